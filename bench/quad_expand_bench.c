@@ -0,0 +1,125 @@
+/**
+ * Microbenchmark of the sprite to vertex expansion: the per vertex setters
+ * SpriteBatch used before, against every QuadExpand kernel the CPU runs.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mrb_lib/vertex.h"
+#include "mrb_lib/sprite.h"
+#include "mrb_lib/quad_expand.h"
+
+/* sprites expanded per run: one worker slice, and a big world */
+static const int benchSizes[] = { 4096, 200000 };
+/* each size runs until this many sprites are expanded */
+#define SPRITES_PER_SIZE 20000000
+#define MAX_SPRITES 200000
+
+static double nowMs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * The old SpriteBatch loop: one call per attribute and vertex, with the
+ * color going through floats
+ */
+static void setterTriangles(Vertex *v, Sprite *const *sprites, int count)
+{
+    const Sprite *sp;
+    int i, j;
+
+    for (i = 0; i < count; i++, v += 6) {
+        sp = sprites[i];
+        vertexSetPos(&v[0], sp->x + sp->width, sp->y + sp->height);
+        vertexSetPos(&v[1], sp->x,             sp->y + sp->height);
+        vertexSetPos(&v[2], sp->x,             sp->y);
+        vertexSetPos(&v[3], sp->x,             sp->y);
+        vertexSetPos(&v[4], sp->x + sp->width, sp->y);
+        vertexSetPos(&v[5], sp->x + sp->width, sp->y + sp->height);
+        vertexSetUV(&v[0], sp->uv.maxX, sp->uv.maxY);
+        vertexSetUV(&v[1], sp->uv.minX, sp->uv.maxY);
+        vertexSetUV(&v[2], sp->uv.minX, sp->uv.minY);
+        vertexSetUV(&v[3], sp->uv.minX, sp->uv.minY);
+        vertexSetUV(&v[4], sp->uv.maxX, sp->uv.minY);
+        vertexSetUV(&v[5], sp->uv.maxX, sp->uv.maxY);
+        for (j = 0; j < 6; j++)
+            vertexSetColor(&v[j], sp->color.r, sp->color.g, sp->color.b,
+                    sp->color.a);
+    }
+}
+
+/**
+ * Runs fn on the first count sprites, many times
+ *
+ * @return the best time in milliseconds
+ */
+static double benchRun(QuadExpandFn fn, Vertex *out, Sprite **ptrs, int count)
+{
+    double best = 1e9, t;
+    int run;
+
+    for (run = 0; run < SPRITES_PER_SIZE / count; run++) {
+        t = nowMs();
+        fn(out, ptrs, count);
+        t = nowMs() - t;
+        if (t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+int main()
+{
+    Sprite *sprites, **ptrs;
+    Vertex *out;
+    double base, t;
+    int i, impl, size, n;
+
+    sprites = calloc(MAX_SPRITES, sizeof(*sprites));
+    ptrs = malloc(MAX_SPRITES * sizeof(*ptrs));
+    out = malloc(MAX_SPRITES * 6 * sizeof(*out));
+    if (!sprites || !ptrs || !out) {
+        fprintf(stderr, "Cannot alloc the benchmark sprites\n");
+        return 1;
+    }
+    for (i = 0; i < MAX_SPRITES; i++) {
+        sprites[i].x = i % 1000 * 16;
+        sprites[i].y = i / 1000 * 16;
+        sprites[i].width = sprites[i].height = 16;
+        sprites[i].color = (Color) { 255, i, 255, 255 };
+        sprites[i].uv = (AABB) { 0, 0, 0.25f, 0.25f };
+        ptrs[i] = &sprites[i];
+    }
+
+    for (size = 0; size < (int) (sizeof(benchSizes) / sizeof(*benchSizes));
+            size++) {
+        n = benchSizes[size];
+        printf("%d sprites, best of %d runs\n", n, SPRITES_PER_SIZE / n);
+        base = benchRun(setterTriangles, out, ptrs, n);
+        printf("  %-8s triangles: %8.3f ms\n", "setters", base);
+        for (impl = 0; impl < QE_NUM_IMPLS; impl++) {
+            if (!quadExpandSupported(impl))
+                continue;
+            t = benchRun(quadExpandGetImpl(impl, 6), out, ptrs, n);
+            printf("  %-8s triangles: %8.3f ms  %5.2fx\n",
+                    quadExpandName(impl), t, base / t);
+            t = benchRun(quadExpandGetImpl(impl, 4), out, ptrs, n);
+            printf("  %-8s quads:     %8.3f ms\n", quadExpandName(impl), t);
+        }
+        // what SpriteBatch gets, with the kernel picked by size
+        t = benchRun(quadExpandGet(6), out, ptrs, n);
+        printf("  %-8s triangles: %8.3f ms  %5.2fx\n", "get", t, base / t);
+    }
+
+    free(out);
+    free(ptrs);
+    free(sprites);
+    return 0;
+}
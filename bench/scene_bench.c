@@ -0,0 +1,797 @@
+/**
+ * End to end benchmark: scripted scenes drawn by the real game loop,
+ * offscreen, for a fixed number of frames and without input. Prints the
+ * frame time percentiles, draw calls and bytes uploaded of each scene,
+ * and a checksum of its last frame, as JSON.
+ *
+ * With --baseline, a previous output, the checksums must match when the
+ * renderer is the same, so a faster frame still draws the same pixels.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "game.h"
+#include "mrb_lib/atlas.h"
+#include "mrb_lib/texture.h"
+#include "mrb_lib/texture_array.h"
+#include "mrb_lib/particles.h"
+#include "mrb_lib/tilemap.h"
+#include "mrb_lib/chunk_world.h"
+
+#define BENCH_WIDTH 800
+#define BENCH_HEIGHT 600
+#define BENCH_FRAMES 300
+/* First frames, uploads and warm caches, left out of the percentiles */
+#define BENCH_WARMUP 10
+#define BENCH_SPRITES 100000
+#define BENCH_TEXTURES 64
+#define BENCH_TEXTURE_SPRITES 4096
+#define BENCH_TEXT_LINES 36
+#define BENCH_PARTICLES 200000
+/* chunks scene: a square of static tiles and the chunks they are split in */
+#define BENCH_CHUNK_TILES 256
+#define BENCH_CHUNK_TILE_SIZE 16.0f
+#define BENCH_CHUNK_SIZE 512.0f
+#define BENCH_MAX_NAME 32
+#define BENCH_MAX_RENDERER 128
+
+typedef struct {
+    const char *name;
+    int (*init)(Game *game);
+    void (*update)(Game *game, unsigned long frame);
+} Scene;
+
+typedef struct {
+    double p50, p95, p99;       // frame times, in milliseconds
+    double drawCalls;           // per frame
+    double bytesUploaded;       // per frame
+    uint64_t checksum;          // of the last frame pixels
+    unsigned long frames;       // frames drawn
+} SceneResult;
+
+/* State of the scene being run, the game is gone once gameInit returns */
+static struct {
+    const Scene *scene;
+    double *times;
+    double lastMs;
+    unsigned long drawCalls, bytesUploaded;
+    uint64_t checksum;
+    unsigned long frames;
+    uint32_t random;
+    Atlas *atlas;
+    AtlasRegion *regions[2];
+    Texture *textures[BENCH_TEXTURES];
+    TextureArray *textureArray; // texture_array scene
+    SpriteBatch *arraySb;       // its sprites
+    Sprite **sprites;
+    int spritesLen;
+    Sprite *hero;               // bricks scene
+    Tilemap *bricks;            // bricks scene
+    ChunkWorld *world;          // chunks scene
+    ParticleSystem *particles;  // particles scene
+    TextLabel *labels[BENCH_TEXT_LINES]; // labels scene, owned by the game
+    char renderer[BENCH_MAX_RENDERER];
+} bench;
+
+static double nowMs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * xorshift32, the same numbers on every run unlike rand, which gameInit
+ * seeds with the time
+ *
+ * @return the next number
+ */
+static uint32_t benchRandom()
+{
+    bench.random ^= bench.random << 13;
+    bench.random ^= bench.random >> 17;
+    bench.random ^= bench.random << 5;
+    return bench.random;
+}
+
+/**
+ * Gets a random float in [min, max)
+ */
+static float benchRandomf(float min, float max)
+{
+    return min + (max - min) * (benchRandom() % 65536) / 65536.0f;
+}
+
+/**
+ * Keeps a sprite to be destroyed with the scene
+ *
+ * @return the sprite, or NULL if it is NULL
+ */
+static Sprite *benchKeep(Sprite *sp)
+{
+    if (sp)
+        bench.sprites[bench.spritesLen++] = sp;
+    return sp;
+}
+
+/**
+ * Loads the brick and hero images in one atlas
+ *
+ * @return false on error
+ */
+static bool benchLoadAtlas()
+{
+    if (!(bench.atlas = atlasNew(0, 0)))
+        return false;
+    if (!(bench.regions[0] = atlasAddImage(bench.atlas,
+                    "resources/red_bricks.png"))
+            || !(bench.regions[1] = atlasAddImage(bench.atlas,
+                    "resources/hero.png")))
+        return false;
+    atlasBuild(bench.atlas);
+
+    return true;
+}
+
+/**
+ * The main.c map: bricks in a Tilemap and the animated hero, with the
+ * camera panning along the map
+ */
+static int bricksInit(Game *game)
+{
+    const char *map =
+      "######################\n"
+      "#                    #\n"
+      "#                    #\n"
+      "#           #        #\n"
+      "#    @ #    #        #\n"
+      "#       #   #        #\n"
+      "#        #            #\n"
+      "#                    #\n"
+      "######################\n";
+    const float size = 64.0f;
+    uint16_t charTiles[256] = { 0 };
+    Tileset tileset;
+    int i, x, y, width, height;
+    Sprite *sp;
+
+    if (!benchLoadAtlas())
+        return -1;
+    tileset = (Tileset) { bench.regions[0]->textureID, bench.regions[0]->uv,
+        1, 1 };
+    charTiles['#'] = 1;
+    tilemapMeasureString(map, &width, &height);
+    if (!(bench.bricks = tilemapNew(game->sBatch->prog, game->sBatch->layout,
+                    tileset, width, height, size, size)))
+        return -1;
+    tilemapLoadString(bench.bricks, map, charTiles);
+    tilemapSetDrawLayer(bench.bricks, 0, true);
+
+    bench.sprites = malloc(sizeof(*bench.sprites));
+    if (!bench.sprites)
+        return -1;
+    for (i = 0, x = 0, y = 0; map[i]; i++, x++) {
+        if (map[i] == '\n') {
+            x = -1;
+            y++;
+        } else if (map[i] == '@') {
+            sp = bench.hero = benchKeep(atlasSpriteNew(bench.regions[1],
+                        x * size, y * size, bench.regions[1]->width / 6,
+                        bench.regions[1]->height / 4));
+            spriteSetNumFrames(sp, 6, 4);
+            spriteSetFrame(sp, 1, 1);
+            spriteSetDrawLayer(sp, 1);
+            sbAddSprite(game->sBatch, sp);
+        }
+    }
+
+    return 0;
+}
+
+static void bricksUpdate(Game *game, unsigned long frame)
+{
+    if (bench.hero)
+        spriteSetFrame(bench.hero, frame / 4 % 6, 1);
+    cameraSetPosition(game->cam, 400 + frame % 600, 300);
+    tilemapSubmit(bench.bricks, game->rq, cameraGetAABB(game->cam));
+}
+
+/**
+ * BENCH_CHUNK_TILES^2 static tiles in a ChunkWorld, with compact vertices
+ * unless the layout is instanced, and the camera panning over them
+ */
+static int chunksInit(Game *game)
+{
+    const float size = BENCH_CHUNK_TILES * BENCH_CHUNK_TILE_SIZE;
+    Sprite *sp;
+    int i;
+
+    if (!benchLoadAtlas())
+        return -1;
+    bench.world = chunkWorldNew(game->sBatch->prog, game->sBatch->layout,
+            aabb(0, 0, size, size), BENCH_CHUNK_SIZE, BENCH_CHUNK_SIZE);
+    if (!bench.world)
+        return -1;
+    chunkWorldSetWorkerPool(bench.world, game->pool);
+    // tiles are on whole units; instances are already smaller than
+    // 4 compact vertices
+    if (game->sBatch->layout != SB_LAYOUT_INSTANCED
+            && !chunkWorldSetCompact(bench.world, true))
+        return -1;
+
+    bench.sprites = malloc(BENCH_CHUNK_TILES * BENCH_CHUNK_TILES
+            * sizeof(*bench.sprites));
+    if (!bench.sprites)
+        return -1;
+    for (i = 0; i < BENCH_CHUNK_TILES * BENCH_CHUNK_TILES; i++) {
+        sp = benchKeep(atlasSpriteNew(bench.regions[0],
+                    i % BENCH_CHUNK_TILES * BENCH_CHUNK_TILE_SIZE,
+                    i / BENCH_CHUNK_TILES * BENCH_CHUNK_TILE_SIZE,
+                    BENCH_CHUNK_TILE_SIZE, BENCH_CHUNK_TILE_SIZE));
+        if (!sp || !chunkWorldAdd(bench.world, sp))
+            return -1;
+    }
+
+    return 0;
+}
+
+static void chunksUpdate(Game *game, unsigned long frame)
+{
+    // diagonally across the chunks, new ones come into view
+    cameraSetPosition(game->cam, BENCH_WIDTH / 2 + frame * 8 % 3000,
+            BENCH_HEIGHT / 2 + frame * 4 % 3000);
+    chunkWorldSubmit(bench.world, game->rq, cameraGetAABB(game->cam));
+}
+
+/**
+ * BENCH_SPRITES small animated sprites in view, a sixteenth of them
+ * moving each frame
+ */
+static int spritesInit(Game *game)
+{
+    Sprite *sp;
+    int i;
+
+    if (!benchLoadAtlas())
+        return -1;
+    if (!(bench.sprites = malloc(BENCH_SPRITES * sizeof(*bench.sprites))))
+        return -1;
+    for (i = 0; i < BENCH_SPRITES; i++) {
+        sp = benchKeep(atlasSpriteNew(bench.regions[1],
+                    benchRandomf(-BENCH_WIDTH / 2, BENCH_WIDTH / 2),
+                    benchRandomf(-BENCH_HEIGHT / 2, BENCH_HEIGHT / 2),
+                    16, 16));
+        if (!sp)
+            return -1;
+        spriteSetNumFrames(sp, 6, 4);
+        spriteSetFrame(sp, benchRandom() % 6, benchRandom() % 4);
+        spriteSetDrawLayer(sp, benchRandom() % 4);
+        sbAddSprite(game->sBatch, sp);
+    }
+
+    return 0;
+}
+
+static void spritesUpdate(Game *game, unsigned long frame)
+{
+    Sprite *sp;
+    int i;
+
+    (void) game;
+    for (i = frame % 16; i < bench.spritesLen; i += 16) {
+        sp = bench.sprites[i];
+        spriteSetPos(sp, sp->x + (frame & 16 ? -1 : 1), sp->y);
+    }
+}
+
+/**
+ * Screen filling text, rebuilt every frame
+ */
+static int textInit(Game *game)
+{
+    (void) game;
+    return 0;
+}
+
+static void textUpdate(Game *game, unsigned long frame)
+{
+    char str[80];
+    int i;
+
+    trSetFontSize(game->tr, 16);
+    trSetSpacing(game->tr, 0.5f);
+    for (i = 0; i < BENCH_TEXT_LINES; i++) {
+        trSetColor(game->tr, color(i * 7, 255 - i * 7, 128, 255));
+        snprintf(str, sizeof(str),
+                "%06lu The quick brown fox jumps over the lazy dog %02d",
+                frame, i);
+        trTextAt(game->tr, 0, i * 16, str);
+    }
+}
+
+/**
+ * The text scene as labels: the text only changes once a second
+ */
+static int labelsInit(Game *game)
+{
+    int i;
+
+    trSetFontSize(game->tr, 16);
+    trSetSpacing(game->tr, 0.5f);
+    for (i = 0; i < BENCH_TEXT_LINES; i++) {
+        trSetColor(game->tr, color(i * 7, 255 - i * 7, 128, 255));
+        if (!(bench.labels[i] = trLabelNew(game->tr, 0, i * 16, "")))
+            return -1;
+    }
+
+    return 0;
+}
+
+static void labelsUpdate(Game *game, unsigned long frame)
+{
+    char str[80];
+    int i;
+
+    (void) game;
+    for (i = 0; i < BENCH_TEXT_LINES; i++) {
+        snprintf(str, sizeof(str),
+                "%06lu The quick brown fox jumps over the lazy dog %02d",
+                frame / 60, i);
+        trLabelSetText(bench.labels[i], str);
+    }
+}
+
+/**
+ * Fills a 32x32 image with a checkerboard of its own color
+ *
+ * @param pixels 32 * 32 RGBA pixels
+ * @param i Index of the image, picks the color
+ */
+static void benchCheckerboard(unsigned char *pixels, int i)
+{
+    unsigned char *p;
+    int j;
+
+    for (j = 0, p = pixels; j < 32 * 32; j++, p += 4) {
+        bool on = ((j % 32) / 4 + (j / 32) / 4) % 2;
+        p[0] = on ? i * 4 : 255;
+        p[1] = on ? 255 - i * 4 : 255;
+        p[2] = on ? (i * 37) % 256 : 255;
+        p[3] = 255;
+    }
+}
+
+/**
+ * BENCH_TEXTURE_SPRITES sprites on a grid, each using one of
+ * BENCH_TEXTURES separate textures in turn
+ */
+static int texturesInit(Game *game)
+{
+    unsigned char pixels[32 * 32 * 4];
+    int i, cols = 64;
+    float w = (float) BENCH_WIDTH / cols;
+    float h = (float) BENCH_HEIGHT / (BENCH_TEXTURE_SPRITES / cols);
+    Sprite *sp;
+
+    for (i = 0; i < BENCH_TEXTURES; i++) {
+        if (!(bench.textures[i] = textureNew(32, 32)))
+            return -1;
+        benchCheckerboard(pixels, i);
+        textureSetPixels(bench.textures[i], pixels, false);
+    }
+    bench.sprites = malloc(BENCH_TEXTURE_SPRITES * sizeof(*bench.sprites));
+    if (!bench.sprites)
+        return -1;
+    for (i = 0; i < BENCH_TEXTURE_SPRITES; i++) {
+        sp = benchKeep(spriteNew(
+                    -BENCH_WIDTH / 2 + (i % cols) * w,
+                    -BENCH_HEIGHT / 2 + (i / cols) * h, w, h,
+                    bench.textures[i % BENCH_TEXTURES]->id));
+        if (!sp)
+            return -1;
+        sbAddSprite(game->sBatch, sp);
+    }
+
+    return 0;
+}
+
+static void texturesUpdate(Game *game, unsigned long frame)
+{
+    (void) game;
+    (void) frame;
+}
+
+/**
+ * The textures scene with the images as the layers of one texture array,
+ * in a batch of its own
+ */
+static int textureArrayInit(Game *game)
+{
+    unsigned char pixels[32 * 32 * 4];
+    int i, cols = 64;
+    float w = (float) BENCH_WIDTH / cols;
+    float h = (float) BENCH_HEIGHT / (BENCH_TEXTURE_SPRITES / cols);
+    Sprite *sp;
+
+    if (!game->arrayProg) {
+        fprintf(stderr, "texture_array: texture arrays not supported\n");
+        return -1;
+    }
+    if (!(bench.textureArray = textureArrayNew(32, 32, BENCH_TEXTURES)))
+        return -1;
+    for (i = 0; i < BENCH_TEXTURES; i++) {
+        benchCheckerboard(pixels, i);
+        textureArrayAddPixels(bench.textureArray, pixels);
+    }
+    textureArrayGenerateMipmaps(bench.textureArray);
+
+    if (!(bench.arraySb = sbNew(game->arrayProg)))
+        return -1;
+    sbInit(bench.arraySb);
+    if (!sbSetLayout(bench.arraySb, SB_LAYOUT_INDEXED)
+            || !sbSetTextureArray(bench.arraySb, true))
+        return -1;
+    bench.sprites = malloc(BENCH_TEXTURE_SPRITES * sizeof(*bench.sprites));
+    if (!bench.sprites)
+        return -1;
+    for (i = 0; i < BENCH_TEXTURE_SPRITES; i++) {
+        sp = benchKeep(textureArraySpriteNew(bench.textureArray,
+                    i % BENCH_TEXTURES,
+                    -BENCH_WIDTH / 2 + (i % cols) * w,
+                    -BENCH_HEIGHT / 2 + (i / cols) * h, w, h));
+        if (!sp)
+            return -1;
+        sbAddSprite(bench.arraySb, sp);
+    }
+
+    return 0;
+}
+
+static void textureArrayUpdate(Game *game, unsigned long frame)
+{
+    (void) frame;
+    sbBuildBatches(bench.arraySb);
+    rqSubmit(game->rq, bench.arraySb);
+}
+
+/**
+ * A fountain of BENCH_PARTICLES live particles, once it is full
+ */
+static int fountainInit(Game *game)
+{
+    SpriteBatch *sb = game->sBatch;
+    PSEmitter emitter = {
+        .angle = 3.14159265f / 2, .spread = 0.6f,
+        .speedMin = 200, .speedMax = 400,
+        .lifeMin = 1, .lifeMax = 2,
+        .size = 4,
+        .gravityX = 0, .gravityY = -300,
+        .color = { 255, 160, 64, 255 },
+    };
+
+    if (!benchLoadAtlas())
+        return -1;
+    bench.particles = psNew(sb->prog, sb->layout == SB_LAYOUT_INSTANCED
+            ? SB_LAYOUT_INSTANCED : SB_LAYOUT_INDEXED, BENCH_PARTICLES,
+            bench.regions[0]->textureID);
+    if (!bench.particles)
+        return -1;
+    psSetEmitter(bench.particles, &emitter);
+    psSetUV(bench.particles, bench.regions[0]->uv);
+
+    return 0;
+}
+
+static void fountainUpdate(Game *game, unsigned long frame)
+{
+    (void) frame;
+    // a fixed step, and as many new particles as die on average
+    psUpdate(bench.particles, 1 / 60.0f);
+    psEmit(bench.particles, BENCH_PARTICLES / 90, 0, -BENCH_HEIGHT / 2);
+    psSubmit(bench.particles, game->rq);
+}
+
+static const Scene scenes[] = {
+    { "bricks", bricksInit, bricksUpdate },
+    { "sprites", spritesInit, spritesUpdate },
+    { "chunks", chunksInit, chunksUpdate },
+    { "text", textInit, textUpdate },
+    { "labels", labelsInit, labelsUpdate },
+    { "textures", texturesInit, texturesUpdate },
+    { "texture_array", textureArrayInit, textureArrayUpdate },
+    { "particles", fountainInit, fountainUpdate },
+};
+
+static int onBenchInit(Game *game)
+{
+    const char *renderer = (const char *) glGetString(GL_RENDERER);
+
+    snprintf(bench.renderer, sizeof(bench.renderer), "%s",
+            renderer ? renderer : "unknown");
+    cameraSetPosition(game->cam, 0, 0);
+    return bench.scene->init(game);
+}
+
+static int onBenchUpdate(Game *game, int ticks)
+{
+    (void) ticks;
+    // driven by the frame number, not the time, so every run is the same
+    bench.scene->update(game, game->totalFrames);
+    return 0;
+}
+
+static void onBenchFrameDrawn(Game *game)
+{
+    double now = nowMs();
+    unsigned char *pixels;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i, len;
+
+    // frame times are taken between the same point of two frames
+    if (bench.frames >= BENCH_WARMUP)
+        bench.times[bench.frames - BENCH_WARMUP] = now - bench.lastMs;
+    bench.lastMs = now;
+    bench.frames++;
+    bench.drawCalls += game->rq->stats.drawCalls;
+    bench.bytesUploaded += game->rq->stats.sprites.bytesUploaded;
+    if (game->totalFrames != game->maxFrames)
+        return;
+
+    // FNV-1a of the last frame
+    len = (size_t) game->win->width * game->win->height * 4;
+    if (!(pixels = malloc(len)))
+        return;
+    windowReadPixels(game->win, pixels);
+    for (i = 0; i < len; i++)
+        hash = (hash ^ pixels[i]) * 1099511628211ULL;
+    bench.checksum = hash;
+    free(pixels);
+}
+
+static void onBenchDelete(Game *game)
+{
+    int i;
+
+    (void) game;
+    sbDelete(bench.arraySb);
+    bench.arraySb = NULL;
+    chunkWorldDelete(bench.world);
+    bench.world = NULL;
+    for (i = 0; i < bench.spritesLen; i++)
+        spriteDelete(bench.sprites[i]);
+    free(bench.sprites);
+    bench.sprites = NULL;
+    bench.spritesLen = 0;
+    for (i = 0; i < BENCH_TEXTURES; i++) {
+        if (bench.textures[i])
+            textureDelete(bench.textures[i]);
+        bench.textures[i] = NULL;
+    }
+    textureArrayDelete(bench.textureArray);
+    bench.textureArray = NULL;
+    tilemapDelete(bench.bricks);
+    bench.bricks = NULL;
+    psDelete(bench.particles);
+    bench.particles = NULL;
+    if (bench.atlas)
+        atlasDelete(bench.atlas);
+    bench.atlas = NULL;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Nearest rank percentile
+ *
+ * @param sorted Values in ascending order
+ * @param len Number of values, at least 1
+ * @param p Percentile, 0 to 100
+ */
+static double percentile(const double *sorted, int len, double p)
+{
+    int rank = (int) ceil(p / 100.0 * len);
+
+    return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+/**
+ * Draws a scene for frames frames in a new game
+ *
+ * @return false if the scene could not run
+ */
+static bool runScene(const Scene *scene, unsigned long frames,
+        int windowFlags, SceneResult *result)
+{
+    Game *game;
+    int len = frames - BENCH_WARMUP;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.scene = scene;
+    bench.random = 2463534242u;
+    if (!(bench.times = malloc(len * sizeof(*bench.times))))
+        return false;
+    bench.lastMs = nowMs();
+    if (!(game = gameNew()))
+        return false;
+    game->onGameInit = onBenchInit;
+    game->onGameUpdate = onBenchUpdate;
+    game->onGameDelete = onBenchDelete;
+    game->onGameFrameDrawn = onBenchFrameDrawn;
+    game->windowFlags = windowFlags;
+    game->maxFrames = frames;
+    // runs the frames, then destroys the game
+    gameInit(game, BENCH_WIDTH, BENCH_HEIGHT, scene->name);
+    if (bench.frames != frames) {
+        fprintf(stderr, "scene %s: drew %lu frames of %lu\n", scene->name,
+                bench.frames, frames);
+        free(bench.times);
+        return false;
+    }
+
+    qsort(bench.times, len, sizeof(*bench.times), compareDouble);
+    result->p50 = percentile(bench.times, len, 50);
+    result->p95 = percentile(bench.times, len, 95);
+    result->p99 = percentile(bench.times, len, 99);
+    result->drawCalls = (double) bench.drawCalls / frames;
+    result->bytesUploaded = (double) bench.bytesUploaded / frames;
+    result->checksum = bench.checksum;
+    result->frames = frames;
+    free(bench.times);
+
+    return true;
+}
+
+/**
+ * Finds the value of a "key": "value" pair in a line
+ *
+ * @param line The line
+ * @param key The key, without quotes
+ * @param value Where to copy the value, BENCH_MAX_RENDERER bytes
+ * @return false if the line has no such pair
+ */
+static bool jsonString(const char *line, const char *key, char *value)
+{
+    char pattern[BENCH_MAX_NAME + 8];
+    const char *start, *end;
+    size_t len;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+    if (!(start = strstr(line, pattern)))
+        return false;
+    start += strlen(pattern);
+    if (!(end = strchr(start, '"')))
+        return false;
+    len = end - start < BENCH_MAX_RENDERER - 1
+        ? (size_t) (end - start) : BENCH_MAX_RENDERER - 1;
+    memcpy(value, start, len);
+    value[len] = '\0';
+
+    return true;
+}
+
+/**
+ * Compares the checksums with those of a previous output
+ *
+ * @param path The previous output
+ * @param renderer The renderer of this run
+ * @param run Scenes of this run, NULL for the ones that did not run
+ * @param results Their results
+ * @return false if a checksum differs
+ */
+static bool checkBaseline(const char *path, const char *renderer,
+        const Scene **run, const SceneResult *results)
+{
+    char line[512], name[BENCH_MAX_RENDERER], value[BENCH_MAX_RENDERER];
+    char checksum[20];
+    bool ok = true;
+    size_t i;
+    FILE *f;
+
+    if (!(f = fopen(path, "r"))) {
+        fprintf(stderr, "Cannot open baseline %s\n", path);
+        return false;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (jsonString(line, "renderer", value) && strcmp(value, renderer)) {
+            fprintf(stderr, "Baseline renderer is %s, not checked\n", value);
+            break;
+        }
+        if (!jsonString(line, "scene", name)
+                || !jsonString(line, "checksum", value))
+            continue;
+        for (i = 0; i < ARR_LEN(scenes); i++) {
+            if (!run[i] || strcmp(run[i]->name, name))
+                continue;
+            snprintf(checksum, sizeof(checksum), "%016llx",
+                    (unsigned long long) results[i].checksum);
+            if (strcmp(checksum, value)) {
+                fprintf(stderr, "scene %s: checksum %s, baseline %s\n",
+                        name, checksum, value);
+                ok = false;
+            }
+        }
+    }
+    fclose(f);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const Scene *run[ARR_LEN(scenes)] = { NULL };
+    SceneResult results[ARR_LEN(scenes)];
+    const char *only = NULL, *baseline = NULL;
+    unsigned long frames = BENCH_FRAMES;
+    int windowFlags = WINDOW_OFFSCREEN;
+    bool ok = true, first = true;
+    size_t i;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--frames") && a + 1 < argc) {
+            frames = strtoul(argv[++a], NULL, 10);
+        } else if (!strcmp(argv[a], "--scene") && a + 1 < argc) {
+            only = argv[++a];
+        } else if (!strcmp(argv[a], "--baseline") && a + 1 < argc) {
+            baseline = argv[++a];
+        } else if (!strcmp(argv[a], "--windowed")) {
+            windowFlags = WINDOW_NOFLAGS;
+        } else {
+            fprintf(stderr, "Usage: %s [--frames N] [--scene NAME] "
+                    "[--baseline FILE] [--windowed]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames <= BENCH_WARMUP) {
+        fprintf(stderr, "At least %d frames\n", BENCH_WARMUP + 1);
+        return 1;
+    }
+
+    for (i = 0; i < ARR_LEN(scenes); i++) {
+        if (only && strcmp(only, scenes[i].name))
+            continue;
+        if (!runScene(&scenes[i], frames, windowFlags, &results[i])) {
+            ok = false;
+            continue;
+        }
+        run[i] = &scenes[i];
+    }
+
+    printf("{\n");
+    printf("  \"renderer\": \"");
+    for (i = 0; bench.renderer[i]; i++)
+        if (bench.renderer[i] != '"' && bench.renderer[i] != '\\')
+            putchar(bench.renderer[i]);
+    printf("\",\n");
+    printf("  \"frames\": %lu,\n", frames);
+    printf("  \"scenes\": [\n");
+    for (i = 0; i < ARR_LEN(scenes); i++) {
+        if (!run[i])
+            continue;
+        printf("%s    {\"scene\": \"%s\", \"p50_ms\": %.3f, "
+                "\"p95_ms\": %.3f, \"p99_ms\": %.3f, "
+                "\"draw_calls\": %.1f, \"bytes_uploaded\": %.0f, "
+                "\"checksum\": \"%016llx\"}",
+                first ? "" : ",\n", run[i]->name, results[i].p50,
+                results[i].p95, results[i].p99, results[i].drawCalls,
+                results[i].bytesUploaded,
+                (unsigned long long) results[i].checksum);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+
+    if (baseline && !checkBaseline(baseline, bench.renderer, run, results))
+        ok = false;
+
+    return ok ? 0 : 1;
+}
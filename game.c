@@ -5,6 +5,7 @@
 #include <math.h>
 #include "game.h"
 #include "mrb_lib/timer.h"
+#include "mrb_lib/texture_array.h"
 
 /**
  * Creates a new game
@@ -37,12 +38,65 @@ static bool gameInitShaders(Game *game)
         return false;
     glProgramAddAttribute(game->prog, "vertexPosition");
     glProgramAddAttribute(game->prog, "vertexColor");
+    glProgramBindAttribute(game->prog, SB_ATTRIB_DRAW_DEPTH, "drawDepth");
     if (!glProgramLinkShaders(game->prog))
         return false;
 
     return true;
 }
 
+/**
+ * Compile and link the instanced sprite shaders, if the context can use them
+ */
+static bool gameInitInstancedShaders(Game *game)
+{
+    if (!GLEW_VERSION_3_3)
+        return false;
+    if (!(game->instProg = glProgramNew()))
+        return false;
+    if (!glProgramCompileShaders(game->instProg, "shaders/sprite_shader_instanced"))
+        goto err;
+    glProgramAddAttribute(game->instProg, "instanceRect");
+    glProgramAddAttribute(game->instProg, "instanceColor");
+    glProgramAddAttribute(game->instProg, "instanceUV");
+    if (!glProgramLinkShaders(game->instProg))
+        goto err;
+
+    return true;
+err:
+    glProgramDelete(game->instProg);
+    game->instProg = NULL;
+    return false;
+}
+
+/**
+ * Compile and link the texture array sprite shaders, if the context can
+ * use them, see sbSetTextureArray
+ */
+static bool gameInitArrayShaders(Game *game)
+{
+    if (!textureArraySupported())
+        return false;
+    if (!(game->arrayProg = glProgramNew()))
+        return false;
+    if (!glProgramCompileShaders(game->arrayProg, "shaders/sprite_shader_array"))
+        goto err;
+    glProgramAddAttribute(game->arrayProg, "vertexPosition");
+    glProgramAddAttribute(game->arrayProg, "vertexColor");
+    glProgramAddAttribute(game->arrayProg, "vertexUV");
+    // declared before vertexLayer, automatic locations could swap them
+    glProgramBindAttribute(game->arrayProg, SB_ATTRIB_LAYER, "vertexLayer");
+    glProgramBindAttribute(game->arrayProg, SB_ATTRIB_DRAW_DEPTH, "drawDepth");
+    if (!glProgramLinkShaders(game->arrayProg))
+        goto err;
+
+    return true;
+err:
+    glProgramDelete(game->arrayProg);
+    game->arrayProg = NULL;
+    return false;
+}
+
 /**
  * Initialize the game
  */
@@ -51,7 +105,7 @@ bool gameInit(Game *game, int winWidth, int winHeight, const char *title)
     game->state = GAME_PLAYING;
     srand(time(NULL));
 
-    if (!(game->win = windowNew(title, winWidth, winHeight, 0))) {
+    if (!(game->win = windowNew(title, winWidth, winHeight, game->windowFlags))) {
         fprintf(stderr, "Cannot init window\n");
         return false;
     }
@@ -77,6 +131,31 @@ bool gameInit(Game *game, int winWidth, int winHeight, const char *title)
 
     game->sBatch = sbNew(game->prog);
     sbInit(game->sBatch);
+    // one record per sprite if instancing is available
+    if (gameInitInstancedShaders(game)
+            && sbSetLayout(game->sBatch, SB_LAYOUT_INSTANCED))
+        game->sBatch->prog = game->instProg;
+    else
+        sbSetLayout(game->sBatch, SB_LAYOUT_INDEXED);
+    // for batches of texture array sprites, optional
+    gameInitArrayShaders(game);
+    // mostly static scene: upload only the sprites that changed
+    sbSetUploadMode(game->sBatch, SB_UPLOAD_INCREMENTAL);
+    // build only what the camera sees; the index grows if the world does
+    sbSetCulling(game->sBatch, aabb(
+                -GAME_WORLD_SCREENS * winWidth, -GAME_WORLD_SCREENS * winHeight,
+                GAME_WORLD_SCREENS * winWidth, GAME_WORLD_SCREENS * winHeight));
+    // big full builds write their vertices on all the cores
+    if ((game->pool = workerPoolNew(0)))
+        sbSetWorkerPool(game->sBatch, game->pool);
+    if (!(game->rq = rqNew()))
+        return false;
+    // GPU times of the frame and of the queue, when the context can
+    game->frameTimer = gpuTimerNew();
+    rqSetGPUTimer(game->rq, true);
+    // layers of the same texture in one call, instances draw them anyway
+    if (game->sBatch->layout != SB_LAYOUT_INSTANCED && sbMultiDrawSupported())
+        sbSetMultiDraw(game->sBatch, true);
 
     //game->fontBatch = sbNew(game->prog);
     //sbInit(game->fontBatch);
@@ -101,6 +180,14 @@ void gameDelete(Game *game)
         glProgramDelete(game->prog);
         game->prog = NULL;
     }
+    if (game->instProg) {
+        glProgramDelete(game->instProg);
+        game->instProg = NULL;
+    }
+    if (game->arrayProg) {
+        glProgramDelete(game->arrayProg);
+        game->arrayProg = NULL;
+    }
     if (game->inmgr) {
         inMgrDelete(game->inmgr);
         game->inmgr = NULL;
@@ -109,10 +196,14 @@ void gameDelete(Game *game)
         cameraDelete(game->cam);
         game->cam = NULL;
     }
+    rqDelete(game->rq);
+    gpuTimerDelete(game->frameTimer);
     sbDelete(game->sBatch);
+    workerPoolDelete(game->pool);
     //sbDelete(game->fontBatch);
 
     trDelete(game->tr);
+    arenaFrameDelete();
 
     windowDelete(game->win);
     free(game);
@@ -138,6 +229,7 @@ void gameLoop(Game *game)
     Timer *timer = timerNew(SDL_GetTicks());
 
     while (game->state == GAME_PLAYING) {
+        unsigned long heapAllocs = memHeapAllocs();
         /* Compute the timer */
         uint32_t diffTicks = timerUpdate(timer, SDL_GetTicks());
         updateFPS(game, diffTicks);
@@ -147,32 +239,39 @@ void gameLoop(Game *game)
         if (game->inmgr->quitRequested) {
             game->state = GAME_OVER;
         }
+        if (game->maxFrames && game->totalFrames >= game->maxFrames)
+            game->state = GAME_OVER;
 
+        gpuTimerBegin(game->frameTimer);
         windowClear();
         trSetCamera(game->tr, game->cam);
         game->onGameUpdate(game, diffTicks);
 
         cameraUpdate(game->cam);
-        glProgramUse(game->prog);
-        glActiveTexture(GL_TEXTURE0);
-
-        // send matrix location
-        GLint pLocation = glGetUniformLocation(game->prog->programID, "P");
-        glUniformMatrix4fv(
-                pLocation, 1, GL_FALSE,
-                &(game->cam->cameraMatrix.m[0][0]));
+        rqSetProjection(game->rq, &game->cam->cameraMatrix);
 
         // build vertices //
+        sbSetView(game->sBatch, cameraGetAABB(game->cam));
         sbBuildBatches(game->sBatch);
-        sbDrawBatches(game->sBatch);
+        rqSubmit(game->rq, game->sBatch);
 
-        trRender(game->tr);
+        trSubmit(game->tr, game->rq);
 
-        glProgramUnuse(game->prog);
+        // one sorted submit of everything above
+        rqFlush(game->rq);
+        gpuTimerEnd(game->frameTimer);
+        if (game->onGameFrameDrawn)
+            game->onGameFrameDrawn(game);
         windowUpdate(game->win);
+
+        game->glStats = *glStateGetStats();
+        glStateResetStats();
+        game->frameHeapAllocs = memHeapAllocs() - heapAllocs;
+        // transient data of this frame is gone
+        arenaReset(arenaFrame());
     }
     //
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0);
     timerDelete(timer);
 }
 
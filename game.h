@@ -10,8 +10,15 @@
 #include "mrb_lib/sprite_batch.h"
 #include "mrb_lib/list.h"
 #include "mrb_lib/text_renderer.h"
+#include "mrb_lib/arena.h"
+#include "mrb_lib/render_queue.h"
+#include "mrb_lib/gl_state.h"
+#include "mrb_lib/gpu_timer.h"
+#include "mrb_lib/mem_debug.h"
 
 #define ARR_LEN(a) sizeof(a)/sizeof(*a)
+// initial size of the sprite index, in screens on each side of the origin
+#define GAME_WORLD_SCREENS 4
 
 typedef enum {
 	GAME_PLAYING,
@@ -22,24 +29,38 @@ typedef struct Game Game;
 typedef int (*onGameInitFn) (Game *game);
 typedef int (*onGameUpdateFn) (Game *game, int ticks);
 typedef void (*onGameDeleteFn) (Game *game);
+typedef void (*onGameFrameFn) (Game *game);
 
 struct Game {
 	Window *win;
 	GLProgram *prog;
+	GLProgram *instProg;	// instanced sprites program, or NULL
+	GLProgram *arrayProg;	// texture array sprites program, or NULL
 	Camera *cam;
 	InMgr *inmgr;
 	GameStates state;
 	float scaleSpeed;
+	int windowFlags;	// WindowFlags of the window gameInit opens
+	unsigned long maxFrames;	// frames before the game ends, 0 for no limit
 
 	SpriteBatch *sBatch;
+	WorkerPool *pool;	// threads building the sprite vertices
+	RenderQueue *rq;	// everything drawn in a frame, sorted
+	GLStateStats glStats;	// GL state calls of the last frame
+	GPUTimer *frameTimer;	// GPU time of the frames, or NULL
 
     TextRenderer *tr;
     onGameInitFn onGameInit; 
     onGameUpdateFn onGameUpdate; 
     onGameDeleteFn onGameDelete; 
+    // the frame is drawn but not shown yet, its pixels can be read
+    // with windowReadPixels; optional
+    onGameFrameFn onGameFrameDrawn;
 
     int fps;
 	unsigned long totalFrames;
+	unsigned long frameHeapAllocs;	// heap allocations of the last frame,
+					// counted in MEM_DEBUG builds
 	void *priv;
 };
 
@@ -3,6 +3,8 @@
 #include "mrb_lib/vec2f.h"
 #include "mrb_lib/inmgr.h"
 #include "mrb_lib/text_renderer.h"
+#include "mrb_lib/atlas.h"
+#include "mrb_lib/tilemap.h"
 
 int onGameInit(Game *game);
 int onGameUpdate(Game *game, int ticks);
@@ -30,29 +32,59 @@ typedef struct {
 
 char *textures[] = {
     "resources/red_bricks.png",
-    "resources/hero.png",
-    "resources/bfont.png"
+    "resources/hero.png"
 };
-enum { RBRICK, HERO, FONT, NUM_TEXTURES };
+enum { RBRICK, HERO, NUM_TEXTURES };
 
 #define BRICKSZ 64.0f
 #define PLAYER_NFRAMES_X 6
 #define PLAYER_NFRAMES_Y 4
 
+/* Most bricks the player can overlap at once */
+#define MAX_BRICK_HITS 16
+
+/* Lines of statistics drawn over the game, see printFPS */
+enum {
+    HUD_FPS, HUD_UPLOAD, HUD_DRAWS, HUD_GL, HUD_GPU, HUD_HEAP,
+    HUD_LINES
+};
+#define HUD_LINE_HEIGHT 24
+
 typedef struct {
     int mapWidth, mapHeight;
     char *map;
-    Texture *textures[NUM_TEXTURES];
+    Tilemap *bricks;
+    Atlas *atlas;
+    AtlasRegion *regions[NUM_TEXTURES];
     Array *entities;
     Player *player;
+    TextLabel *hud[HUD_LINES];
 } UsrGame;
 
-int main()
+/* Frames drawn by --headless, unless --frames is given */
+#define HEADLESS_FRAMES 600
+
+int main(int argc, char **argv)
 {
+    int i;
     Game *game = gameNew();
     if (!game)
         return -1;
 
+    // --headless: draw offscreen, like on a build machine without display
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--headless")) {
+            game->windowFlags = WINDOW_OFFSCREEN;
+            if (!game->maxFrames)
+                game->maxFrames = HEADLESS_FRAMES;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            game->maxFrames = strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [--headless] [--frames N]\n", argv[0]);
+            return -1;
+        }
+    }
+
     game->onGameInit = onGameInit;
     game->onGameUpdate = onGameUpdate;
     game->onGameDelete = onGameDelete;
@@ -86,12 +118,42 @@ int onGameInit(Game *game)
 
     usrGame->entities = arrayNew();
 
+    // all the images share one texture, so they are drawn together
+    if (!(usrGame->atlas = atlasNew(0, 0)))
+        return -1;
     for (i = 0; i < NUM_TEXTURES; i++)
-        if (!(usrGame->textures[i] = loadTexture(textures[i])))
+        if (!(usrGame->regions[i] = atlasAddImage(usrGame->atlas, textures[i])))
+            return -1;
+    atlasBuild(usrGame->atlas);
+
+    // kept from frame to frame, only rebuilt when the numbers change
+    trSetFontSize(game->tr, 24);
+    trSetSpacing(game->tr, 0.5f);
+    trSetColor(game->tr, color(0, 128, 0, 255));
+    for (i = 0; i < HUD_LINES; i++)
+        if (!(usrGame->hud[i] = trLabelNew(game->tr, 0, i * HUD_LINE_HEIGHT,
+                        "")))
             return -1;
 
+    // the bricks are tiles: 2 bytes each instead of an Entity and a Sprite
+    uint16_t charTiles[256] = { 0 };
+    Tileset tileset = {
+        usrGame->regions[RBRICK]->textureID, usrGame->regions[RBRICK]->uv,
+        1, 1
+    };
+
+    charTiles['#'] = 1;
+    tilemapMeasureString(usrGame->map, &usrGame->mapWidth,
+            &usrGame->mapHeight);
+    if (!(usrGame->bricks = tilemapNew(game->sBatch->prog,
+            game->sBatch->layout, tileset,
+            usrGame->mapWidth, usrGame->mapHeight, BRICKSZ, BRICKSZ)))
+        return -1;
+    tilemapLoadString(usrGame->bricks, usrGame->map, charTiles);
+    // background: hidden parts are not shaded
+    tilemapSetDrawLayer(usrGame->bricks, 0, true);
+
     int mapLen = strlen(usrGame->map) - 1;
-    Entity *brick;
     Color col;
 
     for (i = 0, x = 0, y = 0; i < mapLen; i++) {
@@ -100,32 +162,19 @@ int onGameInit(Game *game)
                 x = 0;
                 y++;
                 continue;
-            case '#':
-                brick = calloc(1, sizeof(*brick));
-                brick->pos = vec2f(x * BRICKSZ, y * BRICKSZ);
-                brick->dim = vec2f(BRICKSZ, BRICKSZ);
-                brick->sprite = spriteNew(
-                       brick->pos.x, brick->pos.y, BRICKSZ, BRICKSZ,
-                       usrGame->textures[RBRICK]->id
-                );
-                col = color(255, 255, 255, 255);
-                spriteSetColor(brick->sprite, &col);
-                sbAddSprite(game->sBatch, brick->sprite);
-                arrayPush(usrGame->entities, brick);
-                break;
             case '@':
                 player = calloc(1, sizeof(*player));
                 player->update = playerUpdate;
                 player->speed = 0.3;
                 player->ent.pos = vec2f(x * BRICKSZ, y * BRICKSZ);
                 player->ent.dim = vec2f(
-                        usrGame->textures[HERO]->width / PLAYER_NFRAMES_X,
-                        usrGame->textures[HERO]->height / PLAYER_NFRAMES_Y
+                        usrGame->regions[HERO]->width / PLAYER_NFRAMES_X,
+                        usrGame->regions[HERO]->height / PLAYER_NFRAMES_Y
                 );
-                player->ent.sprite = spriteNew(
+                player->ent.sprite = atlasSpriteNew(
+                       usrGame->regions[HERO],
                        player->ent.pos.x, player->ent.pos.y,
-                       player->ent.dim.x, player->ent.dim.y,
-                       usrGame->textures[HERO]->id
+                       player->ent.dim.x, player->ent.dim.y
                 );
                 col = color(255, 255, 255, 255);
                 spriteSetColor(player->ent.sprite, &col);
@@ -134,10 +183,12 @@ int onGameInit(Game *game)
                         PLAYER_NFRAMES_X, PLAYER_NFRAMES_Y
                 );
                 spriteSetFrame(player->ent.sprite, 1, 1);
+                spriteSetDrawLayer(player->ent.sprite, 1);
                 sbAddSprite(game->sBatch, player->ent.sprite);
                 arrayPush(usrGame->entities, player);
                 usrGame->player = player;
                 break;
+            case '#':
             case ' ':
                 break;
             default:
@@ -146,8 +197,6 @@ int onGameInit(Game *game)
         }
         x++;
     }
-    usrGame->mapWidth = x;
-    usrGame->mapHeight = y;
 
     return 0;
 }
@@ -237,23 +286,35 @@ int checkCollisions(Game *game)
     int i;
     UsrGame *usrGame = game->priv;
     Player *player = usrGame->player;
-    Entity *ent;
-
-    arrayForEach(usrGame->entities, ent, i) {
-        if ((Entity *) player == ent)
-            continue;
-        if (isColliding((Rect *) player, (Rect *) ent)) {
-            Vec2f distVec = getDistance((Rect *) ent, (Rect *) player);
+    TileHit hits[MAX_BRICK_HITS];
+    Rect brick;
+    int len;
+
+    // only the bricks around the player, looked up in the map
+    len = tilemapQuery(usrGame->bricks, aabb(
+                player->ent.pos.x, player->ent.pos.y,
+                player->ent.pos.x + player->ent.dim.x,
+                player->ent.pos.y + player->ent.dim.y),
+            hits, MAX_BRICK_HITS);
+    for (i = 0; i < len; i++) {
+        brick = (Rect) {
+            hits[i].bounds.minX, hits[i].bounds.minY,
+            hits[i].bounds.maxX - hits[i].bounds.minX,
+            hits[i].bounds.maxY - hits[i].bounds.minY
+        };
+        // an earlier brick may have pushed the player out of this one
+        if (isColliding((Rect *) player, &brick)) {
+            Vec2f distVec = getDistance(&brick, (Rect *) player);
             if (fabs(distVec.x) > fabs(distVec.y)) {
                 if (distVec.x < 0)
-                    player->ent.pos.x = ent->pos.x - player->ent.dim.x;
+                    player->ent.pos.x = brick.x - player->ent.dim.x;
                 else
-                    player->ent.pos.x = ent->pos.x + ent->dim.x;
+                    player->ent.pos.x = brick.x + brick.width;
             } else {
                 if (distVec.y < 0)
-                    player->ent.pos.y = ent->pos.y - player->ent.dim.y;
+                    player->ent.pos.y = brick.y - player->ent.dim.y;
                 else
-                    player->ent.pos.y = ent->pos.y + ent->dim.y;
+                    player->ent.pos.y = brick.y + brick.height;
             }
             spriteSetPos(
                     player->ent.sprite, 
@@ -267,13 +328,51 @@ int checkCollisions(Game *game)
 
 void printFPS(Game *game)
 {
+    UsrGame *usrGame = game->priv;
+    TextLabel **hud = usrGame->hud;
     char str[64];
-    trSetFontSize(game->tr, 24);
-    trSetSpacing(game->tr, 0.5f);
-    trSetColor(game->tr, color(0, 128, 0, 255));
-    if (game->fps) {
-        snprintf(str, sizeof(str), "FPS: %d", game->fps);
-        trTextAt(game->tr, 0, 0, str);
+    int i;
+
+    for (i = 0; i < HUD_LINES; i++)
+        trLabelSetVisible(hud[i], game->fps != 0);
+    if (!game->fps)
+        return;
+    snprintf(str, sizeof(str), "FPS: %d", game->fps);
+    trLabelSetText(hud[HUD_FPS], str);
+    snprintf(str, sizeof(str), "Upload: %luB built: %d calls: %d vis: %d",
+            game->sBatch->stats.bytesUploaded,
+            game->sBatch->stats.spritesBuilt,
+            game->sBatch->stats.uploadCalls,
+            game->sBatch->stats.spritesVisible);
+    trLabelSetText(hud[HUD_UPLOAD], str);
+    snprintf(str, sizeof(str), "Draws: %d prog: %d tex: %d vao: %d",
+            game->rq->stats.drawCalls,
+            game->rq->stats.programChanges,
+            game->rq->stats.textureChanges,
+            game->rq->stats.vaoChanges);
+    trLabelSetText(hud[HUD_DRAWS], str);
+    snprintf(str, sizeof(str), "GL state calls: %lu elided: %lu",
+            game->glStats.calls, game->glStats.elided);
+    trLabelSetText(hud[HUD_GL], str);
+    if (game->frameTimer && game->rq->gpuTimer) {
+        GPUTimerStats frame, queue;
+        gpuTimerGetStats(game->frameTimer, &frame);
+        gpuTimerGetStats(game->rq->gpuTimer, &queue);
+        snprintf(str, sizeof(str),
+                "GPU ms frame: %.2f max %.2f queue: %.2f max %.2f",
+                frame.averageMs, frame.maxMs,
+                queue.averageMs, queue.maxMs);
+        trLabelSetText(hud[HUD_GPU], str);
+    } else {
+        trLabelSetVisible(hud[HUD_GPU], false);
+    }
+    if (memDebugEnabled()) {
+        snprintf(str, sizeof(str), "Heap allocs: %lu arena: %luB",
+                game->frameHeapAllocs,
+                (unsigned long) arenaFrame()->peak);
+        trLabelSetText(hud[HUD_HEAP], str);
+    } else {
+        trLabelSetVisible(hud[HUD_HEAP], false);
     }
 }
 
@@ -285,6 +384,7 @@ int onGameUpdate(Game *game, int ticks)
         player->update(game, (Entity *) player, ticks);
     checkCollisions(game);
     cameraSetPosition(game->cam, player->ent.pos.x, player->ent.pos.y);
+    tilemapSubmit(usrGame->bricks, game->rq, cameraGetAABB(game->cam));
     printFPS(game);
 
     return 0;
@@ -297,8 +397,10 @@ void onGameDelete(Game *game)
     Entity *entity;
 
     free(usrGame->map);
-    for (i = 0; i < NUM_TEXTURES; i++)
-        free(usrGame->textures[i]);
+    tilemapDelete(usrGame->bricks);
+    for (i = 0; i < HUD_LINES; i++)
+        trLabelDelete(game->tr, usrGame->hud[i]);
+    atlasDelete(usrGame->atlas);
 
     arrayForEach(usrGame->entities, entity, i) {
         if (entity->sprite)
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include "arena.h"
+
+static Arena *frame = NULL;
+
+/**
+ * Allocates a block and makes it the current one
+ *
+ * @param arena The arena
+ * @param minSize Minimum number of usable bytes
+ * @return the new block or NULL on error
+ */
+static ArenaBlock *arenaAddBlock(Arena *arena, size_t minSize)
+{
+    ArenaBlock *block;
+    size_t size = arena->blockSize;
+
+    while (size < minSize)
+        size *= 2;
+    if (!(block = malloc(sizeof(*block) + size))) {
+        fprintf(stderr, "Cannot alloc an arena block\n");
+        return NULL;
+    }
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->blockAllocs++;
+
+    return block;
+}
+
+Arena *arenaNew(size_t blockSize)
+{
+    Arena *arena;
+
+    if (!(arena = calloc(1, sizeof(*arena)))) {
+        fprintf(stderr, "Cannot alloc Arena\n");
+        return NULL;
+    }
+    arena->blockSize = blockSize > 0 ? blockSize : ARENA_BLOCK_SIZE;
+    if (!arenaAddBlock(arena, arena->blockSize)) {
+        free(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+/**
+ * Frees all the blocks of the arena
+ *
+ * @param arena The arena
+ */
+static void arenaFreeBlocks(Arena *arena)
+{
+    ArenaBlock *block, *next;
+
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    arena->blocks = NULL;
+}
+
+void arenaDelete(Arena *arena)
+{
+    if (!arena)
+        return;
+    arenaFreeBlocks(arena);
+    free(arena);
+}
+
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    ArenaBlock *block;
+    uintptr_t start;
+    size_t pad;
+
+    if (!arena)
+        return NULL;
+    block = arena->blocks;
+    start = (uintptr_t) (block->data + block->used);
+    pad = (ARENA_ALIGN - start % ARENA_ALIGN) % ARENA_ALIGN;
+    if (block->used + pad + size > block->size) {
+        if (!(block = arenaAddBlock(arena, size + ARENA_ALIGN)))
+            return NULL;
+        start = (uintptr_t) block->data;
+        pad = (ARENA_ALIGN - start % ARENA_ALIGN) % ARENA_ALIGN;
+    }
+    block->used += pad + size;
+    arena->used += pad + size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+
+    return (void *) (start + pad);
+}
+
+void arenaReset(Arena *arena)
+{
+    if (!arena)
+        return;
+    if (arena->blocks->next) {
+        // grow to a single block holding the peak, with room to align
+        arenaFreeBlocks(arena);
+        arena->blockAllocs = 0;
+        if (!arenaAddBlock(arena, arena->peak + arena->peak / 8)) {
+            // keep the arena usable with the default size
+            arenaAddBlock(arena, arena->blockSize);
+        }
+    }
+    arena->blocks->used = 0;
+    arena->used = 0;
+    arena->blockAllocs = 0;
+}
+
+Arena *arenaFrame()
+{
+    if (!frame)
+        frame = arenaNew(0);
+
+    return frame;
+}
+
+void arenaFrameDelete()
+{
+    arenaDelete(frame);
+    frame = NULL;
+}
+
+#ifdef COMPILE_TESTS
+void arenaTest()
+{
+    Arena *arena;
+    char *a, *b;
+    int i;
+
+    printf("Testing Arena\n");
+    assert((arena = arenaNew(1024)));
+
+    a = arenaAlloc(arena, 3);
+    b = arenaAlloc(arena, 5);
+    assert(a && b);
+    assert((uintptr_t) a % ARENA_ALIGN == 0);
+    assert((uintptr_t) b % ARENA_ALIGN == 0);
+    assert(b >= a + 3);
+
+    // overflow the first block, then bigger than a block
+    for (i = 0; i < 100; i++)
+        assert(arenaAlloc(arena, 100));
+    assert(arenaAlloc(arena, 4000));
+    assert(arena->blocks->next);
+    assert(arena->blockAllocs > 0);
+
+    // after a reset the same load fits in one block, without allocating
+    arenaReset(arena);
+    assert(!arena->blocks->next);
+    assert(arena->used == 0);
+    arenaAlloc(arena, 3);
+    arenaAlloc(arena, 5);
+    for (i = 0; i < 100; i++)
+        assert(arenaAlloc(arena, 100));
+    assert(arenaAlloc(arena, 4000));
+    assert(!arena->blocks->next);
+    assert(arena->blockAllocs == 0);
+
+    arenaDelete(arena);
+}
+#endif // COMPILE_TESTS
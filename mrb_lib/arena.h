@@ -0,0 +1,87 @@
+/**
+ * Linear (bump) allocator for short lived data.
+ *
+ * Allocations are carved out of big blocks and never freed one by one;
+ * arenaReset releases all of them at once. The frame arena (arenaFrame)
+ * is reset by the game loop at the end of every frame, so anything taken
+ * from it is only valid until then.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Alignment of every allocation */
+#define ARENA_ALIGN 16
+/* Default size of a block */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+    ArenaBlock *next;       // previous (full) block
+    size_t size;            // usable bytes in data
+    size_t used;            // bytes handed out
+    unsigned char data[];
+};
+
+typedef struct {
+    ArenaBlock *blocks;     // current block, followed by the full ones
+    size_t blockSize;       // minimum size of a new block
+    size_t used;            // bytes handed out since the last reset
+    size_t peak;            // highest used between two resets
+    int blockAllocs;        // blocks allocated since the last reset
+} Arena;
+
+/**
+ * Creates a new arena
+ *
+ * @param blockSize Size of each block, 0 for ARENA_BLOCK_SIZE
+ * @return a new Arena or NULL on error
+ */
+Arena *arenaNew(size_t blockSize);
+
+/**
+ * Destroys the arena and everything allocated from it
+ *
+ * @param arena The arena
+ */
+void arenaDelete(Arena *arena);
+
+/**
+ * Allocates memory from the arena. A new block is added if the current
+ * one is full.
+ *
+ * @param arena The arena
+ * @param size Number of bytes
+ * @return ARENA_ALIGN aligned memory or NULL on error
+ */
+void *arenaAlloc(Arena *arena, size_t size);
+
+/**
+ * Releases everything allocated from the arena. If it needed more than one
+ * block, they are merged into a single one big enough for the peak use,
+ * so the same load does not allocate again.
+ *
+ * @param arena The arena
+ */
+void arenaReset(Arena *arena);
+
+/**
+ * Gets the frame arena, creating it on first use
+ *
+ * @return the frame arena or NULL on error
+ */
+Arena *arenaFrame();
+
+/**
+ * Destroys the frame arena
+ */
+void arenaFrameDelete();
+
+/**
+ * Internal self test
+ */
+void arenaTest();
+
+#endif // ARENA_H
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "atlas.h"
+
+/**
+ * Skyline packer
+ */
+
+bool skylineInit(Skyline *sl, int width, int height)
+{
+    sl->width = width;
+    sl->height = height;
+    sl->size = 16;
+    sl->len = 1;
+    if (!(sl->nodes = malloc(sl->size * sizeof(*sl->nodes)))) {
+        fprintf(stderr, "skylineInit: cannot alloc nodes\n");
+        return false;
+    }
+    sl->nodes[0] = (SkylineNode) { 0, 0, width };
+
+    return true;
+}
+
+void skylineFree(Skyline *sl)
+{
+    free(sl->nodes);
+    sl->nodes = NULL;
+    sl->len = sl->size = 0;
+}
+
+/**
+ * Checks if a rectangle can sit on the skyline starting at node idx
+ *
+ * @param sl The skyline
+ * @param idx Index of the leftmost node under the rectangle
+ * @param width Rectangle width
+ * @param height Rectangle height
+ * @return the top y where the rectangle rests, or -1 if it does not fit
+ */
+static int skylineFit(Skyline *sl, int idx, int width, int height)
+{
+    int y = 0, left = width;
+
+    if (sl->nodes[idx].x + width > sl->width)
+        return -1;
+    for (; left > 0; idx++) {
+        if (sl->nodes[idx].y > y)
+            y = sl->nodes[idx].y;
+        if (y + height > sl->height)
+            return -1;
+        left -= sl->nodes[idx].width;
+    }
+
+    return y;
+}
+
+bool skylineInsert(Skyline *sl, int width, int height, int *x, int *y)
+{
+    int i, fy, best = -1, bestY = 0, bestWidth = 0;
+    SkylineNode *prev, *node;
+
+    if (width <= 0 || height <= 0)
+        return false;
+    // bottom-left: lowest resting place, then the narrowest segment
+    for (i = 0; i < sl->len; i++) {
+        if ((fy = skylineFit(sl, i, width, height)) < 0)
+            continue;
+        if (best < 0 || fy < bestY
+                || (fy == bestY && sl->nodes[i].width < bestWidth)) {
+            best = i;
+            bestY = fy;
+            bestWidth = sl->nodes[i].width;
+        }
+    }
+    if (best < 0)
+        return false;
+
+    if (sl->len == sl->size) {
+        int size = sl->size * 2;
+        SkylineNode *nodes = realloc(sl->nodes, size * sizeof(*nodes));
+        if (!nodes) {
+            fprintf(stderr, "skylineInsert: cannot realloc nodes\n");
+            return false;
+        }
+        sl->nodes = nodes;
+        sl->size = size;
+    }
+    *x = sl->nodes[best].x;
+    *y = bestY;
+    memmove(&sl->nodes[best + 1], &sl->nodes[best],
+            (sl->len - best) * sizeof(*sl->nodes));
+    sl->nodes[best] = (SkylineNode) { *x, bestY + height, width };
+    sl->len++;
+
+    // cut the segments now covered by the new one
+    for (i = best + 1; i < sl->len; i++) {
+        prev = &sl->nodes[i - 1];
+        node = &sl->nodes[i];
+        int shrink = prev->x + prev->width - node->x;
+        if (shrink <= 0)
+            break;
+        node->x += shrink;
+        node->width -= shrink;
+        if (node->width > 0)
+            break;
+        memmove(node, node + 1, (sl->len - i - 1) * sizeof(*node));
+        sl->len--;
+        i--;
+    }
+    // merge neighbours at the same height
+    for (i = 0; i < sl->len - 1; i++) {
+        if (sl->nodes[i].y == sl->nodes[i + 1].y) {
+            sl->nodes[i].width += sl->nodes[i + 1].width;
+            memmove(&sl->nodes[i + 1], &sl->nodes[i + 2],
+                    (sl->len - i - 2) * sizeof(*sl->nodes));
+            sl->len--;
+            i--;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Atlas
+ */
+
+Atlas *atlasNew(int pageWidth, int pageHeight)
+{
+    Atlas *atlas;
+    GLint maxSize = 0;
+
+    if (!(atlas = calloc(1, sizeof(*atlas)))) {
+        fprintf(stderr, "Cannot alloc Atlas\n");
+        return NULL;
+    }
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    atlas->pageWidth = pageWidth > 0 ? pageWidth : ATLAS_PAGE_SIZE;
+    atlas->pageHeight = pageHeight > 0 ? pageHeight : ATLAS_PAGE_SIZE;
+    if (maxSize > 0 && atlas->pageWidth > maxSize)
+        atlas->pageWidth = maxSize;
+    if (maxSize > 0 && atlas->pageHeight > maxSize)
+        atlas->pageHeight = maxSize;
+    atlas->pages = arrayNew();
+    atlas->regions = arrayNew();
+    if (!atlas->pages || !atlas->regions) {
+        atlasDelete(atlas);
+        return NULL;
+    }
+
+    return atlas;
+}
+
+static void atlasPageDelete(AtlasPage *page)
+{
+    if (page->texture)
+        textureDelete(page->texture);
+    skylineFree(&page->skyline);
+    free(page->pixels);
+    free(page);
+}
+
+void atlasDelete(Atlas *atlas)
+{
+    AtlasPage *page;
+    AtlasRegion *region;
+    int i;
+
+    if (!atlas)
+        return;
+    if (atlas->pages) {
+        arrayForEach(atlas->pages, page, i)
+            atlasPageDelete(page);
+        arrayDelete(&atlas->pages);
+    }
+    if (atlas->regions) {
+        arrayForEach(atlas->regions, region, i)
+            free(region);
+        arrayDelete(&atlas->regions);
+    }
+    free(atlas);
+}
+
+static AtlasPage *atlasPageNew(Atlas *atlas)
+{
+    AtlasPage *page;
+
+    if (!(page = calloc(1, sizeof(*page)))) {
+        fprintf(stderr, "Cannot alloc AtlasPage\n");
+        return NULL;
+    }
+    page->pixels = calloc(atlas->pageWidth * atlas->pageHeight, 4);
+    page->texture = textureNew(atlas->pageWidth, atlas->pageHeight);
+    if (!page->pixels || !page->texture
+            || !skylineInit(&page->skyline,
+                atlas->pageWidth, atlas->pageHeight)) {
+        fprintf(stderr, "Cannot alloc AtlasPage\n");
+        atlasPageDelete(page);
+        return NULL;
+    }
+    arrayPush(atlas->pages, page);
+
+    return page;
+}
+
+/**
+ * Copies the image into the page, surrounded by ATLAS_PADDING pixels
+ * repeating its edges.
+ *
+ * @param page The page
+ * @param pageWidth Width of the page
+ * @param x Left of the padded rectangle
+ * @param y Top of the padded rectangle
+ * @param pixels The image pixels
+ * @param width Image width
+ * @param height Image height
+ */
+static void atlasPageBlit(AtlasPage *page, int pageWidth, int x, int y,
+        const unsigned char *pixels, int width, int height)
+{
+    int px, py, sx, sy;
+
+    for (py = 0; py < height + 2 * ATLAS_PADDING; py++) {
+        sy = py - ATLAS_PADDING;
+        sy = sy < 0 ? 0 : sy >= height ? height - 1 : sy;
+        unsigned char *dst = page->pixels + ((y + py) * pageWidth + x) * 4;
+        const unsigned char *src = pixels + sy * width * 4;
+        for (px = 0; px < width + 2 * ATLAS_PADDING; px++, dst += 4) {
+            sx = px - ATLAS_PADDING;
+            sx = sx < 0 ? 0 : sx >= width ? width - 1 : sx;
+            memcpy(dst, src + sx * 4, 4);
+        }
+    }
+    page->dirty = true;
+}
+
+AtlasRegion *atlasAddPixels(Atlas *atlas, const unsigned char *pixels,
+        int width, int height)
+{
+    AtlasPage *page = NULL;
+    AtlasRegion *region;
+    int i, x, y,
+        w = width + 2 * ATLAS_PADDING,
+        h = height + 2 * ATLAS_PADDING;
+
+    if (w > atlas->pageWidth || h > atlas->pageHeight) {
+        fprintf(stderr, "atlasAddPixels: %dx%d image does not fit in "
+                "%dx%d pages\n", width, height,
+                atlas->pageWidth, atlas->pageHeight);
+        return NULL;
+    }
+    for (i = 0; i < atlas->pages->len; i++) {
+        page = atlas->pages->data[i];
+        if (skylineInsert(&page->skyline, w, h, &x, &y))
+            break;
+        page = NULL;
+    }
+    if (!page) {
+        if (!(page = atlasPageNew(atlas)))
+            return NULL;
+        i = atlas->pages->len - 1;
+        if (!skylineInsert(&page->skyline, w, h, &x, &y))
+            return NULL;
+    }
+    if (!(region = calloc(1, sizeof(*region)))) {
+        fprintf(stderr, "Cannot alloc AtlasRegion\n");
+        return NULL;
+    }
+    atlasPageBlit(page, atlas->pageWidth, x, y, pixels, width, height);
+
+    region->textureID = page->texture->id;
+    region->page = i;
+    region->x = x + ATLAS_PADDING;
+    region->y = y + ATLAS_PADDING;
+    region->width = width;
+    region->height = height;
+    // sprite v goes up, while page rows go down
+    region->uv = aabb(
+            (float) region->x / atlas->pageWidth,
+            1.0f - (float) (region->y + height) / atlas->pageHeight,
+            (float) (region->x + width) / atlas->pageWidth,
+            1.0f - (float) region->y / atlas->pageHeight);
+    arrayPush(atlas->regions, region);
+
+    return region;
+}
+
+AtlasRegion *atlasAddImage(Atlas *atlas, const char *filePath)
+{
+    AtlasRegion *region;
+    unsigned char *pixels;
+    int width, height;
+
+    if (!(pixels = loadImage(filePath, &width, &height)))
+        return NULL;
+    region = atlasAddPixels(atlas, pixels, width, height);
+    free(pixels);
+
+    return region;
+}
+
+void atlasBuild(Atlas *atlas)
+{
+    AtlasPage *page;
+    int i;
+
+    arrayForEach(atlas->pages, page, i) {
+        if (!page->dirty)
+            continue;
+        // no mipmaps: lower levels would mix neighbour images
+        textureSetPixels(page->texture, page->pixels, false);
+        page->dirty = false;
+    }
+}
+
+Sprite *atlasSpriteNew(AtlasRegion *region,
+        float x, float y, float width, float height)
+{
+    Sprite *sp;
+
+    if (!(sp = spriteNew(x, y, width, height, region->textureID)))
+        return NULL;
+    spriteSetRegion(sp, region->textureID, region->uv);
+
+    return sp;
+}
+
+#ifdef COMPILE_TESTS
+static bool rectsOverlap(int *a, int *b)
+{
+    return !(a[0] >= b[0] + b[2] || a[0] + a[2] <= b[0]
+            || a[1] >= b[1] + b[3] || a[1] + a[3] <= b[1]);
+}
+
+void atlasTest()
+{
+    Skyline sl;
+    int rects[256][4];
+    int i, j, n = 0, x, y;
+
+    printf("Testing Atlas\n");
+
+    // 16 tiles of 32x32 fill a 128x128 area exactly
+    assert(skylineInit(&sl, 128, 128));
+    for (i = 0; i < 16; i++) {
+        assert(skylineInsert(&sl, 32, 32, &x, &y));
+        assert(x % 32 == 0 && y % 32 == 0);
+    }
+    assert(sl.len == 1 && sl.nodes[0].y == 128);
+    assert(!skylineInsert(&sl, 1, 1, &x, &y));
+    skylineFree(&sl);
+
+    // random sizes stay inside the area and never overlap
+    assert(skylineInit(&sl, 512, 512));
+    assert(!skylineInsert(&sl, 513, 10, &x, &y));
+    srand(1);
+    for (i = 0; i < 256; i++) {
+        int w = 4 + rand() % 60, h = 4 + rand() % 60;
+        if (!skylineInsert(&sl, w, h, &x, &y))
+            continue;
+        assert(x >= 0 && y >= 0 && x + w <= 512 && y + h <= 512);
+        rects[n][0] = x; rects[n][1] = y;
+        rects[n][2] = w; rects[n][3] = h;
+        for (j = 0; j < n; j++)
+            assert(!rectsOverlap(rects[n], rects[j]));
+        n++;
+    }
+    assert(n > 64);
+    for (i = 1; i < sl.len; i++)
+        assert(sl.nodes[i].x == sl.nodes[i - 1].x + sl.nodes[i - 1].width);
+    skylineFree(&sl);
+}
+#endif // COMPILE_TESTS
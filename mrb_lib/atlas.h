@@ -0,0 +1,147 @@
+/**
+ * Texture atlas - packs many small images into a few big texture pages,
+ * so sprites using them can share a texture and be drawn together.
+ *
+ * Images are placed with a skyline (bottom-left) packer. Each one gets a
+ * border of ATLAS_PADDING pixels filled with its own edge pixels, so linear
+ * filtering does not bleed the neighbours in.
+ */
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <stdbool.h>
+#include "texture.h"
+#include "aabb.h"
+#include "array.h"
+#include "sprite.h"
+
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_PADDING 2
+
+typedef struct {
+    int x, y, width;        // segment of the skyline, y is the filled height
+} SkylineNode;
+
+typedef struct {
+    int width, height;      // size of the packed area
+    SkylineNode *nodes;     // skyline segments, left to right
+    int len, size;
+} Skyline;
+
+typedef struct {
+    Texture *texture;       // page texture, its id is valid before the upload
+    unsigned char *pixels;  // RGBA pixels, top row first
+    Skyline skyline;        // free space of the page
+    bool dirty;             // pixels changed since the last atlasBuild
+} AtlasPage;
+
+typedef struct {
+    GLuint textureID;       // texture of the page holding the image
+    AABB uv;                // sub-image, in sprite UV space
+    int x, y;               // position in the page, in pixels from top left
+    int width, height;      // image size in pixels
+    int page;               // page index
+} AtlasRegion;
+
+typedef struct {
+    int pageWidth, pageHeight;
+    Array *pages;           // AtlasPage *
+    Array *regions;         // AtlasRegion *
+} Atlas;
+
+/**
+ * Initialises an empty skyline
+ *
+ * @param sl The skyline
+ * @param width Width of the area to pack into
+ * @param height Height of the area to pack into
+ * @return true on success, false on no memory
+ */
+bool skylineInit(Skyline *sl, int width, int height);
+
+/**
+ * Releases the skyline nodes
+ *
+ * @param sl The skyline
+ */
+void skylineFree(Skyline *sl);
+
+/**
+ * Finds a place for a width x height rectangle and marks it as used
+ *
+ * @param sl The skyline
+ * @param width Rectangle width
+ * @param height Rectangle height
+ * @param x Where to store the left of the rectangle
+ * @param y Where to store the top of the rectangle
+ * @return true if placed, false if there is no room left
+ */
+bool skylineInsert(Skyline *sl, int width, int height, int *x, int *y);
+
+/**
+ * Creates a new atlas
+ *
+ * @param pageWidth Width of each page, 0 for ATLAS_PAGE_SIZE
+ * @param pageHeight Height of each page, 0 for ATLAS_PAGE_SIZE
+ * @return a new Atlas or NULL on error
+ */
+Atlas *atlasNew(int pageWidth, int pageHeight);
+
+/**
+ * Destroys the atlas, its pages and regions
+ *
+ * @param atlas The atlas
+ */
+void atlasDelete(Atlas *atlas);
+
+/**
+ * Packs RGBA pixels into the atlas. A new page is opened if the image
+ * does not fit in any of the existing ones.
+ *
+ * @param atlas The atlas
+ * @param pixels width * height RGBA pixels, top row first
+ * @param width Image width
+ * @param height Image height
+ * @return the region of the image, owned by the atlas, or NULL on error
+ */
+AtlasRegion *atlasAddPixels(Atlas *atlas, const unsigned char *pixels,
+        int width, int height);
+
+/**
+ * Loads a png file and packs it into the atlas
+ *
+ * @param atlas The atlas
+ * @param filePath Path to png file
+ * @return the region of the image, owned by the atlas, or NULL on error
+ */
+AtlasRegion *atlasAddImage(Atlas *atlas, const char *filePath);
+
+/**
+ * Uploads the pages changed since the last call.
+ * Regions can be used by sprites before this, as the texture ids
+ * do not change, but they will draw garbage until the pages are built.
+ *
+ * @param atlas The atlas
+ */
+void atlasBuild(Atlas *atlas);
+
+/**
+ * Creates a sprite showing an atlas region. spriteSetUV and spriteSetFrame
+ * on it work relative to the region, as if it were a texture of its own.
+ *
+ * @param region The atlas region
+ * @param x Sprite position x
+ * @param y Sprite position y
+ * @param width Sprite width
+ * @param height Sprite height
+ * @return a new Sprite or NULL on error
+ */
+Sprite *atlasSpriteNew(AtlasRegion *region,
+        float x, float y, float width, float height);
+
+/**
+ * Internal self test
+ */
+void atlasTest();
+
+#endif // ATLAS_H
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "chunk_world.h"
+
+ChunkWorld *chunkWorldNew(GLProgram *prog, SBLayout layout, AABB limits,
+        float chunkWidth, float chunkHeight)
+{
+    ChunkWorld *cw;
+
+    if (chunkWidth <= 0 || chunkHeight <= 0
+            || limits.maxX <= limits.minX || limits.maxY <= limits.minY) {
+        fprintf(stderr, "chunkWorldNew: invalid limits or chunk size\n");
+        return NULL;
+    }
+    if (!(cw = calloc(1, sizeof(*cw)))) {
+        fprintf(stderr, "Cannot alloc ChunkWorld\n");
+        return NULL;
+    }
+    cw->prog = prog;
+    cw->layout = layout;
+    cw->limits = limits;
+    cw->chunkWidth = chunkWidth;
+    cw->chunkHeight = chunkHeight;
+    cw->cols = (int) ceilf((limits.maxX - limits.minX) / chunkWidth);
+    cw->rows = (int) ceilf((limits.maxY - limits.minY) / chunkHeight);
+    cw->chunks = calloc(cw->cols * cw->rows, sizeof(*cw->chunks));
+    cw->visible = malloc(cw->cols * cw->rows * sizeof(*cw->visible));
+    if (!cw->chunks || !cw->visible) {
+        fprintf(stderr, "Cannot alloc %dx%d chunks\n", cw->cols, cw->rows);
+        chunkWorldDelete(cw);
+        return NULL;
+    }
+
+    return cw;
+}
+
+void chunkWorldDelete(ChunkWorld *cw)
+{
+    int i;
+
+    if (!cw)
+        return;
+    if (cw->chunks) {
+        for (i = 0; i < cw->cols * cw->rows; i++) {
+            if (!cw->chunks[i])
+                continue;
+            sbDelete(cw->chunks[i]->sb);
+            free(cw->chunks[i]);
+        }
+    }
+    free(cw->chunks);
+    free(cw->visible);
+    free(cw);
+}
+
+void chunkWorldSetWorkerPool(ChunkWorld *cw, WorkerPool *pool)
+{
+    int i;
+
+    cw->pool = pool;
+    for (i = 0; i < cw->cols * cw->rows; i++)
+        if (cw->chunks[i])
+            sbSetWorkerPool(cw->chunks[i]->sb, pool);
+}
+
+/**
+ * Sets the compact vertex format of a chunk batch, with its origin
+ * at the chunk corner
+ *
+ * @param cw The world
+ * @param idx Index of the chunk
+ * @return false if the layout does not allow it
+ */
+static bool chunkSetCompact(ChunkWorld *cw, int idx)
+{
+    SpriteBatch *sb = cw->chunks[idx]->sb;
+
+    if (!sbSetCompact(sb, cw->compact))
+        return false;
+    sbSetOrigin(sb, cw->limits.minX + (idx % cw->cols) * cw->chunkWidth,
+            cw->limits.minY + (idx / cw->cols) * cw->chunkHeight);
+
+    return true;
+}
+
+bool chunkWorldSetCompact(ChunkWorld *cw, bool enable)
+{
+    int i;
+
+    if (enable && (cw->layout == SB_LAYOUT_INSTANCED
+                || cw->chunkWidth >= 16384 || cw->chunkHeight >= 16384))
+        return false;
+    cw->compact = enable;
+    for (i = 0; i < cw->cols * cw->rows; i++)
+        if (cw->chunks[i] && !chunkSetCompact(cw, i))
+            return false;
+
+    return true;
+}
+
+/**
+ * Creates the chunk of a cell
+ *
+ * @param cw The world
+ * @param idx Index of the cell
+ * @return the new chunk or NULL on error
+ */
+static Chunk *chunkNew(ChunkWorld *cw, int idx)
+{
+    Chunk *chunk;
+
+    if (!(chunk = calloc(1, sizeof(*chunk)))) {
+        fprintf(stderr, "Cannot alloc Chunk\n");
+        return NULL;
+    }
+    if (!(chunk->sb = sbNew(cw->prog))) {
+        free(chunk);
+        return NULL;
+    }
+    sbInit(chunk->sb);
+    if (!sbSetLayout(chunk->sb, cw->layout)
+            || !sbSetUploadMode(chunk->sb, SB_UPLOAD_STATIC)) {
+        fprintf(stderr, "Cannot setup the chunk batch\n");
+        sbDelete(chunk->sb);
+        free(chunk);
+        return NULL;
+    }
+    sbSetWorkerPool(chunk->sb, cw->pool);
+    chunk->empty = true;
+    cw->chunks[idx] = chunk;
+    if (cw->compact && !chunkSetCompact(cw, idx)) {
+        cw->chunks[idx] = NULL;
+        sbDelete(chunk->sb);
+        free(chunk);
+        return NULL;
+    }
+
+    return chunk;
+}
+
+bool chunkWorldAdd(ChunkWorld *cw, Sprite *sp)
+{
+    Chunk *chunk;
+    int col, row, idx;
+
+    col = (int) floorf((sp->x - cw->limits.minX) / cw->chunkWidth);
+    row = (int) floorf((sp->y - cw->limits.minY) / cw->chunkHeight);
+    if (col < 0 || col >= cw->cols || row < 0 || row >= cw->rows) {
+        fprintf(stderr, "chunkWorldAdd: sprite out of the world at %g, %g\n",
+                sp->x, sp->y);
+        return false;
+    }
+    idx = row * cw->cols + col;
+    if (!(chunk = cw->chunks[idx]) && !(chunk = chunkNew(cw, idx)))
+        return false;
+
+    return sbAdd(chunk->sb, sp).gen != 0;
+}
+
+bool chunkWorldRemove(ChunkWorld *cw, Sprite *sp)
+{
+    (void) cw;
+    if (!sp->batch) {
+        fprintf(stderr, "chunkWorldRemove: sprite not in the world\n");
+        return false;
+    }
+
+    return sbDeleteSprite(sp->batch, sp);
+}
+
+/**
+ * Recomputes the area covered by the chunk sprites
+ *
+ * @param chunk The chunk
+ */
+static void chunkUpdateBounds(Chunk *chunk)
+{
+    SpriteBatch *sb = chunk->sb;
+    Sprite *sp;
+    int i;
+
+    chunk->empty = sb->spritesLen == 0;
+    for (i = 0; i < sb->spritesLen; i++) {
+        sp = sb->sprites[i];
+        if (i == 0) {
+            chunk->bounds = aabb(sp->x, sp->y,
+                    sp->x + sp->width, sp->y + sp->height);
+            continue;
+        }
+        chunk->bounds.minX = fminf(chunk->bounds.minX, sp->x);
+        chunk->bounds.minY = fminf(chunk->bounds.minY, sp->y);
+        chunk->bounds.maxX = fmaxf(chunk->bounds.maxX, sp->x + sp->width);
+        chunk->bounds.maxY = fmaxf(chunk->bounds.maxY, sp->y + sp->height);
+    }
+}
+
+/**
+ * Builds the chunks intersecting the view into cw->visible
+ *
+ * @param cw The world
+ * @param view The visible area
+ * @return the number of visible chunks
+ */
+static int chunkWorldBuild(ChunkWorld *cw, AABB view)
+{
+    Chunk *chunk;
+    int col, row, minCol, minRow, maxCol, maxRow, len = 0;
+
+    memset(&cw->stats, 0, sizeof(cw->stats));
+    // sprites can stick out of their chunk, look one chunk further
+    minCol = (int) floorf((view.minX - cw->limits.minX) / cw->chunkWidth) - 1;
+    minRow = (int) floorf((view.minY - cw->limits.minY) / cw->chunkHeight) - 1;
+    maxCol = (int) floorf((view.maxX - cw->limits.minX) / cw->chunkWidth) + 1;
+    maxRow = (int) floorf((view.maxY - cw->limits.minY) / cw->chunkHeight) + 1;
+    if (minCol < 0)
+        minCol = 0;
+    if (minRow < 0)
+        minRow = 0;
+    if (maxCol >= cw->cols)
+        maxCol = cw->cols - 1;
+    if (maxRow >= cw->rows)
+        maxRow = cw->rows - 1;
+
+    for (row = minRow; row <= maxRow; row++) {
+        for (col = minCol; col <= maxCol; col++) {
+            if (!(chunk = cw->chunks[row * cw->cols + col]))
+                continue;
+            // a sprite was added, removed or changed since the last build
+            if (chunk->sb->needsSort || chunk->sb->dirtyLen > 0)
+                chunkUpdateBounds(chunk);
+            if (chunk->empty || !aabbIntersects(&chunk->bounds, &view))
+                continue;
+            sbBuildBatches(chunk->sb);
+            if (chunk->sb->stats.spritesBuilt > 0)
+                cw->stats.chunksBuilt++;
+            cw->visible[len++] = chunk->sb;
+        }
+    }
+    cw->stats.chunksVisible = len;
+
+    return len;
+}
+
+void chunkWorldDraw(ChunkWorld *cw, AABB view)
+{
+    int i, len = chunkWorldBuild(cw, view);
+
+    sbDrawBatchList(cw->visible, len);
+    for (i = 0; i < len; i++)
+        sbAddStats(&cw->stats.sprites, &cw->visible[i]->stats);
+}
+
+void chunkWorldSubmit(ChunkWorld *cw, RenderQueue *rq, AABB view)
+{
+    int i, len = chunkWorldBuild(cw, view);
+
+    for (i = 0; i < len; i++) {
+        if (!rqSubmit(rq, cw->visible[i]))
+            break;
+        sbAddStats(&cw->stats.sprites, &cw->visible[i]->stats);
+    }
+}
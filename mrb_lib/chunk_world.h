@@ -0,0 +1,124 @@
+/**
+ * Static world geometry split in chunks: fixed size cells of world space,
+ * each with its own prebuilt vertex buffer, drawn only when in view.
+ */
+#ifndef CHUNK_WORLD_H
+#define CHUNK_WORLD_H
+
+#include <stdbool.h>
+#include "aabb.h"
+#include "sprite.h"
+#include "sprite_batch.h"
+#include "render_queue.h"
+#include "gl_program.h"
+
+typedef struct {
+    SpriteBatch *sb;    // the chunk sprites, in SB_UPLOAD_STATIC mode
+    AABB bounds;        // area covered by the sprites
+    bool empty;         // no sprites, bounds is meaningless
+} Chunk;
+
+/* Per frame counters, reset on each chunkWorldDraw */
+typedef struct {
+    int chunksVisible;  // chunks intersecting the view
+    int chunksBuilt;    // chunks whose vertices were rebuilt
+    SBStats sprites;    // sums of the visible chunks batch counters; only
+                        // the build ones when submitted to a RenderQueue
+} CWStats;
+
+typedef struct {
+    GLProgram *prog;
+    SBLayout layout;
+    AABB limits;        // world area split in chunks
+    float chunkWidth, chunkHeight;
+    int cols, rows;
+    Chunk **chunks;     // cols * rows, NULL until a sprite is added there
+    SpriteBatch **visible; // batches of the chunks drawn last frame
+    WorkerPool *pool;
+    bool compact;       // chunks use compact vertices, see chunkWorldSetCompact
+    CWStats stats;
+} ChunkWorld;
+
+/**
+ * Creates an empty world
+ *
+ * @param prog Program to draw with, matching the layout
+ * @param layout Layout of the chunk batches, see SBLayout
+ * @param limits World area; sprites must start inside it
+ * @param chunkWidth Width of a chunk, like 32 tiles
+ * @param chunkHeight Height of a chunk
+ * @return a new ChunkWorld or NULL on error
+ */
+ChunkWorld *chunkWorldNew(GLProgram *prog, SBLayout layout, AABB limits,
+        float chunkWidth, float chunkHeight);
+
+/**
+ * Destroys the world and its chunks, but not the sprites, which can
+ * be destroyed before
+ *
+ * @param cw The world
+ */
+void chunkWorldDelete(ChunkWorld *cw);
+
+/**
+ * Builds the chunks with a worker pool, see sbSetWorkerPool
+ *
+ * @param cw The world
+ * @param pool The pool, or NULL
+ */
+void chunkWorldSetWorkerPool(ChunkWorld *cw, WorkerPool *pool);
+
+/**
+ * @brief Stores the chunks with compact vertices, relative to the
+ * chunk corner, see sbSetCompact.
+ *
+ * Chunks must be smaller than 16384 units for the positions to fit.
+ *
+ * @param cw The world
+ * @param enable true for compact vertices
+ * @return false if the layout does not allow it
+ */
+bool chunkWorldSetCompact(ChunkWorld *cw, bool enable);
+
+/**
+ * @brief Adds a sprite to the chunk its position is in.
+ *
+ * The sprite can change later, which rebuilds its chunk, but should not
+ * move further than a chunk away or stick out of its chunk by more than
+ * a chunk, or it may not be drawn.
+ *
+ * @param cw The world
+ * @param sp The sprite; it must not be in a batch
+ * @return false if it is out of the world limits or on error
+ */
+bool chunkWorldAdd(ChunkWorld *cw, Sprite *sp);
+
+/**
+ * Removes a sprite from its chunk. The sprite is not destroyed.
+ *
+ * @param cw The world
+ * @param sp The sprite
+ * @return false if the sprite is not in the world
+ */
+bool chunkWorldRemove(ChunkWorld *cw, Sprite *sp);
+
+/**
+ * Draws the chunks intersecting the view, rebuilding the ones that
+ * changed. Chunks out of view cost nothing.
+ *
+ * @param cw The world
+ * @param view The visible area, like cameraGetAABB
+ */
+void chunkWorldDraw(ChunkWorld *cw, AABB view);
+
+/**
+ * Builds the chunks intersecting the view like chunkWorldDraw, but
+ * queues them to be drawn with the rest of the frame
+ *
+ * @param cw The world
+ * @param rq The render queue of the frame
+ * @param view The visible area, like cameraGetAABB
+ */
+void chunkWorldSubmit(ChunkWorld *cw, RenderQueue *rq, AABB view);
+
+#endif // CHUNK_WORLD_H
@@ -7,6 +7,7 @@
 #include "error.h"
 #include "file_get.h"
 #include "gl_program.h"
+#include "gl_state.h"
 
 /**
  * Compiles the shaders
@@ -91,8 +92,10 @@ void glProgramDelete(GLProgram *program)
     }
     glDeleteShader(program->vertexShaderID);
     glDeleteShader(program->fragmentShaderID);
-    glDeleteProgram(program->programID);
+    glStateDeleteProgram(program->programID);
 
+    free(program->uniforms);
+    free(program->attributes);
     free(program);
     program = NULL;
 }
@@ -118,6 +121,56 @@ bool glProgramCompileShaders(GLProgram *program, const char *path)
     return true;
 }
 
+/**
+ * Reads the names and locations of the active uniforms or attributes
+ * of a linked program
+ *
+ * @param program The program
+ * @param uniforms true for the uniforms, false for the attributes
+ * @param len Where to store the number of locations
+ * @return the locations, NULL if there are none or on error
+ */
+static GLProgramLocation *glProgramReflect(GLProgram *program, bool uniforms,
+        int *len)
+{
+    GLProgramLocation *locs, *loc;
+    GLint i, n = 0, size;
+    GLsizei length;
+    GLenum type;
+    char *bracket;
+
+    glGetProgramiv(program->programID,
+            uniforms ? GL_ACTIVE_UNIFORMS : GL_ACTIVE_ATTRIBUTES, &n);
+    *len = 0;
+    if (n <= 0)
+        return NULL;
+    if (!(locs = calloc(n, sizeof(*locs)))) {
+        fprintf(stderr, "Out of memory: GLProgram locations\n");
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        loc = &locs[i];
+        if (uniforms)
+            glGetActiveUniform(program->programID, i, sizeof(loc->name),
+                    &length, &size, &type, loc->name);
+        else
+            glGetActiveAttrib(program->programID, i, sizeof(loc->name),
+                    &length, &size, &type, loc->name);
+        if (length >= (GLsizei) sizeof(loc->name) - 1)
+            fprintf(stderr, "glProgram: %s name too long: %s\n",
+                    uniforms ? "uniform" : "attribute", loc->name);
+        // arrays are reported as name[0]
+        if ((bracket = strchr(loc->name, '[')))
+            *bracket = 0;
+        loc->location = uniforms
+            ? glGetUniformLocation(program->programID, loc->name)
+            : glGetAttribLocation(program->programID, loc->name);
+    }
+    *len = n;
+
+    return locs;
+}
+
 bool glProgramLinkShaders(GLProgram *program) 
 {
     glAttachShader(program->programID, program->vertexShaderID);
@@ -133,7 +186,7 @@ bool glProgramLinkShaders(GLProgram *program)
         glGetProgramiv(program->programID, GL_INFO_LOG_LENGTH, &maxLength);
         char *errorLog = calloc(1, maxLength + 1);
         glGetProgramInfoLog(program->programID, maxLength, &maxLength, errorLog);
-        glDeleteProgram(program->programID);
+        glStateDeleteProgram(program->programID);
         fprintf(stderr, "Cannot link program %s\n", errorLog);
         free(errorLog);
         return false;
@@ -144,6 +197,12 @@ bool glProgramLinkShaders(GLProgram *program)
     glDeleteShader(program->vertexShaderID);
     glDeleteShader(program->fragmentShaderID);
 
+    free(program->uniforms);
+    free(program->attributes);
+    program->uniforms = glProgramReflect(program, true, &program->uniformsLen);
+    program->attributes = glProgramReflect(
+            program, false, &program->attributesLen);
+
     return true;
 }
 
@@ -154,7 +213,8 @@ bool glProgramLinkShaders(GLProgram *program)
  */
 void glProgramUse(GLProgram *program) 
 {
-    glUseProgram(program->programID);
+    if (!glStateUseProgram(program->programID))
+        return;
     for (int i = 0; i< program->numAttributes; i++)
         glEnableVertexAttribArray(i);
 }
@@ -166,7 +226,7 @@ void glProgramUse(GLProgram *program)
  */
 void glProgramUnuse(GLProgram *program) 
 {
-    glUseProgram(0);
+    glStateUseProgram(0);
     for (int i = 0; i < program->numAttributes; i++)
         glEnableVertexAttribArray(0);
 }
@@ -184,3 +244,38 @@ void glProgramAddAttribute(GLProgram *program, const char *attributeName)
             program->programID, program->numAttributes++, attributeName);
 }
 
+
+void glProgramBindAttribute(GLProgram *program, GLuint index,
+        const char *name)
+{
+    glBindAttribLocation(program->programID, index, name);
+}
+
+/**
+ * Finds a name in a location table
+ *
+ * @param locs The locations
+ * @param len Number of locations
+ * @param name The name
+ * @return the location, or -1 if not found
+ */
+static GLint glProgramFind(const GLProgramLocation *locs, int len,
+        const char *name)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        if (!strcmp(locs[i].name, name))
+            return locs[i].location;
+    return -1;
+}
+
+GLint glProgramUniformLocation(const GLProgram *program, const char *name)
+{
+    return glProgramFind(program->uniforms, program->uniformsLen, name);
+}
+
+GLint glProgramAttribLocation(const GLProgram *program, const char *name)
+{
+    return glProgramFind(program->attributes, program->attributesLen, name);
+}
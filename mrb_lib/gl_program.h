@@ -4,11 +4,24 @@
 #include <stdbool.h>
 #include <GL/glew.h>
 
+/* Longest uniform or attribute name cached by the program */
+#define GL_PROGRAM_MAX_NAME 32
+
+/* Location of an active uniform or attribute */
+typedef struct {
+    char name[GL_PROGRAM_MAX_NAME];
+    GLint location;
+} GLProgramLocation;
+
 typedef struct {
     GLuint programID;
     GLuint vertexShaderID;
     GLuint fragmentShaderID;
     GLint numAttributes;
+    GLProgramLocation *uniforms;   // active uniforms, read at link time
+    int uniformsLen;
+    GLProgramLocation *attributes; // active attributes, read at link time
+    int attributesLen;
 } GLProgram;
 
 GLProgram* glProgramNew();
@@ -32,6 +45,37 @@ bool glProgramLinkShaders(GLProgram *program);
 
 void glProgramAddAttribute(GLProgram *program, const char *name);
 
+/**
+ * Binds an attribute to a given location, before linking. Unlike
+ * glProgramAddAttribute, glProgramUse does not enable it: for
+ * attributes only some vertex arrays provide.
+ *
+ * @param program The program
+ * @param index The attribute location
+ * @param name The attribute name
+ */
+void glProgramBindAttribute(GLProgram *program, GLuint index,
+        const char *name);
+
+/**
+ * Gets the location of a uniform, from the locations read when the
+ * program was linked, without asking GL
+ *
+ * @param program The linked program
+ * @param name The uniform name; arrays by their name, without [0]
+ * @return the location, or -1 if the uniform is not active
+ */
+GLint glProgramUniformLocation(const GLProgram *program, const char *name);
+
+/**
+ * Gets the location of an attribute, like glProgramUniformLocation
+ *
+ * @param program The linked program
+ * @param name The attribute name
+ * @return the location, or -1 if the attribute is not active
+ */
+GLint glProgramAttribLocation(const GLProgram *program, const char *name);
+
 void glProgramUse(GLProgram *program);
 
 void glProgramUnuse(GLProgram *program);
@@ -0,0 +1,215 @@
+#include <string.h>
+#include "gl_state.h"
+
+/* Bits of GLState.known, a state is only compared when its bit is set */
+enum {
+    GLS_PROGRAM = 1 << 0,
+    GLS_ACTIVE_TEXTURE = 1 << 1,
+    GLS_VAO = 1 << 2,
+    GLS_ARRAY_BUFFER = 1 << 3,
+    GLS_BLEND = 1 << 4,
+    GLS_BLEND_FUNC = 1 << 5,
+    GLS_DEPTH_TEST = 1 << 6,
+    GLS_DEPTH_MASK = 1 << 7,
+    GLS_DEPTH_FUNC = 1 << 8,
+};
+
+typedef struct {
+    unsigned known;
+    GLuint program;
+    GLenum activeTexture;
+    GLenum textureTargets[GLS_TEXTURE_UNITS]; // 0 if unknown
+    GLuint textures[GLS_TEXTURE_UNITS];
+    GLuint vao;
+    GLuint arrayBuffer;
+    bool blend;
+    GLenum blendSrc, blendDst;
+    bool depthTest;
+    GLboolean depthMask;
+    GLenum depthFunc;
+} GLState;
+
+static GLState state;
+static GLStateStats stats;
+
+void glStateReset()
+{
+    memset(&state, 0, sizeof(state));
+}
+
+/**
+ * Tells if a state is known and already has the wanted value, and
+ * counts the call
+ *
+ * @param bit The GLS_* bit of the state
+ * @param same The cached value is the wanted one
+ * @return true if the call can be skipped
+ */
+static inline bool glStateCurrent(unsigned bit, bool same)
+{
+    if ((state.known & bit) && same) {
+        stats.elided++;
+        return true;
+    }
+    state.known |= bit;
+    stats.calls++;
+
+    return false;
+}
+
+bool glStateUseProgram(GLuint program)
+{
+    if (glStateCurrent(GLS_PROGRAM, state.program == program))
+        return false;
+    state.program = program;
+    glUseProgram(program);
+
+    return true;
+}
+
+void glStateActiveTexture(GLenum unit)
+{
+    if (glStateCurrent(GLS_ACTIVE_TEXTURE, state.activeTexture == unit))
+        return;
+    state.activeTexture = unit;
+    glActiveTexture(unit);
+}
+
+void glStateBindTexture(GLenum target, GLuint texture)
+{
+    int unit = (state.known & GLS_ACTIVE_TEXTURE)
+        ? (int) (state.activeTexture - GL_TEXTURE0) : -1;
+
+    if (unit < 0 || unit >= GLS_TEXTURE_UNITS) {
+        stats.calls++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (state.textureTargets[unit] == target
+            && state.textures[unit] == texture) {
+        stats.elided++;
+        return;
+    }
+    stats.calls++;
+    state.textureTargets[unit] = target;
+    state.textures[unit] = texture;
+    glBindTexture(target, texture);
+}
+
+void glStateBindVertexArray(GLuint vao)
+{
+    if (glStateCurrent(GLS_VAO, state.vao == vao))
+        return;
+    state.vao = vao;
+    glBindVertexArray(vao);
+}
+
+void glStateBindBuffer(GLenum target, GLuint buffer)
+{
+    if (target != GL_ARRAY_BUFFER) {
+        stats.calls++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (glStateCurrent(GLS_ARRAY_BUFFER, state.arrayBuffer == buffer))
+        return;
+    state.arrayBuffer = buffer;
+    glBindBuffer(target, buffer);
+}
+
+void glStateEnable(GLenum cap, bool enable)
+{
+    if (cap == GL_BLEND) {
+        if (glStateCurrent(GLS_BLEND, state.blend == enable))
+            return;
+        state.blend = enable;
+    } else if (cap == GL_DEPTH_TEST) {
+        if (glStateCurrent(GLS_DEPTH_TEST, state.depthTest == enable))
+            return;
+        state.depthTest = enable;
+    } else {
+        stats.calls++;
+    }
+    if (enable)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+void glStateBlendFunc(GLenum src, GLenum dst)
+{
+    if (glStateCurrent(GLS_BLEND_FUNC,
+                state.blendSrc == src && state.blendDst == dst))
+        return;
+    state.blendSrc = src;
+    state.blendDst = dst;
+    glBlendFunc(src, dst);
+}
+
+void glStateDepthMask(GLboolean mask)
+{
+    if (glStateCurrent(GLS_DEPTH_MASK, state.depthMask == mask))
+        return;
+    state.depthMask = mask;
+    glDepthMask(mask);
+}
+
+void glStateDepthFunc(GLenum func)
+{
+    if (glStateCurrent(GLS_DEPTH_FUNC, state.depthFunc == func))
+        return;
+    state.depthFunc = func;
+    glDepthFunc(func);
+}
+
+void glStateDeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    GLsizei i;
+
+    // deleting a bound buffer binds 0 in its place
+    for (i = 0; i < n; i++)
+        if (buffers[i] && state.arrayBuffer == buffers[i])
+            state.arrayBuffer = 0;
+    glDeleteBuffers(n, buffers);
+}
+
+void glStateDeleteTextures(GLsizei n, const GLuint *textures)
+{
+    GLsizei i;
+    int unit;
+
+    for (i = 0; i < n; i++)
+        for (unit = 0; unit < GLS_TEXTURE_UNITS; unit++)
+            if (textures[i] && state.textures[unit] == textures[i])
+                state.textures[unit] = 0;
+    glDeleteTextures(n, textures);
+}
+
+void glStateDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    GLsizei i;
+
+    for (i = 0; i < n; i++)
+        if (arrays[i] && state.vao == arrays[i])
+            state.vao = 0;
+    glDeleteVertexArrays(n, arrays);
+}
+
+void glStateDeleteProgram(GLuint program)
+{
+    // a current program is only deleted once it is no longer used,
+    // its name cannot be reused before that; forget it anyway
+    if (program && state.program == program)
+        state.known &= ~GLS_PROGRAM;
+    glDeleteProgram(program);
+}
+
+const GLStateStats *glStateGetStats()
+{
+    return &stats;
+}
+
+void glStateResetStats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,122 @@
+/**
+ * Cache of the GL state the draw loops set the most: program, textures,
+ * vertex array, array buffer, blending and depth. Setting a state that
+ * is already current costs no GL call.
+ *
+ * Every change of the cached state must go through these functions,
+ * or be followed by glStateReset. One context, used from one thread.
+ */
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <stdbool.h>
+#include <GL/glew.h>
+
+/* Texture units whose bindings are cached, the others are passed through */
+#define GLS_TEXTURE_UNITS 8
+
+typedef struct {
+    unsigned long calls;    // GL calls made through the cache
+    unsigned long elided;   // calls skipped, the state was already set
+} GLStateStats;
+
+/**
+ * Forgets the cached state, so the next calls reach GL. Call it after
+ * creating a context, or after changing the state behind the cache.
+ */
+void glStateReset();
+
+/**
+ * glUseProgram, if it is not the current program
+ *
+ * @param program The program object, or 0
+ * @return true if the program changed
+ */
+bool glStateUseProgram(GLuint program);
+
+/**
+ * glActiveTexture, if it is not the active unit
+ *
+ * @param unit The unit, like GL_TEXTURE0
+ */
+void glStateActiveTexture(GLenum unit);
+
+/**
+ * glBindTexture on the active unit, if the texture is not bound there
+ *
+ * @param target The target, like GL_TEXTURE_2D
+ * @param texture The texture object, or 0
+ */
+void glStateBindTexture(GLenum target, GLuint texture);
+
+/**
+ * glBindVertexArray, if it is not the bound vertex array
+ *
+ * @param vao The vertex array object, or 0
+ */
+void glStateBindVertexArray(GLuint vao);
+
+/**
+ * glBindBuffer. Only GL_ARRAY_BUFFER is cached, the element array
+ * buffer belongs to the vertex array and the other targets are rare.
+ *
+ * @param target The target, like GL_ARRAY_BUFFER
+ * @param buffer The buffer object, or 0
+ */
+void glStateBindBuffer(GLenum target, GLuint buffer);
+
+/**
+ * glEnable or glDisable. GL_BLEND and GL_DEPTH_TEST are cached.
+ *
+ * @param cap The capability
+ * @param enable true to enable it
+ */
+void glStateEnable(GLenum cap, bool enable);
+
+/**
+ * glBlendFunc, if it is not the current blend function
+ */
+void glStateBlendFunc(GLenum src, GLenum dst);
+
+/**
+ * glDepthMask, if it is not the current depth write mask
+ */
+void glStateDepthMask(GLboolean mask);
+
+/**
+ * glDepthFunc, if it is not the current depth test function
+ */
+void glStateDepthFunc(GLenum func);
+
+/**
+ * glDeleteBuffers, forgetting the bindings of the deleted buffers
+ */
+void glStateDeleteBuffers(GLsizei n, const GLuint *buffers);
+
+/**
+ * glDeleteTextures, forgetting the bindings of the deleted textures
+ */
+void glStateDeleteTextures(GLsizei n, const GLuint *textures);
+
+/**
+ * glDeleteVertexArrays, forgetting the bindings of the deleted arrays
+ */
+void glStateDeleteVertexArrays(GLsizei n, const GLuint *arrays);
+
+/**
+ * glDeleteProgram, forgetting the program if it is current
+ */
+void glStateDeleteProgram(GLuint program);
+
+/**
+ * Gets the counters of the calls made and elided since the last
+ * glStateResetStats
+ */
+const GLStateStats *glStateGetStats();
+
+/**
+ * Resets the counters, like at the start of a frame
+ */
+void glStateResetStats();
+
+#endif // GL_STATE_H
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gpu_timer.h"
+
+bool gpuTimerSupported()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+GPUTimer *gpuTimerNew()
+{
+    GPUTimer *t;
+
+    if (!gpuTimerSupported())
+        return NULL;
+    if (!(t = calloc(1, sizeof(*t)))) {
+        fprintf(stderr, "Cannot alloc GPUTimer\n");
+        return NULL;
+    }
+    glGenQueries(2 * GPU_TIMER_LATENCY, &t->queries[0][0]);
+    t->current = -1;
+
+    return t;
+}
+
+void gpuTimerDelete(GPUTimer *t)
+{
+    if (!t)
+        return;
+    glDeleteQueries(2 * GPU_TIMER_LATENCY, &t->queries[0][0]);
+    free(t);
+}
+
+/**
+ * Adds a result to the history, replacing the oldest one when full
+ *
+ * @param t The timer
+ * @param ns The time, in nanoseconds
+ */
+static void gpuTimerAddSample(GPUTimer *t, GLuint64 ns)
+{
+    t->history[t->historyPos] = ns;
+    t->historyPos = (t->historyPos + 1) % GPU_TIMER_HISTORY;
+    if (t->historyLen < GPU_TIMER_HISTORY)
+        t->historyLen++;
+}
+
+void gpuTimerCollect(GPUTimer *t)
+{
+    GLuint available;
+    GLuint64 begin, end;
+
+    // the spans end in order, so do their results
+    while (t->pending[t->oldest]) {
+        glGetQueryObjectuiv(t->queries[t->oldest][1],
+                GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        glGetQueryObjectui64v(t->queries[t->oldest][0],
+                GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(t->queries[t->oldest][1],
+                GL_QUERY_RESULT, &end);
+        gpuTimerAddSample(t, end > begin ? end - begin : 0);
+        t->pending[t->oldest] = false;
+        t->oldest = (t->oldest + 1) % GPU_TIMER_LATENCY;
+    }
+}
+
+void gpuTimerBegin(GPUTimer *t)
+{
+    if (!t || t->current >= 0)
+        return;
+    gpuTimerCollect(t);
+    if (t->pending[t->next]) {
+        t->skipped++;
+        return;
+    }
+    t->current = t->next;
+    t->next = (t->next + 1) % GPU_TIMER_LATENCY;
+    glQueryCounter(t->queries[t->current][0], GL_TIMESTAMP);
+}
+
+void gpuTimerEnd(GPUTimer *t)
+{
+    if (!t || t->current < 0)
+        return;
+    glQueryCounter(t->queries[t->current][1], GL_TIMESTAMP);
+    t->pending[t->current] = true;
+    t->current = -1;
+}
+
+void gpuTimerGetStats(const GPUTimer *t, GPUTimerStats *stats)
+{
+    GLuint64 sum = 0, max = 0;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->skipped = t->skipped;
+    if (t->historyLen == 0)
+        return;
+    for (i = 0; i < t->historyLen; i++) {
+        sum += t->history[i];
+        if (t->history[i] > max)
+            max = t->history[i];
+    }
+    i = (t->historyPos + GPU_TIMER_HISTORY - 1) % GPU_TIMER_HISTORY;
+    stats->lastMs = t->history[i] / 1e6;
+    stats->averageMs = (double) sum / t->historyLen / 1e6;
+    stats->maxMs = max / 1e6;
+    stats->samples = t->historyLen;
+}
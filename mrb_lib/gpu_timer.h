@@ -0,0 +1,94 @@
+/**
+ * GPU time of a span of GL commands, measured with timestamp queries.
+ *
+ * The results are read back a few frames later, only once they are
+ * available, so measuring never waits for the GPU. Timestamps rather
+ * than GL_TIME_ELAPSED queries let the spans nest, like a batch inside
+ * the frame.
+ */
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <stdbool.h>
+#include <GL/glew.h>
+
+/* Spans in flight before a result must be available, in frames */
+#define GPU_TIMER_LATENCY 4
+/* Samples of the rolling average and max */
+#define GPU_TIMER_HISTORY 64
+
+typedef struct {
+    double lastMs;      // most recent result
+    double averageMs;   // average of the last GPU_TIMER_HISTORY results
+    double maxMs;       // max of the last GPU_TIMER_HISTORY results
+    int samples;        // results in the average, up to GPU_TIMER_HISTORY
+    unsigned long skipped; // spans not measured, the queries were busy
+} GPUTimerStats;
+
+typedef struct {
+    GLuint queries[GPU_TIMER_LATENCY][2]; // begin and end timestamps
+    bool pending[GPU_TIMER_LATENCY];      // result not read back yet
+    int next;           // slot of the next span
+    int oldest;         // oldest pending slot
+    int current;        // slot of the running span, -1 if none
+    GLuint64 history[GPU_TIMER_HISTORY]; // results, in nanoseconds
+    int historyLen, historyPos;
+    unsigned long skipped;
+} GPUTimer;
+
+/**
+ * Tells if the context has timestamp queries (GL 3.3 or ARB_timer_query)
+ *
+ * @return true if gpuTimerNew can work
+ */
+bool gpuTimerSupported();
+
+/**
+ * Creates a timer, with a current context
+ *
+ * @return a new GPUTimer, or NULL on error or without timer queries
+ */
+GPUTimer *gpuTimerNew();
+
+/**
+ * Destroys the timer and its queries
+ *
+ * @param t The timer, or NULL
+ */
+void gpuTimerDelete(GPUTimer *t);
+
+/**
+ * @brief Starts measuring the commands that follow.
+ *
+ * The results of the previous spans that are available are read back
+ * first. If the queries of the oldest span are still in flight the span
+ * is skipped rather than waiting for them.
+ *
+ * @param t The timer, or NULL to do nothing
+ */
+void gpuTimerBegin(GPUTimer *t);
+
+/**
+ * Ends the span started by gpuTimerBegin
+ *
+ * @param t The timer, or NULL to do nothing
+ */
+void gpuTimerEnd(GPUTimer *t);
+
+/**
+ * Reads back the results that are available, without waiting.
+ * gpuTimerBegin already does it.
+ *
+ * @param t The timer
+ */
+void gpuTimerCollect(GPUTimer *t);
+
+/**
+ * Gets the results read back so far
+ *
+ * @param t The timer
+ * @param stats Where to write the last, average and max times
+ */
+void gpuTimerGetStats(const GPUTimer *t, GPUTimerStats *stats);
+
+#endif // GPU_TIMER_H
@@ -0,0 +1,49 @@
+#include <stddef.h>
+#include "mem_debug.h"
+
+#ifdef MEM_DEBUG
+static unsigned long heapAllocs = 0;
+
+// provided by the linker --wrap option
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    heapAllocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    heapAllocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heapAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+bool memDebugEnabled()
+{
+    return true;
+}
+
+unsigned long memHeapAllocs()
+{
+    return heapAllocs;
+}
+#else
+bool memDebugEnabled()
+{
+    return false;
+}
+
+unsigned long memHeapAllocs()
+{
+    return 0;
+}
+#endif // MEM_DEBUG
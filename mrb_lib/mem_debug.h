@@ -0,0 +1,28 @@
+/**
+ * Heap allocation counter, to check the frames do not allocate.
+ *
+ * Only counts when built with -DMEM_DEBUG and linked with
+ * -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc, which routes the
+ * allocations of the objects we link (not the shared libraries) through
+ * the counter. make MEM_DEBUG=1 builds the game that way.
+ */
+#ifndef MEM_DEBUG_H
+#define MEM_DEBUG_H
+
+#include <stdbool.h>
+
+/**
+ * Checks if allocations are being counted
+ *
+ * @return true in MEM_DEBUG builds
+ */
+bool memDebugEnabled();
+
+/**
+ * Gets the number of malloc/calloc/realloc calls made so far
+ *
+ * @return the number of heap allocations, 0 if not counting
+ */
+unsigned long memHeapAllocs();
+
+#endif // MEM_DEBUG_H
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "particles.h"
+
+bool particlesInit(Particles *p, int size)
+{
+    float *fields;
+
+    memset(p, 0, sizeof(*p));
+    // one block for the 6 arrays
+    if (!(fields = malloc(6 * size * sizeof(*fields)))) {
+        fprintf(stderr, "Cannot alloc %d particles\n", size);
+        return false;
+    }
+    p->x = fields;
+    p->y = fields + size;
+    p->vx = fields + 2 * size;
+    p->vy = fields + 3 * size;
+    p->life = fields + 4 * size;
+    p->invLife = fields + 5 * size;
+    p->size = size;
+
+    return true;
+}
+
+void particlesFree(Particles *p)
+{
+    free(p->x);
+    memset(p, 0, sizeof(*p));
+}
+
+void particlesUpdate(Particles *p, float dt, float gravityX, float gravityY)
+{
+    float *restrict x = p->x, *restrict y = p->y;
+    float *restrict vx = p->vx, *restrict vy = p->vy;
+    float *restrict life = p->life, *restrict invLife = p->invLife;
+    int i, live, dead = 0, len = p->len;
+
+    for (i = 0; i < len; i++) {
+        vx[i] += gravityX * dt;
+        vy[i] += gravityY * dt;
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        life[i] -= dt;
+        dead += life[i] <= 0;
+    }
+    if (dead == 0)
+        return;
+
+    // compact from the first dead one: every particle is copied to the
+    // next live position, which only advances past live ones; no branch
+    // on the life
+    for (live = 0; life[live] > 0; live++)
+        ;
+    for (i = live; i < len; i++) {
+        x[live] = x[i];
+        y[live] = y[i];
+        vx[live] = vx[i];
+        vy[live] = vy[i];
+        life[live] = life[i];
+        invLife[live] = invLife[i];
+        live += life[i] > 0;
+    }
+    p->len = live;
+}
+
+/**
+ * Gets the alpha of a particle, faded with its life left
+ *
+ * @param p The particles
+ * @param i Index of the particle
+ * @param alpha Alpha at full life
+ * @return the faded alpha
+ */
+static inline GLubyte particleAlpha(const Particles *p, int i, GLubyte alpha)
+{
+    float t = p->life[i] * p->invLife[i];
+
+    return (GLubyte) (alpha * (t < 1.0f ? t : 1.0f));
+}
+
+void particlesWriteQuads(const Particles *p, Vertex *v, float size,
+        Color color, AABB uv)
+{
+    float half = size / 2;
+    Color faded = color;
+    int i;
+
+    for (i = 0; i < p->len; i++, v += 4) {
+        faded.a = particleAlpha(p, i, color.a);
+        sbQuadVertices(v, p->x[i] - half, p->y[i] - half,
+                p->x[i] + half, p->y[i] + half, faded, uv);
+    }
+}
+
+void particlesWriteInstances(const Particles *p, SpriteInstance *inst,
+        float size, Color color, AABB uv)
+{
+    float half = size / 2;
+    int i;
+
+    for (i = 0; i < p->len; i++, inst++) {
+        inst->x = p->x[i] - half;
+        inst->y = p->y[i] - half;
+        inst->width = inst->height = size;
+        inst->minU = uv.minX;
+        inst->minV = uv.minY;
+        inst->maxU = uv.maxX;
+        inst->maxV = uv.maxY;
+        inst->color = color;
+        inst->color.a = particleAlpha(p, i, color.a);
+    }
+}
+
+ParticleSystem *psNew(GLProgram *prog, SBLayout layout, int maxParticles,
+        GLuint textureID)
+{
+    ParticleSystem *ps;
+
+    if (layout != SB_LAYOUT_INDEXED && layout != SB_LAYOUT_INSTANCED) {
+        fprintf(stderr, "psNew: indexed or instanced layout only\n");
+        return NULL;
+    }
+    if (!(ps = calloc(1, sizeof(*ps)))) {
+        fprintf(stderr, "Cannot alloc ParticleSystem\n");
+        return NULL;
+    }
+    if (!particlesInit(&ps->particles, maxParticles)) {
+        free(ps);
+        return NULL;
+    }
+    if (!(ps->sb = sbNew(prog))) {
+        particlesFree(&ps->particles);
+        free(ps);
+        return NULL;
+    }
+    sbInit(ps->sb);
+    if (!sbSetLayout(ps->sb, layout)) {
+        psDelete(ps);
+        return NULL;
+    }
+    // rewritten every frame, straight into the mapped buffer
+    sbSetUploadMode(ps->sb, SB_UPLOAD_STREAM);
+    ps->textureID = textureID;
+    ps->uv = (AABB) { 0, 0, 1, 1 };
+    ps->random = 2463534242u;
+    ps->emitter = (PSEmitter) {
+        .angle = 0, .spread = 3.14159265f,
+        .speedMin = 50, .speedMax = 100,
+        .lifeMin = 0.5f, .lifeMax = 1,
+        .size = 8,
+        .color = { 255, 255, 255, 255 },
+    };
+
+    return ps;
+}
+
+void psDelete(ParticleSystem *ps)
+{
+    if (!ps)
+        return;
+    sbDelete(ps->sb);
+    particlesFree(&ps->particles);
+    free(ps);
+}
+
+void psSetEmitter(ParticleSystem *ps, const PSEmitter *emitter)
+{
+    ps->emitter = *emitter;
+}
+
+void psSetUV(ParticleSystem *ps, AABB uv)
+{
+    ps->uv = uv;
+}
+
+/**
+ * Gets a random float in [min, max), xorshift32
+ *
+ * @param ps The particle system
+ * @param min Lower bound
+ * @param max Upper bound
+ * @return the number
+ */
+static inline float psRandom(ParticleSystem *ps, float min, float max)
+{
+    ps->random ^= ps->random << 13;
+    ps->random ^= ps->random >> 17;
+    ps->random ^= ps->random << 5;
+    return min + (max - min) * (ps->random >> 8) * (1.0f / (1 << 24));
+}
+
+int psEmit(ParticleSystem *ps, int count, float x, float y)
+{
+    Particles *p = &ps->particles;
+    PSEmitter *e = &ps->emitter;
+    float angle, speed, life;
+    int i, end;
+
+    if (count > p->size - p->len)
+        count = p->size - p->len;
+    for (i = p->len, end = p->len + count; i < end; i++) {
+        angle = psRandom(ps, e->angle - e->spread, e->angle + e->spread);
+        speed = psRandom(ps, e->speedMin, e->speedMax);
+        life = psRandom(ps, e->lifeMin, e->lifeMax);
+        p->x[i] = x;
+        p->y[i] = y;
+        p->vx[i] = cosf(angle) * speed;
+        p->vy[i] = sinf(angle) * speed;
+        p->life[i] = life;
+        p->invLife[i] = life > 0 ? 1.0f / life : 0;
+    }
+    p->len = end;
+
+    return count;
+}
+
+void psUpdate(ParticleSystem *ps, float dt)
+{
+    particlesUpdate(&ps->particles, dt,
+            ps->emitter.gravityX, ps->emitter.gravityY);
+}
+
+/**
+ * Writes the live particles into the mapped vertices of the batch
+ *
+ * @param ps The particle system
+ */
+static void psBuild(ParticleSystem *ps)
+{
+    Particles *p = &ps->particles;
+    void *v = sbMapQuads(ps->sb, p->len);
+
+    if (!v)
+        return;
+    if (ps->sb->layout == SB_LAYOUT_INSTANCED)
+        particlesWriteInstances(p, v, ps->emitter.size, ps->emitter.color,
+                ps->uv);
+    else
+        particlesWriteQuads(p, v, ps->emitter.size, ps->emitter.color,
+                ps->uv);
+    sbCommitQuads(ps->sb, p->len, ps->textureID, ps->drawLayer, false);
+}
+
+void psRender(ParticleSystem *ps)
+{
+    psBuild(ps);
+    sbDrawBatches(ps->sb);
+}
+
+void psSubmit(ParticleSystem *ps, RenderQueue *rq)
+{
+    psBuild(ps);
+    rqSubmit(rq, ps->sb);
+}
+
+#ifdef COMPILE_TESTS
+void particlesTest()
+{
+    Particles p;
+    Vertex v[4 * 4];
+    SpriteInstance inst[4];
+    int i;
+
+    printf("Testing Particles\n");
+    assert(particlesInit(&p, 8));
+
+    // particle i lives i + 0.5 seconds and moves right at speed i
+    for (i = 0; i < 4; i++) {
+        p.x[i] = p.y[i] = 0;
+        p.vx[i] = i;
+        p.vy[i] = 0;
+        p.life[i] = i + 0.5f;
+        p.invLife[i] = 1.0f / p.life[i];
+    }
+    p.len = 4;
+
+    particlesUpdate(&p, 1, 0, -2);
+    assert(p.len == 3);
+    // the dead one is gone and the others kept their order
+    for (i = 0; i < 3; i++) {
+        assert(p.x[i] == i + 1);
+        assert(p.vy[i] == -2 && p.y[i] == -2);
+        assert(p.life[i] == i + 0.5f);
+    }
+
+    particlesWriteQuads(&p, v, 2, color(10, 20, 30, 200),
+            (AABB) { 0, 0, 1, 1 });
+    assert(v[0].pos.x == 2 && v[0].pos.y == -1);
+    assert(v[2].pos.x == 0 && v[2].pos.y == -3);
+    assert(v[0].uv.u == 1 && v[2].uv.v == 0);
+    // 0.5 of 1.5 seconds left
+    assert(v[0].color.r == 10 && v[0].color.a == (GLubyte) (200 / 3.0f));
+    assert(v[4].pos.x == 3);
+
+    particlesWriteInstances(&p, inst, 2, color(10, 20, 30, 200),
+            (AABB) { 0, 0, 1, 1 });
+    assert(inst[1].x == 1 && inst[1].width == 2 && inst[1].maxU == 1);
+
+    particlesUpdate(&p, 10, 0, 0);
+    assert(p.len == 0);
+
+    particlesFree(&p);
+}
+#endif // COMPILE_TESTS
@@ -0,0 +1,175 @@
+/**
+ * Particle systems: short lived quads without a Sprite each. The
+ * particles are kept in a structure of arrays, updated by plain
+ * loops the compiler can vectorize, and written straight into the
+ * vertex buffer of a SpriteBatch every frame.
+ */
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "aabb.h"
+#include "vertex.h"
+#include "sprite_batch.h"
+#include "render_queue.h"
+#include "gl_program.h"
+
+/* How new particles are spawned, see psEmit */
+typedef struct {
+    float angle, spread;        // direction and half its range, in radians
+    float speedMin, speedMax;   // in units per second
+    float lifeMin, lifeMax;     // in seconds
+    float size;                 // width and height of the quads
+    float gravityX, gravityY;   // acceleration, in units per second squared
+    Color color;                // fades out with the life left
+} PSEmitter;
+
+/* The particles, one array per field; index i of each is particle i */
+typedef struct {
+    float *x, *y;       // center
+    float *vx, *vy;     // velocity
+    float *life;        // seconds left
+    float *invLife;     // 1 / total life, for the fade
+    int len;            // live particles, packed at the front
+    int size;           // capacity of the arrays
+} Particles;
+
+typedef struct {
+    Particles particles;
+    PSEmitter emitter;
+    uint32_t random;    // state of the spawn generator
+    SpriteBatch *sb;    // streams the quads, owns no sprite
+    GLuint textureID;
+    AABB uv;            // sub-image of the texture to draw
+    int drawLayer;      // see spriteSetDrawLayer
+} ParticleSystem;
+
+/**
+ * Allocates the arrays of a set of particles
+ *
+ * @param p The particles
+ * @param size Most live particles
+ * @return false on error
+ */
+bool particlesInit(Particles *p, int size);
+
+/**
+ * Frees the arrays
+ *
+ * @param p The particles
+ */
+void particlesFree(Particles *p);
+
+/**
+ * Moves the particles, ages them and compacts the dead ones away,
+ * keeping the order of the others
+ *
+ * @param p The particles
+ * @param dt Elapsed time, in seconds
+ * @param gravityX Acceleration on x
+ * @param gravityY Acceleration on y
+ */
+void particlesUpdate(Particles *p, float dt, float gravityX, float gravityY);
+
+/**
+ * Writes one quad per particle, in the SB_LAYOUT_INDEXED vertex order
+ *
+ * @param p The particles
+ * @param v Where to write 4 * p->len vertices
+ * @param size Width and height of the quads
+ * @param color Color at full life, faded with the life left
+ * @param uv Texture coordinates of the quads
+ */
+void particlesWriteQuads(const Particles *p, Vertex *v, float size,
+        Color color, AABB uv);
+
+/**
+ * Writes one SpriteInstance per particle, for SB_LAYOUT_INSTANCED
+ *
+ * @param p The particles
+ * @param inst Where to write p->len instances
+ * @param size Width and height of the quads
+ * @param color Color at full life, faded with the life left
+ * @param uv Texture coordinates of the quads
+ */
+void particlesWriteInstances(const Particles *p, SpriteInstance *inst,
+        float size, Color color, AABB uv);
+
+/**
+ * Creates a particle system with its own batch, streamed each frame
+ *
+ * @param prog Program to draw with, matching the layout
+ * @param layout SB_LAYOUT_INDEXED or SB_LAYOUT_INSTANCED
+ * @param maxParticles Most live particles
+ * @param textureID Texture of the particles
+ * @return a new ParticleSystem or NULL on error
+ */
+ParticleSystem *psNew(GLProgram *prog, SBLayout layout, int maxParticles,
+        GLuint textureID);
+
+/**
+ * Destroys the system and its batch
+ *
+ * @param ps The particle system
+ */
+void psDelete(ParticleSystem *ps);
+
+/**
+ * Sets how the next particles are spawned
+ *
+ * @param ps The particle system
+ * @param emitter The spawn parameters, copied
+ */
+void psSetEmitter(ParticleSystem *ps, const PSEmitter *emitter);
+
+/**
+ * Draws the particles with a part of their texture, like
+ * spriteSetRegion, in UV space
+ *
+ * @param ps The particle system
+ * @param uv Texture coordinates, 0 to 1
+ */
+void psSetUV(ParticleSystem *ps, AABB uv);
+
+/**
+ * Spawns particles at a point, with the emitter parameters
+ *
+ * @param ps The particle system
+ * @param count Number of particles
+ * @param x Center of the new particles
+ * @param y Center of the new particles
+ * @return the number spawned, fewer when the system is full
+ */
+int psEmit(ParticleSystem *ps, int count, float x, float y);
+
+/**
+ * Moves and ages the particles, see particlesUpdate
+ *
+ * @param ps The particle system
+ * @param dt Elapsed time, in seconds
+ */
+void psUpdate(ParticleSystem *ps, float dt);
+
+/**
+ * Writes the live particles into the batch and draws them
+ *
+ * @param ps The particle system
+ */
+void psRender(ParticleSystem *ps);
+
+/**
+ * Writes the live particles into the batch like psRender, but queues
+ * them to be drawn with the rest of the frame
+ *
+ * @param ps The particle system
+ * @param rq The render queue of the frame
+ */
+void psSubmit(ParticleSystem *ps, RenderQueue *rq);
+
+/**
+ * Internal self test
+ */
+void particlesTest();
+
+#endif // PARTICLES_H
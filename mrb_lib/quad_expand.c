@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "quad_expand.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define QE_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * A sprite is expanded from 3 vectors of 4 values:
+ * pos = (P0, P1, P2, P3) = (x, y, x + width, y + height),
+ * uv  = (U0, U1, U2, U3) = (minU, minV, maxU, maxV) and the color C.
+ * The corners are (2, 3), (0, 3), (0, 1) and (2, 1), taking the same
+ * lanes from pos and uv. A Vertex is 5 floats: P P C U U, so 4 corners
+ * are 5 vectors and 2 triangles (2 3 / 0 3 / 0 1 / 0 1 / 2 1 / 2 3) are
+ * 7.5 vectors, built with shuffles and written with unaligned stores.
+ */
+
+static inline uint32_t qeColorBits(Color c)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &c, sizeof(bits));
+    return bits;
+}
+
+/**
+ * Writes one vertex, without any conversion
+ */
+static inline void qeVertex(Vertex *v, float x, float y, Color c,
+        float u, float w)
+{
+    v->pos.x = x;
+    v->pos.y = y;
+    v->color = c;
+    v->uv.u = u;
+    v->uv.v = w;
+}
+
+static void qeScalarQuads(Vertex *out, Sprite *const *sprites, int count)
+{
+    const Sprite *sp;
+    float maxX, maxY;
+    int i;
+
+    for (i = 0; i < count; i++, out += 4) {
+        sp = sprites[i];
+        maxX = sp->x + sp->width;
+        maxY = sp->y + sp->height;
+        qeVertex(out + 0, maxX,  maxY,  sp->color, sp->uv.maxX, sp->uv.maxY);
+        qeVertex(out + 1, sp->x, maxY,  sp->color, sp->uv.minX, sp->uv.maxY);
+        qeVertex(out + 2, sp->x, sp->y, sp->color, sp->uv.minX, sp->uv.minY);
+        qeVertex(out + 3, maxX,  sp->y, sp->color, sp->uv.maxX, sp->uv.minY);
+    }
+}
+
+static void qeScalarTriangles(Vertex *out, Sprite *const *sprites, int count)
+{
+    const Sprite *sp;
+    float maxX, maxY;
+    int i;
+
+    for (i = 0; i < count; i++, out += 6) {
+        sp = sprites[i];
+        maxX = sp->x + sp->width;
+        maxY = sp->y + sp->height;
+        qeVertex(out + 0, maxX,  maxY,  sp->color, sp->uv.maxX, sp->uv.maxY);
+        qeVertex(out + 1, sp->x, maxY,  sp->color, sp->uv.minX, sp->uv.maxY);
+        qeVertex(out + 2, sp->x, sp->y, sp->color, sp->uv.minX, sp->uv.minY);
+        out[3] = out[2];
+        qeVertex(out + 4, maxX,  sp->y, sp->color, sp->uv.maxX, sp->uv.minY);
+        out[5] = out[0];
+    }
+}
+
+#ifdef QE_X86
+/* (a[i], a[j], b[k], b[l]) */
+#define QE_SHUF(a, b, i, j, k, l) \
+    _mm_shuffle_ps((a), (b), _MM_SHUFFLE((l), (k), (j), (i)))
+
+__attribute__((target("sse2")))
+static inline void qeLoadSSE2(const Sprite *sp, __m128 *pos, __m128 *uv,
+        __m128 *c)
+{
+    const __m128 hi = _mm_castsi128_ps(_mm_set_epi32(-1, -1, 0, 0));
+    __m128 rect = _mm_loadu_ps(&sp->x); // x, y, width, height
+
+    *pos = _mm_add_ps(_mm_movelh_ps(rect, rect), _mm_and_ps(rect, hi));
+    *uv = _mm_loadu_ps(&sp->uv.minX);
+    *c = _mm_castsi128_ps(_mm_set1_epi32(qeColorBits(sp->color)));
+}
+
+__attribute__((target("sse2")))
+static inline void qeQuadSSE2(float *f, const Sprite *sp)
+{
+    __m128 pos, uv, c;
+
+    qeLoadSSE2(sp, &pos, &uv, &c);
+    _mm_storeu_ps(f + 0, QE_SHUF(pos, QE_SHUF(c, uv, 0, 0, 2, 2), 2, 3, 1, 2));
+    _mm_storeu_ps(f + 4, QE_SHUF(QE_SHUF(uv, pos, 3, 3, 0, 0),
+                QE_SHUF(pos, c, 3, 3, 0, 0), 0, 2, 0, 2));
+    _mm_storeu_ps(f + 8, QE_SHUF(uv, pos, 0, 3, 0, 1));
+    _mm_storeu_ps(f + 12, QE_SHUF(QE_SHUF(c, uv, 0, 0, 0, 0),
+                QE_SHUF(uv, pos, 1, 1, 2, 2), 0, 2, 0, 2));
+    _mm_storeu_ps(f + 16, QE_SHUF(QE_SHUF(pos, c, 1, 1, 0, 0), uv, 0, 2, 2, 1));
+}
+
+__attribute__((target("sse2")))
+static inline void qeTrianglesSSE2(float *f, const Sprite *sp)
+{
+    __m128 pos, uv, c, cu0, cu2, p1c, p3c, u1p2;
+
+    qeLoadSSE2(sp, &pos, &uv, &c);
+    cu0 = QE_SHUF(c, uv, 0, 0, 0, 0);
+    cu2 = QE_SHUF(c, uv, 0, 0, 2, 2);
+    p1c = QE_SHUF(pos, c, 1, 1, 0, 0);
+    p3c = QE_SHUF(pos, c, 3, 3, 0, 0);
+    u1p2 = QE_SHUF(uv, pos, 1, 1, 2, 2);
+    _mm_storeu_ps(f + 0, QE_SHUF(pos, cu2, 2, 3, 1, 2));
+    _mm_storeu_ps(f + 4, QE_SHUF(QE_SHUF(uv, pos, 3, 3, 0, 0), p3c, 0, 2, 0, 2));
+    _mm_storeu_ps(f + 8, QE_SHUF(uv, pos, 0, 3, 0, 1));
+    _mm_storeu_ps(f + 12, QE_SHUF(cu0, QE_SHUF(uv, pos, 1, 1, 0, 0), 0, 2, 0, 2));
+    _mm_storeu_ps(f + 16, QE_SHUF(p1c, uv, 0, 2, 0, 1));
+    _mm_storeu_ps(f + 20, QE_SHUF(pos, cu2, 2, 1, 1, 2));
+    _mm_storeu_ps(f + 24, QE_SHUF(u1p2, p3c, 0, 2, 0, 2));
+    _mm_storeh_pi((__m64 *) (f + 28), uv);
+}
+
+__attribute__((target("sse2")))
+static void qeSSE2Quads(Vertex *out, Sprite *const *sprites, int count)
+{
+    float *f = (float *) out;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4, f += 80) {
+        qeQuadSSE2(f + 0, sprites[i + 0]);
+        qeQuadSSE2(f + 20, sprites[i + 1]);
+        qeQuadSSE2(f + 40, sprites[i + 2]);
+        qeQuadSSE2(f + 60, sprites[i + 3]);
+    }
+    for (; i < count; i++, f += 20)
+        qeQuadSSE2(f, sprites[i]);
+}
+
+__attribute__((target("sse2")))
+static void qeSSE2Triangles(Vertex *out, Sprite *const *sprites, int count)
+{
+    float *f = (float *) out;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4, f += 120) {
+        qeTrianglesSSE2(f + 0, sprites[i + 0]);
+        qeTrianglesSSE2(f + 30, sprites[i + 1]);
+        qeTrianglesSSE2(f + 60, sprites[i + 2]);
+        qeTrianglesSSE2(f + 90, sprites[i + 3]);
+    }
+    for (; i < count; i++, f += 30)
+        qeTrianglesSSE2(f, sprites[i]);
+}
+
+/*
+ * Above this many sprites per call the triangles outgrow L2 and their 7.5
+ * unaligned stores per sprite cost more than the scalar loop. SSE2 is 1.8x
+ * faster at 4096 sprites, equal at 16384 and 10% slower at 200000 (make
+ * quad_bench). Quads stay SSE2 at every size.
+ */
+#define QE_SSE2_MAX_TRIANGLES 16384
+
+/**
+ * Triangles of the SSE2 implementation, handing big calls to the scalar
+ * kernel
+ */
+static void qeSizedTriangles(Vertex *out, Sprite *const *sprites, int count)
+{
+    if (count > QE_SSE2_MAX_TRIANGLES)
+        qeScalarTriangles(out, sprites, count);
+    else
+        qeSSE2Triangles(out, sprites, count);
+}
+
+#endif // QE_X86
+
+/* Kernels by implementation, for 4 and 6 vertices per sprite */
+static const struct {
+    const char *name;
+    QuadExpandFn quads;
+    QuadExpandFn triangles;
+} qeImpls[QE_NUM_IMPLS] = {
+    { "scalar", qeScalarQuads, qeScalarTriangles },
+#ifdef QE_X86
+    { "sse2", qeSSE2Quads, qeSSE2Triangles },
+#else
+    { "sse2", NULL, NULL },
+#endif
+};
+
+bool quadExpandSupported(QEImpl impl)
+{
+    switch (impl) {
+        case QE_SCALAR:
+            return true;
+#ifdef QE_X86
+        case QE_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+#endif
+        default:
+            return false;
+    }
+}
+
+QEImpl quadExpandBest()
+{
+    static int best = -1;
+    int i;
+
+    if (best < 0) {
+        best = QE_SCALAR;
+        for (i = QE_NUM_IMPLS - 1; i > QE_SCALAR; i--) {
+            if (quadExpandSupported(i)) {
+                best = i;
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+const char *quadExpandName(QEImpl impl)
+{
+    if (impl < 0 || impl >= QE_NUM_IMPLS)
+        return "unknown";
+    return qeImpls[impl].name;
+}
+
+QuadExpandFn quadExpandGetImpl(QEImpl impl, int spriteVertices)
+{
+    if (!quadExpandSupported(impl))
+        return NULL;
+    if (spriteVertices == 4)
+        return qeImpls[impl].quads;
+    if (spriteVertices == 6)
+        return qeImpls[impl].triangles;
+    return NULL;
+}
+
+QuadExpandFn quadExpandGet(int spriteVertices)
+{
+#ifdef QE_X86
+    if (quadExpandBest() == QE_SSE2 && spriteVertices == 6)
+        return qeSizedTriangles;
+#endif
+    return quadExpandGetImpl(quadExpandBest(), spriteVertices);
+}
+
+#ifdef COMPILE_TESTS
+void quadExpandTest()
+{
+    enum { N = 37 };
+    Sprite sprites[N], *ptrs[N];
+    Vertex expected[N * 6], got[N * 6 + 1];
+    int i, impl, n;
+
+    printf("Testing QuadExpand\n");
+    assert(sizeof(Vertex) == 5 * sizeof(float));
+    for (i = 0; i < N; i++) {
+        memset(&sprites[i], 0, sizeof(sprites[i]));
+        sprites[i].x = i * 3.5f;
+        sprites[i].y = -i;
+        sprites[i].width = 16 + i;
+        sprites[i].height = 8 + i;
+        sprites[i].color = (Color) { i, 255 - i, 2 * i, 200 };
+        sprites[i].uv = (AABB) { i / 64.f, i / 32.f, i / 16.f, i / 8.f };
+        ptrs[i] = &sprites[i];
+    }
+
+    for (n = 4; n <= 6; n += 2) {
+        quadExpandGetImpl(QE_SCALAR, n)(expected, ptrs, N);
+        // corner 0 is the top right of the sprite
+        assert(expected[0].pos.x == 16 && expected[0].pos.y == 8);
+        assert(expected[0].uv.u == 0 && expected[n].color.g == 254);
+
+        for (impl = QE_SCALAR + 1; impl < QE_NUM_IMPLS; impl++) {
+            if (!quadExpandSupported(impl))
+                continue;
+            // every count, to go through the tails of the unrolled loops
+            for (i = 0; i <= N; i++) {
+                memset(got, 0xab, sizeof(got));
+                quadExpandGetImpl(impl, n)(got, ptrs, i);
+                assert(!memcmp(got, expected, i * n * sizeof(Vertex)));
+                assert(((unsigned char *) &got[i * n])[0] == 0xab);
+            }
+        }
+    }
+    assert(quadExpandGet(4) && quadExpandGet(6) && !quadExpandGet(1));
+    quadExpandGet(6)(got, ptrs, N);
+    assert(!memcmp(got, expected, N * 6 * sizeof(Vertex)));
+}
+#endif // COMPILE_TESTS
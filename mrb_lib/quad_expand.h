@@ -0,0 +1,70 @@
+/**
+ * Expands sprites into interleaved Vertex quads, with SIMD kernels picked
+ * at runtime for the CPU the game runs on.
+ */
+#ifndef QUAD_EXPAND_H
+#define QUAD_EXPAND_H
+
+#include <stdbool.h>
+#include "vertex.h"
+#include "sprite.h"
+
+typedef enum {
+    QE_SCALAR,
+    QE_SSE2,
+    QE_NUM_IMPLS
+} QEImpl;
+
+/**
+ * Writes the vertices of count sprites, one after the other:
+ * 4 corners per sprite (indexed quads) or 6 vertices (2 triangles)
+ */
+typedef void (*QuadExpandFn)(Vertex *out, Sprite *const *sprites, int count);
+
+/**
+ * Tells if an implementation can run on this CPU
+ *
+ * @param impl The implementation
+ * @return true if it is compiled in and the CPU supports it
+ */
+bool quadExpandSupported(QEImpl impl);
+
+/**
+ * Gets the best implementation for this CPU, detected with cpuid
+ * on the first call
+ *
+ * @return the implementation used by quadExpandGet
+ */
+QEImpl quadExpandBest();
+
+/**
+ * Gets the name of an implementation, for logs and benchmarks
+ */
+const char *quadExpandName(QEImpl impl);
+
+/**
+ * Gets the kernel of the best implementation. Call it from the main
+ * thread; the returned function can run on any thread. The SSE2
+ * triangles fall back to the scalar loop on big calls, where they are
+ * store bound and measured slower.
+ *
+ * @param spriteVertices 4 for indexed quads, 6 for triangles
+ * @return the kernel, or NULL if there is none for that layout
+ */
+QuadExpandFn quadExpandGet(int spriteVertices);
+
+/**
+ * Gets the kernel of a given implementation
+ *
+ * @param impl The implementation
+ * @param spriteVertices 4 for indexed quads, 6 for triangles
+ * @return the kernel, or NULL if not supported
+ */
+QuadExpandFn quadExpandGetImpl(QEImpl impl, int spriteVertices);
+
+/**
+ * Internal self test
+ */
+void quadExpandTest();
+
+#endif // QUAD_EXPAND_H
@@ -180,8 +180,9 @@ static void nodeSplit(QTNode *node)
  */
 static bool nodeAdd(QTNode *node, QTObject *obj) 
 {
-    int i, idx;
-    QTObject *oldObj;
+    int i, idx, numRem = 0;
+    // moved objects: the node is a full leaf when it splits
+    QTObject *oldObj, *rem[QT_TREE_MAX_OBJECTS];
 
     // if object cannot fit in this node //
     if (!aabbFitsIn(obj->limits, node->limits)) {
@@ -198,24 +199,20 @@ static bool nodeAdd(QTNode *node, QTObject *obj)
     else if (node->childs[NE] == NULL) {
         // split the node in 4
         nodeSplit(node);
-        // XXX - todo - use List, it's much easy to remove objs.
-        Array *rem = arrayNew();
         // move it's objects to childs, if possible
         arrayForEach(node->objects, oldObj, i) {
             idx = nodeGetIndex(node, oldObj);
-            if (idx >= 0) {
+            if (idx >= 0 && numRem < QT_TREE_MAX_OBJECTS) {
                 if (nodeAdd(node->childs[idx], oldObj)) {
-                    arrayPush(rem, oldObj);
-                    //removeObj(node->objects, oldObj);
+                    rem[numRem++] = oldObj;
                 }
             }
         }
-        arrayForEach(rem, oldObj, i) {
-            idx = arrayIndexOf(node->objects, oldObj);
+        for (i = 0; i < numRem; i++) {
+            idx = arrayIndexOf(node->objects, rem[i]);
             if (idx < 0) continue;
-            removeObj(node->objects, oldObj);
+            removeObj(node->objects, rem[i]);
         }
-        arrayDelete(&rem);
     }
 
     // add original object into one of the childs
@@ -242,6 +239,8 @@ static bool nodeDeleteUp(QTNode *node)
     int numChildsObjs = 0; // number of objects this node children has
     int i;
 
+    if (!n) // root is never deleted
+        return false;
     for (i = 0; i < QT_NUM_CHILDS; i++) {
         numChildsObjs += n->childs[i]->objects->len;
         if (n->childs[i]->childs[NE] != NULL || numChildsObjs > 0)
@@ -462,10 +461,23 @@ QTObject *quadTreeAdd(QuadTree *tree, AABB limits, void *data)
         return NULL;
     }
     obj->tree = tree;
+    tree->items++;
 
     return obj;
 }
 
+void quadTreeRemove(QTObject *obj)
+{
+    QTNode *node = obj->node;
+
+    removeObj(node->objects, obj);
+    // drop the leaves left empty
+    if (node->childs[NE] == NULL && node->objects->len == 0)
+        nodeDeleteUp(node);
+    obj->tree->items--;
+    objectDelete(obj);
+}
+
 /**
  * @brief Query the tree for objects that intersects this limits
  *
@@ -523,6 +535,16 @@ bool quadTreeGetIntersections(QuadTree *tree, AABB limits, Array *result)
     return nodeGetIntersections(tree->root, limits, result);
 }
 
+void quadTreeResetResults(Array *results)
+{
+    arrayReset(results);
+}
+
+void quadTreeDeleteResults(Array *results)
+{
+    arrayDelete(&results);
+}
+
 #ifdef COMPILE_TESTS
 
 static void printObject(QTObject *obj)
@@ -641,7 +663,26 @@ void quadTreeTest()
         //	printObject(res->data[i]);
     }
     arrayReset(res);
-    arrayDelete(&res);
+
+    // remove what we found in the first quadrant
+    assert(tree->items == 6);
+    queryBox = aabb(0, 0, 10, 10);
+    quadTreeGetIntersections(tree, queryBox, res);
+    arrayForEach(res, obj, i) {
+        quadTreeRemove(obj);
+    }
+    assert(tree->items == 2);
+    quadTreeResetResults(res);
+    quadTreeGetIntersections(tree, queryBox, res);
+    assert(res->len == 0);
+    quadTreeGetIntersections(tree, aabb(-10, -10, 10, 10), res);
+    assert(res->len == 2);
+    arrayForEach(res, obj, i) {
+        quadTreeRemove(obj);
+    }
+    assert(tree->items == 0);
+    assert(tree->root->childs[NE] == NULL);
+    quadTreeDeleteResults(res);
 
     //printTree(tree);
 
@@ -83,7 +83,13 @@ void quadTreeDelete(QuadTree *tree);
  */
 QTObject *quadTreeAdd(QuadTree *tree, AABB limits, void *element);
 
-// TODO quadTreeDel tree, QTObject, based on nodeDelete.
+/**
+ * Removes an object from its tree and destroys it.
+ * Leaves left empty are merged back into their parent.
+ *
+ * @param obj The object to remove, as returned by quadTreeAdd
+ */
+void quadTreeRemove(QTObject *obj);
 
 /**
  * Query the tree for the objects that intersects this limits
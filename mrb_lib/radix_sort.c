@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "radix_sort.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+// below this many pairs, insertion sort beats the histograms
+#define RADIX_MIN_LEN 64
+// nearly sorted input falls back to a full sort above len / this
+#define RADIX_MAX_DISPLACED_RATIO 8
+
+static void insertionSort(SortPair *pairs, int len)
+{
+    SortPair p;
+    int i, j;
+
+    for (i = 1; i < len; i++) {
+        p = pairs[i];
+        for (j = i; j > 0 && pairs[j - 1].key > p.key; j--)
+            pairs[j] = pairs[j - 1];
+        pairs[j] = p;
+    }
+}
+
+void radixSort(SortPair *pairs, SortPair *scratch, int len)
+{
+    int counts[RADIX_PASSES][RADIX_BUCKETS];
+    SortPair *src = pairs, *dst = scratch, *tmp;
+    int i, pass, sum, c;
+    unsigned shift;
+
+    if (len < RADIX_MIN_LEN) {
+        insertionSort(pairs, len);
+        return;
+    }
+    // all the histograms in one read of the keys
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < len; i++) {
+        uint64_t key = pairs[i].key;
+        for (pass = 0; pass < RADIX_PASSES; pass++, key >>= RADIX_BITS)
+            counts[pass][key & (RADIX_BUCKETS - 1)]++;
+    }
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+        shift = pass * RADIX_BITS;
+        // every key has the same byte here, nothing to move
+        if (counts[pass][(src[0].key >> shift) & (RADIX_BUCKETS - 1)] == len)
+            continue;
+        for (i = 0, sum = 0; i < RADIX_BUCKETS; i++) {
+            c = counts[pass][i];
+            counts[pass][i] = sum;
+            sum += c;
+        }
+        for (i = 0; i < len; i++)
+            dst[counts[pass][(src[i].key >> shift) & (RADIX_BUCKETS - 1)]++]
+                = src[i];
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != pairs)
+        memcpy(pairs, src, len * sizeof(*pairs));
+}
+
+int radixSortNearlySorted(SortPair *pairs, SortPair *scratch, int len)
+{
+    uint64_t last = 0;
+    uint32_t *pos = NULL, *idx = NULL, keptPos = 0;
+    int i, j, k, d = 0, m, o, pass;
+
+    if (len < 2)
+        return 0;
+    // keep the longest sorted run we can greedily follow; a pair is out
+    // of place if it is below what we kept or above its next neighbour.
+    // The first pass only counts them, the second one moves the kept
+    // pairs down in place and the displaced ones to scratch.
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            if (d == 0)
+                return 0;
+            if (d > len / RADIX_MAX_DISPLACED_RATIO) {
+                radixSort(pairs, scratch, len);
+                return len;
+            }
+            // scratch: displaced, radixSort space, then where they were
+            // and their index, the sort key index being their rank
+            pos = (uint32_t *) (scratch + 2 * d);
+            idx = pos + d;
+        }
+        for (i = 0, k = 0, d = 0; i < len; i++) {
+            if ((k > 0 && pairs[i].key < last)
+                    || (i + 1 < len && pairs[i].key > pairs[i + 1].key
+                        && (k == 0 || pairs[i + 1].key >= last))) {
+                if (pass == 1) {
+                    pos[d] = i;
+                    idx[d] = pairs[i].index;
+                    scratch[d] = (SortPair) { pairs[i].key, d };
+                }
+                d++;
+            } else {
+                last = pairs[i].key;
+                if (pass == 1)
+                    pairs[k] = pairs[i];
+                k++;
+            }
+        }
+    }
+    radixSort(scratch, scratch + d, d);
+
+    // merge from the end, the kept pairs never get overwritten; on equal
+    // keys the one that came last in the input goes last
+    for (i = k - 1, j = d - 1, m = d, o = len - 1; j >= 0; o--) {
+        if (i >= 0) {
+            // displaced pairs before kept pair i in the input
+            while (m > 0 && pos[m - 1] > (uint32_t) (i + m - 1))
+                m--;
+            keptPos = i + m;
+        }
+        if (i < 0 || scratch[j].key > pairs[i].key
+                || (scratch[j].key == pairs[i].key
+                    && pos[scratch[j].index] > keptPos)) {
+            pairs[o].key = scratch[j].key;
+            pairs[o].index = idx[scratch[j].index];
+            j--;
+        } else {
+            pairs[o] = pairs[i--];
+        }
+    }
+
+    return d;
+}
+
+#ifdef COMPILE_TESTS
+static void checkSorted(SortPair *pairs, int len)
+{
+    int i;
+
+    for (i = 1; i < len; i++)
+        assert(pairs[i - 1].key <= pairs[i].key);
+}
+
+void radixSortTest()
+{
+    int i, len = 10000;
+    SortPair *pairs = malloc(len * sizeof(*pairs)),
+             *scratch = malloc(len * sizeof(*scratch));
+
+    printf("Testing RadixSort\n");
+    assert(pairs && scratch);
+
+    // random keys, few distinct values: check order and stability
+    srand(1);
+    for (i = 0; i < len; i++) {
+        pairs[i].key = ((uint64_t) (rand() % 50) << 40) | (rand() % 3);
+        pairs[i].index = i;
+    }
+    radixSort(pairs, scratch, len);
+    checkSorted(pairs, len);
+    for (i = 1; i < len; i++)
+        if (pairs[i - 1].key == pairs[i].key)
+            assert(pairs[i - 1].index < pairs[i].index);
+
+    // short input goes through insertion sort
+    for (i = 0; i < 10; i++)
+        pairs[i].key = 10 - i;
+    radixSort(pairs, scratch, 10);
+    checkSorted(pairs, 10);
+
+    // a few keys changed: sorted without falling back
+    for (i = 0; i < len; i++) {
+        pairs[i].key = i / 4;
+        pairs[i].index = i;
+    }
+    pairs[0].key = len;
+    pairs[5000].key = 3;
+    pairs[len - 1].key = 0;
+    assert(radixSortNearlySorted(pairs, scratch, len) == 3);
+    checkSorted(pairs, len);
+    assert(pairs[len - 1].index == 0);
+
+    // equal keys keep their input order, displaced or not
+    for (i = 0; i < len; i++) {
+        pairs[i].key = i < 100 ? 5 : 6;
+        pairs[i].index = i;
+    }
+    pairs[0].key = 6;
+    pairs[50].key = 3;
+    pairs[len - 1].key = 5;
+    assert(radixSortNearlySorted(pairs, scratch, len) == 3);
+    checkSorted(pairs, len);
+    assert(pairs[0].index == 50 && pairs[1].index == 1);
+    assert(pairs[99].index == (uint32_t) len - 1 && pairs[100].index == 0);
+    for (i = 1; i < len; i++)
+        if (pairs[i - 1].key == pairs[i].key)
+            assert(pairs[i - 1].index < pairs[i].index);
+
+    // already sorted
+    assert(radixSortNearlySorted(pairs, scratch, len) == 0);
+    checkSorted(pairs, len);
+
+    // everything changed: falls back to the full sort
+    for (i = 0; i < len; i++)
+        pairs[i].key = rand();
+    assert(radixSortNearlySorted(pairs, scratch, len) == len);
+    checkSorted(pairs, len);
+
+    free(pairs);
+    free(scratch);
+}
+#endif // COMPILE_TESTS
@@ -0,0 +1,45 @@
+/**
+ * LSD radix sort of (key, index) pairs, used to order draw keys.
+ * Sorting is stable, so equal keys keep their previous order.
+ */
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t key;       // sort key
+    uint32_t index;     // what the key belongs to
+} SortPair;
+
+/**
+ * Sorts pairs by key, one byte per pass. Passes where all the keys have
+ * the same byte are skipped.
+ *
+ * @param pairs The pairs to sort
+ * @param scratch Temporary buffer of at least len pairs
+ * @param len Number of pairs
+ */
+void radixSort(SortPair *pairs, SortPair *scratch, int len);
+
+/**
+ * @brief Sorts pairs that were sorted before a few keys changed.
+ *
+ * The pairs out of place are pulled out, sorted on their own and merged
+ * back, in linear time. If too many keys moved, falls back to radixSort.
+ * Stable as well: on equal keys the merge follows the input order.
+ *
+ * @param pairs The pairs to sort
+ * @param scratch Temporary buffer of at least len pairs
+ * @param len Number of pairs
+ * @return the number of pairs that were out of place, or len on fallback
+ */
+int radixSortNearlySorted(SortPair *pairs, SortPair *scratch, int len);
+
+/**
+ * Internal self test
+ */
+void radixSortTest();
+
+#endif // RADIX_SORT_H
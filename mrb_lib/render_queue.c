@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "render_queue.h"
+#include "gl_state.h"
+
+RenderQueue *rqNew()
+{
+    RenderQueue *rq;
+
+    if (!(rq = calloc(1, sizeof(*rq)))) {
+        fprintf(stderr, "Cannot alloc RenderQueue\n");
+        return NULL;
+    }
+    rq->projection = mat4fIdentity();
+
+    return rq;
+}
+
+void rqDelete(RenderQueue *rq)
+{
+    if (!rq)
+        return;
+    free(rq->commands);
+    free(rq->scratch);
+    gpuTimerDelete(rq->gpuTimer);
+    free(rq);
+}
+
+void rqSetProjection(RenderQueue *rq, const Mat4f *projection)
+{
+    rq->projection = *projection;
+}
+
+bool rqSetGPUTimer(RenderQueue *rq, bool enable)
+{
+    if (!enable) {
+        gpuTimerDelete(rq->gpuTimer);
+        rq->gpuTimer = NULL;
+        return true;
+    }
+    if (!rq->gpuTimer)
+        rq->gpuTimer = gpuTimerNew();
+
+    return rq->gpuTimer != NULL;
+}
+
+/**
+ * Queues one batch, without its static partition
+ *
+ * @param rq The queue
+ * @param sb The sprite batch
+ * @return false if the queue is full or the batch too big
+ */
+static bool rqAddBatch(RenderQueue *rq, SpriteBatch *sb)
+{
+    if (rq->batchesLen == RQ_MAX_BATCHES) {
+        fprintf(stderr, "rqSubmit: more than %d batches\n", RQ_MAX_BATCHES);
+        return false;
+    }
+    if (sb->rbLen > RQ_MAX_RENDER_BATCHES) {
+        fprintf(stderr, "rqSubmit: more than %d render batches\n",
+                RQ_MAX_RENDER_BATCHES);
+        return false;
+    }
+    rq->batches[rq->batchesLen++] = sb;
+
+    return true;
+}
+
+bool rqSubmit(RenderQueue *rq, SpriteBatch *sb)
+{
+    // statics first, like sbDrawBatches
+    if (sb->statics && !rqAddBatch(rq, sb->statics))
+        return false;
+
+    return rqAddBatch(rq, sb);
+}
+
+/**
+ * Gets the command key of a render batch, see RQ_KEY_*
+ *
+ * @param sb The sprite batch
+ * @param batch Index of the batch in the queue
+ * @param idx Index of the render batch
+ * @return the key
+ */
+static inline uint64_t rqKey(SpriteBatch *sb, int batch, int idx)
+{
+    RenderBatch *rb = &sb->renderBatches[idx];
+    // same pass and layer order as the sprite draw key
+    uint64_t layer = rb->opaque
+        ? SPRITE_DRAW_LAYERS - 1 - rb->drawLayer : rb->drawLayer;
+
+    return (uint64_t) !rb->opaque << RQ_KEY_PASS_SHIFT
+        | layer << RQ_KEY_LAYER_SHIFT
+        | (sb->prog->programID & RQ_KEY_PROGRAM_MASK) << RQ_KEY_PROGRAM_SHIFT
+        | (rb->textureID & RQ_KEY_TEXTURE_MASK) << RQ_KEY_TEXTURE_SHIFT
+        | (uint64_t) batch << RQ_KEY_BATCH_SHIFT
+        | (uint64_t) idx;
+}
+
+/**
+ * Makes one command per render batch of the queued batches, sorted
+ * by key
+ *
+ * @param rq The queue
+ * @return false on error (no memory)
+ */
+static bool rqSortCommands(RenderQueue *rq)
+{
+    SpriteBatch *sb;
+    SortPair *pair;
+    int i, j, len = 0, size;
+
+    for (i = 0; i < rq->batchesLen; i++)
+        len += rq->batches[i]->rbLen;
+    if (len > rq->commandsSize) {
+        size = rq->commandsSize == 0 ? 64 : rq->commandsSize;
+        while (size < len)
+            size *= 2;
+        free(rq->commands);
+        free(rq->scratch);
+        rq->commands = malloc(size * sizeof(*rq->commands));
+        rq->scratch = malloc(size * sizeof(*rq->scratch));
+        if (!rq->commands || !rq->scratch) {
+            fprintf(stderr, "Cannot alloc %d render commands\n", size);
+            rq->commandsSize = 0;
+            return false;
+        }
+        rq->commandsSize = size;
+    }
+
+    pair = rq->commands;
+    for (i = 0; i < rq->batchesLen; i++) {
+        sb = rq->batches[i];
+        for (j = 0; j < sb->rbLen; j++, pair++) {
+            pair->key = rqKey(sb, i, j);
+            pair->index = (uint32_t) i << RQ_KEY_BATCH_SHIFT | j;
+        }
+    }
+    rq->commandsLen = len;
+    radixSort(rq->commands, rq->scratch, len);
+
+    return true;
+}
+
+/**
+ * Makes a program current and sends it the frame uniforms
+ *
+ * @param rq The queue
+ * @param prog The program
+ */
+static void rqUseProgram(RenderQueue *rq, GLProgram *prog)
+{
+    glProgramUse(prog);
+    glUniformMatrix4fv(glProgramUniformLocation(prog, "P"),
+            1, GL_FALSE, &rq->projection.m[0][0]);
+    glUniform1i(glProgramUniformLocation(prog, "mySampler"), 0);
+    rq->stats.programChanges++;
+}
+
+/**
+ * Counts the commands from first that can be drawn by one multi-draw:
+ * the next render batches of the same batch, with the same texture
+ * and pass
+ *
+ * @param rq The queue
+ * @param first First command of the run
+ * @return the number of commands in the run
+ */
+static int rqMultiDrawRun(RenderQueue *rq, int first)
+{
+    const uint64_t mask = RQ_KEY_TEXTURE_MASK << RQ_KEY_TEXTURE_SHIFT
+        | 1ULL << RQ_KEY_PASS_SHIFT;
+    SortPair *cmd = &rq->commands[first];
+    int i;
+
+    for (i = 1; first + i < rq->commandsLen; i++)
+        if (cmd[i].index != cmd[0].index + i
+                || (cmd[i].key & mask) != (cmd[0].key & mask))
+            break;
+    return i;
+}
+
+void rqFlush(RenderQueue *rq)
+{
+    SpriteBatch *sb, *bound = NULL;
+    GLProgram *prog = NULL;
+    RenderBatch *rb;
+    GLuint texture = 0;
+    GLenum textureTarget = 0;
+    GLint depthLocation = -1, originLocation = -1;
+    int i, idx, run, layer, pass = -1, drawLayer = -1;
+
+    memset(&rq->stats, 0, sizeof(rq->stats));
+    gpuTimerBegin(rq->gpuTimer);
+    // every upload before the first draw
+    for (i = 0; i < rq->batchesLen; i++)
+        sbPrepareDraw(rq->batches[i]);
+    if (!rqSortCommands(rq))
+        rq->commandsLen = 0;
+
+    glStateActiveTexture(GL_TEXTURE0);
+    for (i = 0; i < rq->commandsLen; i += run) {
+        sb = rq->batches[rq->commands[i].index >> RQ_KEY_BATCH_SHIFT];
+        idx = rq->commands[i].index & RQ_KEY_RB_MASK;
+        rb = &sb->renderBatches[idx];
+        if (sb->prog != prog) {
+            prog = sb->prog;
+            rqUseProgram(rq, prog);
+            depthLocation = glProgramUniformLocation(prog, "depth");
+            originLocation = glProgramUniformLocation(prog, "origin");
+            // uniforms are per program, send them again
+            drawLayer = -1;
+            bound = NULL;
+        }
+        if (sb != bound) {
+            bound = sb;
+            glStateBindVertexArray(sb->vao);
+            glUniform2f(originLocation, sb->origin.x, sb->origin.y);
+            rq->stats.vaoChanges++;
+        }
+        if (pass != !rb->opaque) {
+            pass = !rb->opaque;
+            sbSetPass(rb->opaque);
+            rq->stats.passChanges++;
+        }
+        // in multi-draw mode the depth comes with each command
+        layer = sb->multiDraw ? 0 : rb->drawLayer;
+        if (layer != drawLayer) {
+            drawLayer = layer;
+            glUniform1f(depthLocation, sbLayerDepth(drawLayer));
+        }
+        if (rb->textureID != texture || sb->textureTarget != textureTarget) {
+            texture = rb->textureID;
+            textureTarget = sb->textureTarget;
+            glStateBindTexture(textureTarget, texture);
+            rq->stats.textureChanges++;
+        }
+        run = sb->multiDraw ? rqMultiDrawRun(rq, i) : 1;
+        if (run > 1)
+            sbMultiDrawRenderBatches(sb, idx, run);
+        else
+            sbDrawRenderBatch(sb, idx);
+    }
+    rq->stats.commands = rq->commandsLen;
+
+    if (pass >= 0) {
+        glStateDepthMask(GL_TRUE);
+        glStateEnable(GL_DEPTH_TEST, false);
+    }
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0);
+    glStateBindVertexArray(0);
+    if (prog)
+        glProgramUnuse(prog);
+    gpuTimerEnd(rq->gpuTimer);
+
+    for (i = 0; i < rq->batchesLen; i++) {
+        sb = rq->batches[i];
+        sbFrameEnd(sb);
+        sbAddStats(&rq->stats.sprites, &sb->stats);
+    }
+    // like sbDrawBatches, a batch counters include its static partition
+    for (i = 0; i < rq->batchesLen; i++) {
+        sb = rq->batches[i];
+        if (sb->statics)
+            sbAddStats(&sb->stats, &sb->statics->stats);
+    }
+    rq->stats.batches = rq->batchesLen;
+    rq->stats.drawCalls = rq->stats.sprites.drawCalls;
+    rq->batchesLen = 0;
+    rq->commandsLen = 0;
+}
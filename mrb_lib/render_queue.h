@@ -0,0 +1,123 @@
+/**
+ * Frame render queue: every producer (sprite batches, chunks, text...)
+ * submits its built batches, and the queue draws all their render batches
+ * in one sorted pass, changing programs, textures and vertex arrays only
+ * when the next draw needs it.
+ */
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mat4f.h"
+#include "sprite_batch.h"
+#include "radix_sort.h"
+#include "gpu_timer.h"
+
+/* Maximum number of batches submitted in a frame */
+#define RQ_MAX_BATCHES 256
+/* Maximum number of render batches of a submitted batch, below 1 << 16
+ * so consecutive commands of two batches never look like one run */
+#define RQ_MAX_RENDER_BATCHES 65535
+
+/*
+ * Command key, commands are drawn in ascending key order:
+ * | 1 bit pass | 8 bits layer | 7 bits program | 24 bits texture |
+ * | 8 bits batch | 16 bits render batch |
+ * Pass and layer are those of the sprite draw key (see SB_KEY_*), so all
+ * the producers share the opaque and translucent passes and their layers.
+ * Inside a layer, commands are grouped by program and texture; the batch
+ * and render batch keep the submission and build order of the rest.
+ */
+#define RQ_KEY_PASS_SHIFT 63
+#define RQ_KEY_LAYER_SHIFT 55
+#define RQ_KEY_PROGRAM_SHIFT 48
+#define RQ_KEY_TEXTURE_SHIFT 24
+#define RQ_KEY_BATCH_SHIFT 16
+#define RQ_KEY_PROGRAM_MASK 0x7fULL
+#define RQ_KEY_TEXTURE_MASK 0xffffffULL
+#define RQ_KEY_RB_MASK 0xffffULL
+
+/* Counters of the last rqFlush */
+typedef struct {
+    int batches;        // batches submitted, with their static partitions
+    int commands;       // render batches drawn
+    int drawCalls;      // glDraw* calls
+    int programChanges; // glUseProgram calls
+    int textureChanges; // glBindTexture calls
+    int vaoChanges;     // glBindVertexArray calls
+    int passChanges;    // depth and blend state changes
+    SBStats sprites;    // sums of the submitted batches counters
+} RQStats;
+
+typedef struct {
+    SpriteBatch *batches[RQ_MAX_BATCHES]; // submitted this frame
+    int batchesLen;
+    SortPair *commands; // key and batch/render batch of each draw
+    SortPair *scratch;  // radix sort temporary
+    int commandsSize;
+    int commandsLen;
+    Mat4f projection;   // sent to each program as P, see rqSetProjection
+    GPUTimer *gpuTimer; // GPU time of rqFlush, or NULL
+    RQStats stats;
+} RenderQueue;
+
+/**
+ * Creates an empty queue
+ *
+ * @return a new RenderQueue or NULL on error
+ */
+RenderQueue *rqNew();
+
+/**
+ * Destroys the queue, but not the batches submitted to it
+ *
+ * @param rq The queue
+ */
+void rqDelete(RenderQueue *rq);
+
+/**
+ * Sets the projection sent to the programs of the queued batches, as
+ * the uniform P, once per program and frame
+ *
+ * @param rq The queue
+ * @param projection The projection, like the camera matrix
+ */
+void rqSetProjection(RenderQueue *rq, const Mat4f *projection);
+
+/**
+ * Measures the GPU time of each rqFlush, uploads included, see GPUTimer.
+ * The commands of the batches are interleaved, so they are timed as a
+ * whole rather than by batch.
+ *
+ * @param rq The queue
+ * @param enable true to measure
+ * @return false if the context has no timer queries
+ */
+bool rqSetGPUTimer(RenderQueue *rq, bool enable);
+
+/**
+ * @brief Queues a built batch for this frame, with its static partition.
+ *
+ * The batch must stay alive and must not be built again until rqFlush.
+ * Its sprites can be removed, the render batches and vertices are kept.
+ *
+ * @param rq The queue
+ * @param sb The sprite batch, built with sbBuildBatches
+ * @return false if the queue is full or the batch too big
+ */
+bool rqSubmit(RenderQueue *rq, SpriteBatch *sb);
+
+/**
+ * @brief Draws the batches submitted this frame and empties the queue.
+ *
+ * All the uploads are done first, then the render batches of all the
+ * batches are sorted by command key and drawn. The program, texture,
+ * vertex array and pass are set only when they change from the
+ * previous draw; see RQStats for how many times they did.
+ *
+ * @param rq The queue
+ */
+void rqFlush(RenderQueue *rq);
+
+#endif // RENDER_QUEUE_H
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include "error.h"
 #include "simple_sprite.h"
+#include "gl_state.h"
 
 void simpleSpriteSetPos(SimpleSprite *sprite, float x, float y) 
 {
@@ -16,12 +17,12 @@ void simpleSpriteSetPos(SimpleSprite *sprite, float x, float y)
     vertexSetPos(sprite->ventrices + 4, x + sprite->width, y);
     vertexSetPos(sprite->ventrices + 5, x + sprite->width, y + sprite->height);
 
-    glBindBuffer(GL_ARRAY_BUFFER, sprite->vboID);
+    glStateBindBuffer(GL_ARRAY_BUFFER, sprite->vboID);
     glBufferData(
             GL_ARRAY_BUFFER, sizeof(sprite->ventrices),
             sprite->ventrices, GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 SimpleSprite *simpleSpriteNew(float x, float y, float width, float height, GLuint textureID) 
@@ -59,7 +60,7 @@ SimpleSprite *simpleSpriteNew(float x, float y, float width, float height, GLuin
 void simpleSpriteDraw(SimpleSprite *sprite) 
 {
 
-    glBindBuffer(GL_ARRAY_BUFFER, sprite->vboID);
+    glStateBindBuffer(GL_ARRAY_BUFFER, sprite->vboID);
 
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
@@ -83,14 +84,14 @@ void simpleSpriteDraw(SimpleSprite *sprite)
     glDisableVertexAttribArray(1);
     glDisableVertexAttribArray(0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void simpleSpriteDelete(SimpleSprite *sprite) 
 {
     if (sprite) {
         if (sprite->vboID) {
-            glDeleteBuffers(1, &sprite->vboID);
+            glStateDeleteBuffers(1, &sprite->vboID);
         }
         free(sprite);
         sprite = NULL;
@@ -1,16 +1,42 @@
 #include <GL/glew.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "sprite.h"
+#include "sprite_batch.h"
+
+/**
+ * Flags the sprite as changed, and lets its batch know
+ * that the sprite vertices must be rebuilt.
+ *
+ * @param sp The sprite
+ */
+static void spriteMarkDirty(Sprite *sp)
+{
+    if (sp->dirty)
+        return;
+    sp->dirty = true;
+    if (sp->batch)
+        sbSpriteDirty(sp->batch, sp);
+}
 
 Sprite *spriteNew(float x, float y, float width, float height, GLuint textureID) 
 {
     Sprite *sp = NULL;
 
-    if (!(sp = calloc(1, sizeof(*sp)))) {
+    if (!(sp = malloc(sizeof(*sp)))) {
         fprintf(stderr, "Cannot malloc sprite\n");
         return NULL;
     }
+    spriteInit(sp, x, y, width, height, textureID);
+
+    return sp;
+}
+
+void spriteInit(Sprite *sp, float x, float y, float width, float height,
+        GLuint textureID)
+{
+    memset(sp, 0, sizeof(*sp));
     spriteSetTextureID(sp, textureID);
     spriteSetPos(sp, x, y);
     spriteSetDimensions(sp, width, height);
@@ -21,23 +47,22 @@ Sprite *spriteNew(float x, float y, float width, float height, GLuint textureID)
 
     spriteSetNumFrames(sp, 1, 1);
     AABB uv = aabb(0, 0, 1, 1);
+    sp->region = uv;
     spriteSetUV(sp, uv);
-
-    return sp;
 }
 
 void spriteSetPos(Sprite *sp, float x, float y) 
 {
     sp->x = x;
     sp->y = y;
-    sp->dirty = true;
+    spriteMarkDirty(sp);
 }
 
 void spriteSetDimensions(Sprite *sp, float width, float height) 
 {
     sp->width = width;
     sp->height = height;
-    sp->dirty = true;
+    spriteMarkDirty(sp);
 }
 
 void spriteSetColor(Sprite *sp, Color *color) 
@@ -46,6 +71,7 @@ void spriteSetColor(Sprite *sp, Color *color)
     sp->color.g = color->g;
     sp->color.b = color->b;
     sp->color.a = color->a;
+    spriteMarkDirty(sp);
 }
 
 void spriteSetNumFrames(Sprite *sp, int numX, int numY)
@@ -76,8 +102,10 @@ void spriteSetTextureID(Sprite *sp, GLuint textureID)
         fprintf(stderr, "Invalid Texture iD: %d\n", textureID);
         exit(1);
     }
+    if (sp->batch && sp->textureID != textureID)
+        sp->batch->needsSort = true;
     sp->textureID = textureID;
-    sp->dirty = true;
+    spriteMarkDirty(sp);
 }
 
 bool spriteSetUV(Sprite *sp, AABB uv)
@@ -89,13 +117,52 @@ bool spriteSetUV(Sprite *sp, AABB uv)
         fprintf(stderr, "spriteSetUV AABB uv must have vals from 0.0 to 1.0\n");
         return false;
     }
-    sp->uv = uv;
+    float w = sp->region.maxX - sp->region.minX,
+          h = sp->region.maxY - sp->region.minY;
+
+    sp->uv.minX = sp->region.minX + uv.minX * w;
+    sp->uv.minY = sp->region.minY + uv.minY * h;
+    sp->uv.maxX = sp->region.minX + uv.maxX * w;
+    sp->uv.maxY = sp->region.minY + uv.maxY * h;
+    spriteMarkDirty(sp);
 
     return true;
 }
 
+void spriteSetRegion(Sprite *sp, GLuint textureID, AABB region)
+{
+    spriteSetTextureID(sp, textureID);
+    sp->region = region;
+    spriteSetUV(sp, aabb(0, 0, 1, 1));
+}
+
+void spriteSetLayer(Sprite *sp, int layer)
+{
+    sp->layer = layer;
+    spriteMarkDirty(sp);
+}
+
+void spriteSetDrawLayer(Sprite *sp, int drawLayer)
+{
+    if (drawLayer < 0 || drawLayer >= SPRITE_DRAW_LAYERS) {
+        fprintf(stderr, "Invalid draw layer: %d\n", drawLayer);
+        return;
+    }
+    if (sp->batch && sp->drawLayer != drawLayer)
+        sp->batch->needsSort = true;
+    sp->drawLayer = drawLayer;
+    spriteMarkDirty(sp);
+}
+
+void spriteSetOpaque(Sprite *sp, bool opaque)
+{
+    if (sp->batch && sp->opaque != opaque)
+        sp->batch->needsSort = true;
+    sp->opaque = opaque;
+    spriteMarkDirty(sp);
+}
+
 void spriteDelete(Sprite *sp) 
 {
     free(sp);
 }
-
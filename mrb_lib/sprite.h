@@ -4,11 +4,17 @@
 #include <stdbool.h>
 #include "vertex.h"
 #include "aabb.h"
+#include "quad_tree.h"
 
 typedef struct {
     float x, y, width, height;
 } Rect;
 
+struct SpriteBatch;
+
+/* Number of draw layers, see spriteSetDrawLayer */
+#define SPRITE_DRAW_LAYERS 256
+
 typedef struct {
     float x, y;             // position.
     float width, height;    // Dimensions.
@@ -16,7 +22,18 @@ typedef struct {
     GLuint textureID;       // Texture id to use (see Texture->id)
     int numX, numY;         // Number of subsprites on x/y
     AABB uv;                // using an AABB for UV, with values from 0 to 1.
+    AABB region;            // sub-image of the texture the UV is relative to
+    int layer;              // layer, when textureID is a texture array
+    int drawLayer;          // depth, higher layers are drawn in front
+    bool opaque;            // no transparent pixels, drawn without blending
     bool dirty;             // do we need to update?
+    struct SpriteBatch *batch; // batch this sprite was added to, or NULL
+    int batchIdx;           // vertex slot of this sprite in the batch,
+                            // -1 if culled out of the last build
+    QTObject *cullObj;      // entry in the batch spatial index, or NULL
+    int slot;               // handle slot in the batch
+    int listIdx;            // position in the batch sprite list
+    int dirtyIdx;           // position in the batch changed list
 } Sprite;
 
 /**
@@ -24,6 +41,13 @@ typedef struct {
  */
 Sprite *spriteNew(float x, float y, float width, float height, GLuint textureID);
 
+/**
+ * Initialises a sprite allocated by the caller, like from an arena.
+ * Such sprites must not be passed to spriteDelete.
+ */
+void spriteInit(Sprite *sp, float x, float y, float width, float height,
+        GLuint textureID);
+
 /**
  * Destroys the sprite
  */
@@ -41,6 +65,7 @@ void spriteSetPos(Sprite *sp, float x, float y);
  * of the sprite. For eg., if we want to display only first quarter of the
  * texture, we will use aabb(0, 0, 0.5, 0.5).
  * Default is aabb(0, 0, 1, 1)
+ * The UV is relative to the sprite region (see spriteSetRegion).
  *
  * @param sp The sprite
  * @param uv Sampling UV in AABB format.
@@ -71,5 +96,49 @@ bool spriteSetFrame(Sprite *sp, int x, int y);
  */
 void spriteSetTextureID(Sprite *sp, GLuint textureID);
 
+/**
+ * @brief Makes the sprite use a sub-image of a texture, like an atlas region.
+ *
+ * UVs and frames set later are relative to the region, as if it was a
+ * texture of its own. Resets the UV to the whole region.
+ *
+ * @param sp The sprite
+ * @param textureID Texture holding the sub-image
+ * @param region Sub-image in UV space, default is aabb(0, 0, 1, 1)
+ */
+void spriteSetRegion(Sprite *sp, GLuint textureID, AABB region);
+
+/**
+ * Sets the layer to sample, when the sprite texture is a texture array.
+ * The batch must be in texture array mode (see sbSetTextureArray).
+ *
+ * @param sp The sprite
+ * @param layer The layer index
+ */
+void spriteSetLayer(Sprite *sp, int layer);
+
+/**
+ * @brief Sets the depth of the sprite.
+ *
+ * Sprites of higher layers are drawn in front of the lower ones, whatever
+ * their texture. Default is 0, the back.
+ *
+ * @param sp The sprite
+ * @param drawLayer From 0 to SPRITE_DRAW_LAYERS - 1
+ */
+void spriteSetDrawLayer(Sprite *sp, int drawLayer);
+
+/**
+ * @brief Flags the sprite as fully opaque.
+ *
+ * Opaque sprites are drawn first, front to back, writing the depth buffer
+ * and without blending, so what they hide is never shaded. Only for
+ * textures and colors without any transparent pixel.
+ *
+ * @param sp The sprite
+ * @param opaque true if the sprite has no transparent pixels
+ */
+void spriteSetOpaque(Sprite *sp, bool opaque);
+
 #endif // SPRITE_H
 
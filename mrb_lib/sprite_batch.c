@@ -1,10 +1,25 @@
 #include <string.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 #include <assert.h>
 #include "sprite_batch.h"
+#include "texture_array.h"
+#include "gl_state.h"
 
 #define SB_INIT_RB_LEN 16
 #define SB_INIT_SPRITES_LEN 16
+#define SB_STREAM_MIN_SIZE (1024 * (GLsizeiptr) sizeof(Vertex))
+// dirty sprites closer than this many slots are uploaded in one range
+#define SB_COALESCE_GAP 4
+// if there are more ranges than this, upload a single span covering all
+#define SB_MAX_UPLOAD_RANGES 8
+// minimum number of quads in the shared index buffer
+#define SB_MIN_INDEXED_QUADS 1024
+
+/* Index buffer shared by all SB_LAYOUT_INDEXED batches */
+static GLuint sbIndexBuffer = 0;
+static int sbIndexQuads = 0;    // number of quads it can draw
+static int sbIndexRefs = 0;     // number of batches using it
 
 SpriteBatch *sbNew(GLProgram *prog)
 {
@@ -24,293 +39,1767 @@ SpriteBatch *sbNew(GLProgram *prog)
     sb->sprites = NULL;
     sb->spritesSize = 0;
     sb->spritesLen = 0;
+    sb->slots = NULL;
+    sb->slotsSize = 0;
+    sb->freeSlot = -1;
+
+    sb->dirty = NULL;
+    sb->dirtySize = 0;
+    sb->dirtyLen = 0;
+    sb->ranges = NULL;
+    sb->rangesLen = 0;
+    sb->needsFullUpload = true;
 
     sb->needsSort = true;
+    sb->sortPairs = sb->sortScratch = NULL;
+    sb->sortSprites = NULL;
+    sb->sortSize = 0;
     sb->vao = sb->vbo = 0;
+    sb->attribVbo = 0;
     sb->prog = prog;
 
+    sb->layout = SB_LAYOUT_TRIANGLES;
+    sb->spriteVertices = 6;
+    sb->vertexSize = sizeof(Vertex);
+    sb->textureArray = false;
+    sb->compact = false;
+    sb->origin.x = sb->origin.y = 0;
+    sb->multiDraw = false;
+    sb->drawVbo = sb->indirectVbo = 0;
+    sb->drawCommands = NULL;
+    sb->drawDepths = NULL;
+    sb->drawCommandsSize = 0;
+    sb->expand = quadExpandGet(sb->spriteVertices);
+    sb->textureTarget = GL_TEXTURE_2D;
+    sb->uploadMode = SB_UPLOAD_ORPHAN;
+    sb->stream = NULL;
+    sb->baseVertex = 0;
+
+    sb->index = NULL;
+    sb->culled = NULL;
+    sb->visible = NULL;
+    sb->visibleSize = 0;
+    sb->visibleLen = 0;
+    sb->view = sb->cullBounds = (AABB) { 0, 0, 0, 0 };
+    sb->pool = NULL;
+    sb->statics = NULL;
+    sb->gpuTimer = NULL;
+    memset(&sb->stats, 0, sizeof(sb->stats));
+
     return sb;
 }
 
-void sbInit(SpriteBatch *sb) 
+/**
+ * Sets the vertex attribute pointers for the batch layout, starting at
+ * offset bytes into the buffer bound to GL_ARRAY_BUFFER
+ *
+ * @param sb The sprite batch
+ * @param offset Byte offset of the first vertex
+ */
+static void sbPointAttributes(SpriteBatch *sb, GLintptr offset)
 {
-    if (sb->vao == 0) {
-        glGenVertexArrays(1, &sb->vao);
-    }
-    glBindVertexArray(sb->vao);
+    char *base = (char *) offset;
 
-    if (sb->vbo == 0) {
-        glGenBuffers(1, &sb->vbo);
+    if (sb->layout == SB_LAYOUT_INSTANCED) {
+        // Rectangle //
+        glVertexAttribPointer(
+                0, 4, GL_FLOAT, GL_FALSE, sizeof(SpriteInstance),
+                base + offsetof(SpriteInstance, x));
+        // Color //
+        glVertexAttribPointer(
+                1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SpriteInstance),
+                base + offsetof(SpriteInstance, color));
+        // UV rectangle //
+        glVertexAttribPointer(
+                2, 4, GL_FLOAT, GL_FALSE, sizeof(SpriteInstance),
+                base + offsetof(SpriteInstance, minU));
+        return;
+    }
+    if (sb->compact) {
+        // Position, whole units from the origin //
+        glVertexAttribPointer(
+                0, 2, GL_SHORT, GL_FALSE,
+                sb->vertexSize, base + offsetof(CompactVertex, x));
+        // Color //
+        glVertexAttribPointer(
+                1, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                sb->vertexSize, base + offsetof(CompactVertex, color));
+        // UV //
+        glVertexAttribPointer(
+                2, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+                sb->vertexSize, base + offsetof(CompactVertex, u));
+        return;
     }
-    glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
     // Position - check shader in //
     glVertexAttribPointer(
             0, 2, GL_FLOAT, GL_FALSE,
-            sizeof(Vertex), (void *) offsetof(Vertex, pos));
+            sb->vertexSize, base + offsetof(Vertex, pos));
     // Color //
     glVertexAttribPointer(
             1, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-            sizeof(Vertex), (void *) offsetof(Vertex, color));
+            sb->vertexSize, base + offsetof(Vertex, color));
     // UV //
     glVertexAttribPointer(
             2, 2, GL_FLOAT, GL_FALSE,
-            sizeof(Vertex), (void *) offsetof(Vertex, uv));
+            sb->vertexSize, base + offsetof(Vertex, uv));
+    if (sb->textureArray) {
+        // Layer //
+        glVertexAttribPointer(
+                SB_ATTRIB_LAYER, 1, GL_FLOAT, GL_FALSE,
+                sb->vertexSize, base + offsetof(LayerVertex, layer));
+    }
+}
+
+/**
+ * Points the vertex attributes of the bound vao to a buffer
+ *
+ * @param sb The sprite batch
+ * @param vbo The buffer holding the vertices
+ */
+static void sbSetupAttributes(SpriteBatch *sb, GLuint vbo)
+{
+    int i;
+    // instanced layout advances the attributes once per sprite
+    GLuint divisor = sb->layout == SB_LAYOUT_INSTANCED ? 1 : 0;
+
+    glStateBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    for (i = 0; i < 3; i++) {
+        glEnableVertexAttribArray(i);
+        if (GLEW_VERSION_3_3)
+            glVertexAttribDivisor(i, divisor);
+    }
+    if (sb->textureArray)
+        glEnableVertexAttribArray(SB_ATTRIB_LAYER);
+    else
+        glDisableVertexAttribArray(SB_ATTRIB_LAYER);
+    sbPointAttributes(sb, 0);
+    if (sb->multiDraw) {
+        // one depth per draw command, picked by its base instance
+        glStateBindBuffer(GL_ARRAY_BUFFER, sb->drawVbo);
+        glVertexAttribPointer(SB_ATTRIB_DRAW_DEPTH, 1, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribDivisor(SB_ATTRIB_DRAW_DEPTH, 1);
+        glEnableVertexAttribArray(SB_ATTRIB_DRAW_DEPTH);
+    } else {
+        glDisableVertexAttribArray(SB_ATTRIB_DRAW_DEPTH);
+    }
+
+    sb->attribVbo = vbo;
+}
+
+void sbInit(SpriteBatch *sb) 
+{
+    if (sb->vao == 0) {
+        glGenVertexArrays(1, &sb->vao);
+    }
+    glStateBindVertexArray(sb->vao);
+
+    if (sb->vbo == 0) {
+        glGenBuffers(1, &sb->vbo);
+    }
+    sbSetupAttributes(sb, sb->vbo);
+
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0); // do we still need this?
+    glStateBindVertexArray(0);
+}
+
+bool sbSetUploadMode(SpriteBatch *sb, SBUploadMode mode)
+{
+    GLsizeiptr frameSize;
+
+    if (mode == SB_UPLOAD_STREAM && !sb->stream) {
+        frameSize = sb->verticesSize * sb->vertexSize;
+        if (frameSize < SB_STREAM_MIN_SIZE)
+            frameSize = SB_STREAM_MIN_SIZE;
+        sb->stream = streamBufferNew(
+                GL_ARRAY_BUFFER, frameSize, SB_STREAM_FRAMES);
+        if (!sb->stream)
+            return false;
+    }
+    glStateBindVertexArray(sb->vao);
+    sbSetupAttributes(sb, mode == SB_UPLOAD_STREAM ? sb->stream->id : sb->vbo);
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0);
+    glStateBindVertexArray(0);
+    sb->uploadMode = mode;
+    sb->needsFullUpload = true;
+
+    return true;
+}
+
+/**
+ * Makes sure the shared index buffer can draw numQuads quads, growing it
+ * if needed, and binds it to the current vao. The buffer object is kept
+ * when growing so the vaos already pointing to it stay valid.
+ *
+ * @param numQuads The number of quads to draw
+ * @return true on success
+ */
+static bool sbBindIndices(int numQuads)
+{
+    GLuint *indices;
+    int i, quads;
+
+    if (!sbIndexBuffer)
+        glGenBuffers(1, &sbIndexBuffer);
+    glStateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sbIndexBuffer);
+    if (numQuads <= sbIndexQuads)
+        return true;
+
+    quads = sbIndexQuads ? sbIndexQuads * 2 : SB_MIN_INDEXED_QUADS;
+    while (quads < numQuads)
+        quads *= 2;
+    if (!(indices = malloc(quads * 6 * sizeof(*indices)))) {
+        fprintf(stderr, "Cannot alloc quad indices\n");
+        return false;
+    }
+    for (i = 0; i < quads; i++) {
+        indices[i * 6 + 0] = i * 4 + 0;
+        indices[i * 6 + 1] = i * 4 + 1;
+        indices[i * 6 + 2] = i * 4 + 2;
+        indices[i * 6 + 3] = i * 4 + 2;
+        indices[i * 6 + 4] = i * 4 + 3;
+        indices[i * 6 + 5] = i * 4 + 0;
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, quads * 6 * sizeof(*indices),
+            indices, GL_STATIC_DRAW);
+    free(indices);
+    sbIndexQuads = quads;
+
+    return true;
+}
+
+/**
+ * Updates the per sprite vertex count and size after a layout or texture
+ * mode change, and points the vao attributes to the new format
+ *
+ * @param sb The sprite batch
+ */
+static void sbSetVertexFormat(SpriteBatch *sb)
+{
+    switch (sb->layout) {
+        case SB_LAYOUT_INDEXED:
+            sb->spriteVertices = 4;
+            break;
+        case SB_LAYOUT_INSTANCED:
+            sb->spriteVertices = 1;
+            break;
+        default:
+            sb->spriteVertices = 6;
+            break;
+    }
+    if (sb->layout == SB_LAYOUT_INSTANCED)
+        sb->vertexSize = sizeof(SpriteInstance);
+    else if (sb->textureArray)
+        sb->vertexSize = sizeof(LayerVertex);
+    else if (sb->compact)
+        sb->vertexSize = sizeof(CompactVertex);
+    else
+        sb->vertexSize = sizeof(Vertex);
+    // plain Vertex quads have a vectorized writer
+    if (sb->layout != SB_LAYOUT_INSTANCED && !sb->textureArray && !sb->compact)
+        sb->expand = quadExpandGet(sb->spriteVertices);
+    else
+        sb->expand = NULL;
+    sb->needsFullUpload = true;
+    // vertex size changed, the client side array must be reallocated
+    sb->verticesSize = 0;
+
+    if (sb->vao) {
+        glStateBindVertexArray(sb->vao);
+        sbSetupAttributes(sb, sb->attribVbo);
+        glStateBindBuffer(GL_ARRAY_BUFFER, 0);
+        glStateBindVertexArray(0);
+    }
+}
+
+bool sbSetLayout(SpriteBatch *sb, SBLayout layout)
+{
+    if (layout == sb->layout)
+        return true;
+
+    switch (layout) {
+        case SB_LAYOUT_INDEXED:
+            // streamed frames start at a base vertex inside the ring
+            if (!GLEW_VERSION_3_2 && !GLEW_ARB_draw_elements_base_vertex)
+                return false;
+            sbIndexRefs++;
+            break;
+        case SB_LAYOUT_INSTANCED:
+            if (!GLEW_VERSION_3_3 || sb->textureArray || sb->compact
+                    || sb->multiDraw)
+                return false;
+            break;
+        default:
+            break;
+    }
+    if (sb->layout == SB_LAYOUT_INDEXED)
+        sbIndexRefs--;
+    if (sbIndexRefs == 0 && sbIndexBuffer) {
+        glStateDeleteBuffers(1, &sbIndexBuffer);
+        sbIndexBuffer = 0;
+        sbIndexQuads = 0;
+    }
+    sb->layout = layout;
+    sbSetVertexFormat(sb);
+    if (sb->statics)
+        return sbSetLayout(sb->statics, layout);
+
+    return true;
+}
+
+bool sbSetTextureArray(SpriteBatch *sb, bool enable)
+{
+    if (enable == sb->textureArray)
+        return true;
+    if (enable && (!textureArraySupported()
+                || sb->layout == SB_LAYOUT_INSTANCED || sb->compact))
+        return false;
+    sb->textureArray = enable;
+    sb->textureTarget = enable ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    sbSetVertexFormat(sb);
+    if (sb->statics)
+        return sbSetTextureArray(sb->statics, enable);
+
+    return true;
+}
+
+bool sbSetCompact(SpriteBatch *sb, bool enable)
+{
+    if (enable == sb->compact)
+        return true;
+    if (enable && (sb->layout == SB_LAYOUT_INSTANCED || sb->textureArray))
+        return false;
+    sb->compact = enable;
+    sbSetVertexFormat(sb);
+    if (sb->statics)
+        return sbSetCompact(sb->statics, enable);
+
+    return true;
+}
+
+bool sbSetGPUTimer(SpriteBatch *sb, bool enable)
+{
+    if (!enable) {
+        gpuTimerDelete(sb->gpuTimer);
+        sb->gpuTimer = NULL;
+        return true;
+    }
+    if (!sb->gpuTimer)
+        sb->gpuTimer = gpuTimerNew();
+
+    return sb->gpuTimer != NULL;
+}
+
+bool sbMultiDrawSupported()
+{
+    return GLEW_VERSION_4_3
+        || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0); // do we still need this?
-    glBindVertexArray(0);
+bool sbSetMultiDraw(SpriteBatch *sb, bool enable)
+{
+    if (enable == sb->multiDraw)
+        return true;
+    if (enable && (!sbMultiDrawSupported()
+                || sb->layout == SB_LAYOUT_INSTANCED))
+        return false;
+    if (enable && !sb->drawVbo) {
+        glGenBuffers(1, &sb->drawVbo);
+        glGenBuffers(1, &sb->indirectVbo);
+    }
+    sb->multiDraw = enable;
+    if (sb->vao) {
+        glStateBindVertexArray(sb->vao);
+        sbSetupAttributes(sb, sb->attribVbo);
+        glStateBindBuffer(GL_ARRAY_BUFFER, 0);
+        glStateBindVertexArray(0);
+    }
+    if (sb->statics)
+        return sbSetMultiDraw(sb->statics, enable);
+
+    return true;
+}
+
+void sbSetOrigin(SpriteBatch *sb, float x, float y)
+{
+    sb->origin.x = x;
+    sb->origin.y = y;
+    sb->needsFullUpload = true;
+    if (sb->statics)
+        sbSetOrigin(sb->statics, x, y);
 }
 
 void sbDelete(SpriteBatch *sb)
 {
     if (!sb)
         return;
-    if (sb->renderBatches)
-        free(sb->renderBatches);
+    free(sb->renderBatches);
     if (sb->vertices)
         free(sb->vertices);
     if (sb->sprites)
         free(sb->sprites);
+    free(sb->slots);
+    free(sb->dirty);
+    free(sb->ranges);
+    // the sprites may be gone already, do not touch them
+    if (sb->index) {
+        quadTreeDelete(sb->index);
+        quadTreeDeleteResults(sb->culled);
+    }
+    free(sb->visible);
+    free(sb->sortPairs);
+    free(sb->sortScratch);
+    free(sb->sortSprites);
+    free(sb->drawCommands);
+    free(sb->drawDepths);
+    if (sb->drawVbo) {
+        glStateDeleteBuffers(1, &sb->drawVbo);
+        glStateDeleteBuffers(1, &sb->indirectVbo);
+    }
+    streamBufferDelete(sb->stream);
+    gpuTimerDelete(sb->gpuTimer);
+    sbDelete(sb->statics);
+    sb->statics = NULL;
+    sbSetLayout(sb, SB_LAYOUT_TRIANGLES); // release the shared indices
+    sbSetTextureArray(sb, false);
 
-    //TODO - more cleanup
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    //?!glDisableVertexAttribArray(sb->vao);
+    glStateDeleteVertexArrays(1, &sb->vao);
+    glStateDeleteBuffers(1, &sb->vbo);
     free(sb);
 }
 
-// adds a pointer to sprite to internal sprite batch //
-// and return the index or -1 on error //
-int sbAddSprite(SpriteBatch *sb, Sprite *sp)
+/**
+ * Gets the world area covered by a sprite
+ *
+ * @param sp The sprite
+ * @return the sprite bounding box
+ */
+static inline AABB sbSpriteAABB(Sprite *sp)
+{
+    return (AABB) { sp->x, sp->y, sp->x + sp->width, sp->y + sp->height };
+}
+
+bool sbSetCulling(SpriteBatch *sb, AABB limits)
 {
     int i;
+
+    if (sb->index)
+        return true;
+    if (!(sb->index = quadTreeNew(limits)) || !(sb->culled = arrayNew())) {
+        fprintf(stderr, "Cannot alloc the sprite index\n");
+        return false;
+    }
+    for (i = 0; i < sb->spritesLen; i++) {
+        sb->sprites[i]->cullObj = quadTreeAdd(
+                sb->index, sbSpriteAABB(sb->sprites[i]), sb->sprites[i]);
+        sb->sprites[i]->batchIdx = -1;
+    }
+    sb->view = limits;
+    sb->needsSort = true;
+
+    return true;
+}
+
+void sbSetView(SpriteBatch *sb, AABB view)
+{
+    sb->view = view;
+}
+
+/**
+ * Takes a slot from the free list, growing the slot table if empty
+ *
+ * @param sb The sprite batch
+ * @return the slot index or -1 on error (no memory)
+ */
+static int sbSlotAlloc(SpriteBatch *sb)
+{
+    SBSlot *slots;
+    int i, size;
+
+    if (sb->freeSlot < 0) {
+        size = sb->slotsSize == 0 ? 8 : sb->slotsSize * 2;
+        if (!(slots = realloc(sb->slots, size * sizeof(*slots)))) {
+            fprintf(stderr, "Cannot realloc sb->slots\n");
+            return -1;
+        }
+        for (i = sb->slotsSize; i < size; i++) {
+            slots[i].sprite = NULL;
+            slots[i].gen = 1;
+            slots[i].nextFree = i + 1 < size ? i + 1 : -1;
+        }
+        sb->slots = slots;
+        sb->freeSlot = sb->slotsSize;
+        sb->slotsSize = size;
+    }
+    i = sb->freeSlot;
+    sb->freeSlot = sb->slots[i].nextFree;
+
+    return i;
+}
+
+/**
+ * Returns a slot to the free list. Its generation changes, so the
+ * handles still pointing to it become stale.
+ *
+ * @param sb The sprite batch
+ * @param slot The slot index
+ */
+static void sbSlotFree(SpriteBatch *sb, int slot)
+{
+    sb->slots[slot].sprite = NULL;
+    if (++sb->slots[slot].gen == 0)
+        sb->slots[slot].gen = 1; // 0 is the invalid handle
+    sb->slots[slot].nextFree = sb->freeSlot;
+    sb->freeSlot = slot;
+}
+
+SBHandle sbAdd(SpriteBatch *sb, Sprite *sp)
+{
+    SBHandle h = SB_HANDLE_NONE;
+    Sprite **sprites;
+    int size, slot;
+
     // resize buffer if needed //
     if (sb->spritesLen == sb->spritesSize) {
-        i = sb->spritesSize == 0 ? 8 : sb->spritesSize * 2;
-        sb->sprites = realloc(sb->sprites, i * sizeof(*sb->sprites));
-        if (!sb->sprites) {
+        size = sb->spritesSize == 0 ? 8 : sb->spritesSize * 2;
+        sprites = realloc(sb->sprites, size * sizeof(*sb->sprites));
+        if (!sprites) {
             fprintf(stderr, "Cannot realloc sb->sprites\n");
-            return -1;
-        }
-        while (sb->spritesSize < i)
-            sb->sprites[sb->spritesSize++] = NULL;
-    }
-    // find free slot //
-    for (i = 0; i < sb->spritesSize; i++) {
-        if (! sb->sprites[i]) {
-            sb->sprites[i] = sp;
-            sb->spritesLen++;
-            sb->needsSort = true;
-            return i;
+            return h;
         }
+        sb->sprites = sprites;
+        sb->spritesSize = size;
     }
+    if ((slot = sbSlotAlloc(sb)) < 0)
+        return h;
+    sb->slots[slot].sprite = sp;
 
-    return -1;
+    sp->batch = sb;
+    sp->slot = slot;
+    sp->listIdx = sb->spritesLen;
+    // built from scratch: a flag left from spriteInit or another batch
+    // would keep spriteMarkDirty from queueing its next change
+    sp->dirty = false;
+    sp->dirtyIdx = -1;
+    sp->batchIdx = sp->listIdx;
+    if (sb->index) {
+        sp->cullObj = quadTreeAdd(sb->index, sbSpriteAABB(sp), sp);
+        sp->batchIdx = -1; // not built until the next culling
+    }
+    sb->sprites[sb->spritesLen++] = sp;
+    sb->needsSort = true;
+
+    h.slot = slot;
+    h.gen = sb->slots[slot].gen;
+
+    return h;
 }
 
-void sbResetSprites(SpriteBatch *sb)
+/**
+ * Creates the static partition of a batch, with the same settings
+ *
+ * @param sb The sprite batch
+ * @return the new partition or NULL on error
+ */
+static SpriteBatch *sbNewStatics(SpriteBatch *sb)
 {
-    memset(sb->sprites, 0, sb->spritesSize * sizeof(sb->sprites[0]));
-    sb->spritesLen = 0;
+    SpriteBatch *statics;
+
+    if (!(statics = sbNew(sb->prog)))
+        return NULL;
+    sbInit(statics);
+    if (!sbSetTextureArray(statics, sb->textureArray)
+            || !sbSetLayout(statics, sb->layout)
+            || !sbSetUploadMode(statics, SB_UPLOAD_STATIC)) {
+        fprintf(stderr, "Cannot setup the static sprites\n");
+        sbDelete(statics);
+        return NULL;
+    }
+    statics->pool = sb->pool;
+
+    return statics;
+}
+
+SBHandle sbAddStatic(SpriteBatch *sb, Sprite *sp)
+{
+    SBHandle h;
+
+    if (!sb->statics && !(sb->statics = sbNewStatics(sb)))
+        return SB_HANDLE_NONE;
+    h = sbAdd(sb->statics, sp);
+    if (h.gen)
+        h.slot |= SB_HANDLE_STATIC;
+
+    return h;
+}
+
+/**
+ * Gets the partition a handle belongs to
+ *
+ * @param sb The sprite batch
+ * @param h The handle, changed to be relative to the partition
+ * @return the batch or its static partition, NULL if there is none
+ */
+static SpriteBatch *sbHandleBatch(SpriteBatch *sb, SBHandle *h)
+{
+    if (!(h->slot & SB_HANDLE_STATIC))
+        return sb;
+    h->slot &= ~SB_HANDLE_STATIC;
+
+    return sb->statics;
+}
+
+Sprite *sbGet(SpriteBatch *sb, SBHandle h)
+{
+    if (!(sb = sbHandleBatch(sb, &h)))
+        return NULL;
+    if (h.gen == 0 || h.slot >= (uint32_t) sb->slotsSize
+            || sb->slots[h.slot].gen != h.gen)
+        return NULL;
+
+    return sb->slots[h.slot].sprite;
+}
+
+bool sbRemove(SpriteBatch *sb, SBHandle h)
+{
+    Sprite *sp, *last;
+
+    if (!(sp = sbGet(sb, h)) || !(sb = sbHandleBatch(sb, &h))) {
+        fprintf(stderr, "sbRemove: stale sprite handle %u:%u\n",
+                h.slot, h.gen);
+        return false;
+    }
+    if (sp->cullObj) {
+        quadTreeRemove(sp->cullObj);
+        sp->cullObj = NULL;
+        if (sp->batchIdx >= 0)
+            sb->visible[sp->batchIdx] = NULL;
+    }
+    // drop it from the changed sprites, the last one takes its place
+    if (sp->dirtyIdx >= 0 && sp->dirtyIdx < sb->dirtyLen
+            && sb->dirty[sp->dirtyIdx] == sp) {
+        last = sb->dirty[--sb->dirtyLen];
+        sb->dirty[sp->dirtyIdx] = last;
+        last->dirtyIdx = sp->dirtyIdx;
+    }
+    // swap-remove from the sprite list; the sort puts it back in order
+    last = sb->sprites[--sb->spritesLen];
+    sb->sprites[sp->listIdx] = last;
+    last->listIdx = sp->listIdx;
+    sb->needsSort = true;
+
+    sbSlotFree(sb, sp->slot);
+    sp->batch = NULL;
+
+    return true;
+}
+
+int sbAddSprite(SpriteBatch *sb, Sprite *sp)
+{
+    SBHandle h = sbAdd(sb, sp);
+
+    return h.gen ? (int) h.slot : -1;
 }
 
 bool sbDeleteSprite(SpriteBatch *sb, Sprite *sp) 
 {
-    int i, j;
-    bool found = false;
+    if (sb->statics && sp->batch == sb->statics)
+        return sbDeleteSprite(sb->statics, sp);
+    if (sp->batch != sb) {
+        fprintf(stderr, "Cannot find sprite: %p\n", (void*) sp);
+        return false;
+    }
+
+    return sbRemove(sb, (SBHandle) { sp->slot, sb->slots[sp->slot].gen });
+}
+
+void sbResetSprites(SpriteBatch *sb)
+{
+    Sprite *sp;
+    int i;
 
     for (i = 0; i < sb->spritesLen; i++) {
-        if (sb->sprites[i] == sp) {
-            printf("found sprite at %d index\n", i);
-            found = true;
-            for (j = i; j < sb->spritesLen; j++) {
-                if (sb->sprites[j + 1])
-                    sb->sprites[j] = sb->sprites[j + 1];
-                else
-                    sb->sprites[j] = 0;
-            }
-            sb->spritesLen--;
-            sb->needsSort = true;
-            break;
+        sp = sb->sprites[i];
+        sp->batch = NULL;
+        if (sp->cullObj) {
+            quadTreeRemove(sp->cullObj);
+            sp->cullObj = NULL;
         }
+        sbSlotFree(sb, sp->slot);
     }
-    if (!found) {
-        fprintf(stderr, "Cannot find sprite: %p\n", (void*) sp);
+    sb->spritesLen = 0;
+    sb->visibleLen = 0;
+    sb->dirtyLen = 0;
+    if (sb->statics)
+        sbResetSprites(sb->statics);
+}
+
+void sbSpriteDirty(SpriteBatch *sb, Sprite *sp)
+{
+    Sprite **dirty;
+    SBRange *ranges;
+    int size;
+
+    if (sb->dirtyLen == sb->dirtySize) {
+        size = sb->dirtySize == 0 ? 8 : sb->dirtySize * 2;
+        if (!(dirty = realloc(sb->dirty, size * sizeof(*dirty))))
+            goto err;
+        sb->dirty = dirty;
+        if (!(ranges = realloc(sb->ranges, size * sizeof(*ranges))))
+            goto err;
+        sb->ranges = ranges;
+        sb->dirtySize = size;
     }
+    sp->dirtyIdx = sb->dirtyLen;
+    sb->dirty[sb->dirtyLen++] = sp;
 
-    return found;
+    return;
+err:
+    fprintf(stderr, "Cannot realloc sb->dirty\n");
+    // not queued: rebuild everything, and let its next change queue it
+    sp->dirty = false;
+    sb->needsFullUpload = true;
 }
 
 static int getFreeRenderBatch(SpriteBatch *sb) 
 {
-    int i;
+    RenderBatch *rb;
+    int size;
 
+    // batches are reused from build to build, only grow when needed
     if (sb->rbLen == sb->rbSize) {
-        i = sb->rbSize == 0 ? 2 : sb->rbSize * 2;
-        sb->renderBatches = realloc(sb->renderBatches, i * sizeof(*sb->renderBatches));
-        assert(sb->renderBatches != NULL);
-        if (!sb->renderBatches) {
+        size = sb->rbSize == 0 ? 2 : sb->rbSize * 2;
+        rb = realloc(sb->renderBatches, size * sizeof(*rb));
+        if (!rb) {
             fprintf(stderr, "Cannot realloc sp->renderBatches\n");
             return -1;
         }
-        while (sb->rbSize < i)
-            sb->renderBatches[sb->rbSize++] = NULL;
-    }
-    // find free slot
-    for (i = 0; i < sb->rbSize; i++) {
-        if (! sb->renderBatches[i]) { // found
-            sb->renderBatches[i] = malloc(sizeof(RenderBatch));
-            if (!sb->renderBatches[i]) {
-                fprintf(stderr, "cannot alloc a render batch\n");
-                return -1;
-            }
-            sb->rbLen++;
-            return i;
-        }
+        sb->renderBatches = rb;
+        sb->rbSize = size;
     }
 
-    return -1;
+    return sb->rbLen++;
 }
 
-// Sorts sprites by textureID
-// TODO - use a self balancing tree, to avoid sorting
-// that's it, keep sprites preSorted
-static int sortByTexture(const void *a, const void *b) 
+/**
+ * Gets the draw key of a sprite, see SB_KEY_*
+ *
+ * @param sp The sprite
+ * @return the key
+ */
+static inline uint64_t sbSpriteKey(Sprite *sp)
 {
-    if ((*(Sprite **)a)->textureID < (*(Sprite **)b)->textureID)
-        return -1;
-    else if ((*(Sprite **)a)->textureID > (*(Sprite **)b)->textureID)
-        return 1;
+    // opaque sprites go first and front to back, the others back to front
+    uint64_t layer = sp->opaque
+        ? SPRITE_DRAW_LAYERS - 1 - sp->drawLayer : sp->drawLayer;
 
-    return 0;
+    return (uint64_t) !sp->opaque << SB_KEY_PASS_SHIFT
+        | layer << SB_KEY_LAYER_SHIFT
+        | (sp->textureID & SB_KEY_TEXTURE_MASK) << SB_KEY_TEXTURE_SHIFT;
 }
 
-static void sbSort(SpriteBatch *sb)
+/**
+ * Sorts sprites by draw key
+ *
+ * @param sb The sprite batch
+ * @param sprites The sprites to sort, in place
+ * @param len Number of sprites
+ * @param nearlySorted The sprites were sorted before, and only a few
+ *  of them changed
+ * @return false on error (no memory)
+ */
+static bool sbSortSprites(SpriteBatch *sb, Sprite **sprites, int len,
+        bool nearlySorted)
 {
-    if (sb->needsSort) {
-        printf("Sorting sprites\n");
-        qsort(sb->sprites, sb->spritesLen, sizeof(Sprite *), sortByTexture);
-        sb->needsSort = false;
+    SortPair *pairs;
+    Sprite **sorted;
+    int i, size;
+
+    if (sb->sortSize < len) {
+        size = sb->sortSize == 0 ? 64 : sb->sortSize;
+        while (size < len)
+            size *= 2;
+        // the grown buffers are kept even if the next one fails
+        if (!(pairs = realloc(sb->sortPairs, size * sizeof(*pairs))))
+            goto err;
+        sb->sortPairs = pairs;
+        if (!(pairs = realloc(sb->sortScratch, size * sizeof(*pairs))))
+            goto err;
+        sb->sortScratch = pairs;
+        if (!(sorted = realloc(sb->sortSprites, size * sizeof(*sorted))))
+            goto err;
+        sb->sortSprites = sorted;
+        sb->sortSize = size;
+    }
+    for (i = 0; i < len; i++) {
+        sb->sortPairs[i].key = sbSpriteKey(sprites[i]);
+        sb->sortPairs[i].index = i;
     }
+    if (nearlySorted) {
+        sb->stats.spritesSorted =
+            radixSortNearlySorted(sb->sortPairs, sb->sortScratch, len);
+    } else {
+        radixSort(sb->sortPairs, sb->sortScratch, len);
+        sb->stats.spritesSorted = len;
+    }
+    for (i = 0; i < len; i++)
+        sb->sortSprites[i] = sprites[sb->sortPairs[i].index];
+    memcpy(sprites, sb->sortSprites, len * sizeof(*sprites));
+
+    return true;
+err:
+    fprintf(stderr, "Cannot realloc the sort buffers\n");
+    return false;
 }
 
-void sbBuildBatches(SpriteBatch *sb)
+/**
+ * Forgets the render batches of the last build
+ *
+ * @param sb The sprite batch
+ */
+static void sbResetBatches(SpriteBatch *sb)
 {
-    GLuint lastTextureId = 0;
-    int numBatch = 0, i, j;
+    sb->rbLen = 0;
+}
 
-    if (!sb)
-        return;
+static void sbSort(SpriteBatch *sb)
+{
+    int i;
 
-    sbSort(sb);
+    // the sprites stay sorted from the last build, only what was
+    // added, removed or changed texture since then is out of place
+    if (sb->needsSort
+            && sbSortSprites(sb, sb->sprites, sb->spritesLen, true)) {
+        for (i = 0; i < sb->spritesLen; i++)
+            sb->sprites[i]->listIdx = i;
+        sb->needsSort = false;
+    }
+}
 
-    int needSize = sb->spritesLen * 6;
+/**
+ * Gets where this frame vertices should be written: straight into the
+ * mapped ring buffer when streaming, or into the client side array
+ *
+ * @param sb The sprite batch
+ * @param needSize Number of vertices to write
+ * @return the vertices to write into or NULL on error
+ */
+static void *sbMapVertices(SpriteBatch *sb, int needSize)
+{
+    GLintptr offset;
+    void *vertices;
+
+    sb->baseVertex = 0;
+    if (sb->uploadMode == SB_UPLOAD_STREAM) {
+        vertices = streamBufferMap(sb->stream, needSize * sb->vertexSize,
+                sb->vertexSize, &offset);
+        if (vertices) {
+            sb->baseVertex = offset / sb->vertexSize;
+            return vertices;
+        }
+        fprintf(stderr, "sbMapVertices: cannot map, back to glBufferData\n");
+        sbSetUploadMode(sb, SB_UPLOAD_ORPHAN);
+    }
 
     if (sb->verticesSize < needSize) {
-        sb->vertices = realloc(sb->vertices, needSize * sizeof(Vertex));
+        sb->vertices = realloc(sb->vertices, needSize * sb->vertexSize);
         if (!sb->vertices) {
             fprintf(stderr, "Cannot realloc vertices\n");
-            return;
+            return NULL;
         }
         sb->verticesSize = needSize;
         fprintf(stdout, "Realloc vertices size to: %d\n", sb->verticesSize);
     }
 
-    for (i = 0; i < sb->spritesLen; i++) {
-        if (!sb->sprites[i]->textureID) {
-            printf("invalid sprite texture at position: %d\n", i);
+    return sb->vertices;
+}
+
+/**
+ * Gets a vertex of a sprite slot. Vertices may be LayerVertex, so they are
+ * addressed by the batch vertex size.
+ *
+ * @param sb The sprite batch
+ * @param base First vertex of the sprite
+ * @param j Vertex index
+ * @return the vertex
+ */
+static inline Vertex *sbVertex(SpriteBatch *sb, void *base, int j)
+{
+    return (Vertex *) ((char *) base + j * sb->vertexSize);
+}
+
+/**
+ * Writes the color, and the layer in texture array mode,
+ * of the first n vertices of a sprite
+ *
+ * @param sb The sprite batch
+ * @param base First vertex of the sprite
+ * @param n Number of vertices
+ * @param sp The sprite
+ */
+static void sbWriteColorLayer(SpriteBatch *sb, void *base, int n, Sprite *sp)
+{
+    int j;
+
+    for (j = 0; j < n; j++) {
+        vertexSetColor(
+                sbVertex(sb, base, j),
+                sp->color.r,
+                sp->color.g,
+                sp->color.b,
+                sp->color.a);
+        if (sb->textureArray)
+            ((LayerVertex *) sbVertex(sb, base, j))->layer = sp->layer;
+    }
+}
+
+/**
+ * Writes the 4 corners of a sprite, to be drawn with the shared indices
+ *
+ * @param sb The sprite batch
+ * @param v Where to write the vertices
+ * @param sp The sprite
+ */
+static void sbWriteQuad(SpriteBatch *sb, void *v, Sprite *sp)
+{
+    vertexSetPos(sbVertex(sb, v, 0), sp->x + sp->width, sp->y + sp->height);
+    vertexSetPos(sbVertex(sb, v, 1), sp->x,             sp->y + sp->height);
+    vertexSetPos(sbVertex(sb, v, 2), sp->x,             sp->y				);
+    vertexSetPos(sbVertex(sb, v, 3), sp->x + sp->width, sp->y				);
+
+    vertexSetUV(sbVertex(sb, v, 0), sp->uv.maxX, sp->uv.maxY);
+    vertexSetUV(sbVertex(sb, v, 1), sp->uv.minX, sp->uv.maxY);
+    vertexSetUV(sbVertex(sb, v, 2), sp->uv.minX, sp->uv.minY);
+    vertexSetUV(sbVertex(sb, v, 3), sp->uv.maxX, sp->uv.minY);
+
+    sbWriteColorLayer(sb, v, 4, sp);
+}
+
+void sbQuadVertices(Vertex *v, float x0, float y0, float x1, float y1,
+        Color color, AABB uv)
+{
+    v[0] = (Vertex) { { x1, y1 }, color, { uv.maxX, uv.maxY } };
+    v[1] = (Vertex) { { x0, y1 }, color, { uv.minX, uv.maxY } };
+    v[2] = (Vertex) { { x0, y0 }, color, { uv.minX, uv.minY } };
+    v[3] = (Vertex) { { x1, y0 }, color, { uv.maxX, uv.minY } };
+}
+
+/**
+ * Quantizes a position to whole units, saturating to the int16 range
+ */
+static inline GLshort sbCompactPos(float p)
+{
+    p = roundf(p);
+    if (p < -32768.0f)
+        return -32768;
+    if (p > 32767.0f)
+        return 32767;
+    return (GLshort) p;
+}
+
+/**
+ * Writes a compact vertex, relative to the batch origin
+ */
+static inline void sbCompactVertex(SpriteBatch *sb, CompactVertex *v,
+        float x, float y, Color c, float u, float w)
+{
+    v->x = sbCompactPos(x - sb->origin.x);
+    v->y = sbCompactPos(y - sb->origin.y);
+    v->color = c;
+    v->u = (GLushort) (u * 65535.0f + 0.5f);
+    v->v = (GLushort) (w * 65535.0f + 0.5f);
+}
+
+/**
+ * Writes the compact vertices of a sprite: 4 corners, or 6 vertices
+ * of 2 triangles
+ *
+ * @param sb The sprite batch
+ * @param v Where to write the vertices
+ * @param sp The sprite
+ */
+static void sbWriteCompact(SpriteBatch *sb, CompactVertex *v, Sprite *sp)
+{
+    float maxX = sp->x + sp->width, maxY = sp->y + sp->height;
+
+    sbCompactVertex(sb, &v[0], maxX,  maxY,  sp->color, sp->uv.maxX, sp->uv.maxY);
+    sbCompactVertex(sb, &v[1], sp->x, maxY,  sp->color, sp->uv.minX, sp->uv.maxY);
+    sbCompactVertex(sb, &v[2], sp->x, sp->y, sp->color, sp->uv.minX, sp->uv.minY);
+    if (sb->layout == SB_LAYOUT_INDEXED) {
+        sbCompactVertex(sb, &v[3], maxX, sp->y, sp->color,
+                sp->uv.maxX, sp->uv.minY);
+        return;
+    }
+    v[3] = v[2];
+    sbCompactVertex(sb, &v[4], maxX, sp->y, sp->color, sp->uv.maxX, sp->uv.minY);
+    v[5] = v[0];
+}
+
+/**
+ * Writes the instance record of a sprite
+ *
+ * @param inst Where to write the instance
+ * @param sp The sprite
+ */
+static void sbWriteInstance(SpriteInstance *inst, Sprite *sp)
+{
+    inst->x = sp->x;
+    inst->y = sp->y;
+    inst->width = sp->width;
+    inst->height = sp->height;
+    inst->minU = sp->uv.minX;
+    inst->minV = sp->uv.minY;
+    inst->maxU = sp->uv.maxX;
+    inst->maxV = sp->uv.maxY;
+    inst->color = sp->color;
+}
+
+/**
+ * Gets the address of the first vertex of a sprite slot
+ *
+ * @param sb The sprite batch
+ * @param vertices Start of the vertices
+ * @param idx The slot index
+ * @return the address of the slot
+ */
+static inline void *sbSlot(SpriteBatch *sb, void *vertices, int idx)
+{
+    return (char *) vertices + (size_t) idx * sb->spriteVertices * sb->vertexSize;
+}
+
+/**
+ * Writes the vertices of a sprite: 6 vertices (2 triangles),
+ * 4 corners for indexed layout or 1 instance for instanced layout
+ *
+ * @param sb The sprite batch
+ * @param v Where to write the vertices
+ * @param sp The sprite
+ */
+static void sbWriteSprite(SpriteBatch *sb, void *v, Sprite *sp)
+{
+    if (sb->expand) {
+        sb->expand(v, &sp, 1);
+        return;
+    }
+    if (sb->compact) {
+        sbWriteCompact(sb, v, sp);
+        return;
+    }
+    if (sb->layout == SB_LAYOUT_INDEXED) {
+        sbWriteQuad(sb, v, sp);
+        return;
+    }
+    if (sb->layout == SB_LAYOUT_INSTANCED) {
+        sbWriteInstance(v, sp);
+        return;
+    }
+
+    vertexSetPos(sbVertex(sb, v, 0), sp->x + sp->width, sp->y + sp->height);
+    vertexSetPos(sbVertex(sb, v, 1), sp->x,             sp->y + sp->height);
+    vertexSetPos(sbVertex(sb, v, 2), sp->x,             sp->y				);
+    vertexSetPos(sbVertex(sb, v, 3), sp->x,             sp->y				);
+    vertexSetPos(sbVertex(sb, v, 4), sp->x + sp->width, sp->y				);
+    vertexSetPos(sbVertex(sb, v, 5), sp->x + sp->width, sp->y + sp->height);
+
+    vertexSetUV(sbVertex(sb, v, 0), sp->uv.maxX, sp->uv.maxY);
+    vertexSetUV(sbVertex(sb, v, 1), sp->uv.minX, sp->uv.maxY);
+    vertexSetUV(sbVertex(sb, v, 2), sp->uv.minX, sp->uv.minY);
+    vertexSetUV(sbVertex(sb, v, 3), sp->uv.minX, sp->uv.minY);
+    vertexSetUV(sbVertex(sb, v, 4), sp->uv.maxX, sp->uv.minY);
+    vertexSetUV(sbVertex(sb, v, 5), sp->uv.maxX, sp->uv.maxY);
+
+    sbWriteColorLayer(sb, v, 6, sp);
+}
+
+static int sortByBatchIdx(const void *a, const void *b)
+{
+    return (*(Sprite **)a)->batchIdx - (*(Sprite **)b)->batchIdx;
+}
+
+/**
+ * Merges the slots of the dirty sprites into a few upload ranges.
+ * Expects sb->dirty to be sorted by batchIdx.
+ *
+ * @param sb The sprite batch
+ */
+static void sbCoalesceRanges(SpriteBatch *sb)
+{
+    SBRange *r = NULL;
+    int i, idx;
+
+    sb->rangesLen = 0;
+    for (i = 0; i < sb->dirtyLen; i++) {
+        idx = sb->dirty[i]->batchIdx;
+        if (r && idx <= r->first + r->count + SB_COALESCE_GAP) {
+            r->count = idx - r->first + 1;
             continue;
         }
-        assert(sb->sprites);
-        assert(sb->sprites[i]);
-        assert(sb->sprites[i]->textureID);
-
-        if (sb->sprites[i]->textureID != lastTextureId) {
-            lastTextureId = sb->sprites[i]->textureID;
-            numBatch = getFreeRenderBatch(sb);
-            sb->renderBatches[numBatch]->textureID = lastTextureId;
-            sb->renderBatches[numBatch]->offset = i * 6;
-            sb->renderBatches[numBatch]->numVertices = 0;
-        }
+        r = sb->ranges + sb->rangesLen++;
+        r->first = idx;
+        r->count = 1;
+    }
+    if (sb->rangesLen > SB_MAX_UPLOAD_RANGES) {
+        r = sb->ranges + sb->rangesLen - 1;
+        sb->ranges[0].count = r->first + r->count - sb->ranges[0].first;
+        sb->rangesLen = 1;
+    }
+}
+
+/**
+ * Incremental build: regenerates only the vertices of the sprites that
+ * changed since last frame. Render batches are kept from the last full build.
+ *
+ * @param sb The sprite batch
+ */
+static void sbBuildDirty(SpriteBatch *sb)
+{
+    Sprite *sp;
+    int i, n = 0;
+
+    for (i = 0; i < sb->dirtyLen; i++) {
+        sp = sb->dirty[i];
+        sp->dirty = false;
+        if (sp->batchIdx < 0) // culled out, nothing to update
+            continue;
+        sbWriteSprite(sb, sbSlot(sb, sb->vertices, sp->batchIdx), sp);
+        sb->dirty[n++] = sp;
+    }
+    sb->dirtyLen = n;
+    sb->stats.spritesBuilt = sb->dirtyLen;
+    qsort(sb->dirty, sb->dirtyLen, sizeof(*sb->dirty), sortByBatchIdx);
+    sbCoalesceRanges(sb);
+    sb->dirtyLen = 0;
+}
+
+/**
+ * Moves the changed sprites to their new place in the spatial index
+ *
+ * @param sb The sprite batch
+ */
+static void sbUpdateIndex(SpriteBatch *sb)
+{
+    QTObject *obj;
+    AABB limits;
+    int i;
 
-        assert(sb->renderBatches);
-
-        Vertex *v;
-        Sprite *sp = sb->sprites[i];
-        v = sb->vertices + i * 6;
-        vertexSetPos(v++, sp->x + sp->width, sp->y + sp->height);
-        vertexSetPos(v++, sp->x,             sp->y + sp->height);
-        vertexSetPos(v++, sp->x,             sp->y				);
-        vertexSetPos(v++, sp->x,             sp->y				);
-        vertexSetPos(v++, sp->x + sp->width, sp->y				);
-        vertexSetPos(v++, sp->x + sp->width, sp->y + sp->height);
-
-        v = sb->vertices + i * 6;
-        vertexSetUV(v++, sp->uv.maxX, sp->uv.maxY);
-        vertexSetUV(v++, sp->uv.minX, sp->uv.maxY);
-        vertexSetUV(v++, sp->uv.minX, sp->uv.minY);
-        vertexSetUV(v++, sp->uv.minX, sp->uv.minY);
-        vertexSetUV(v++, sp->uv.maxX, sp->uv.minY);
-        vertexSetUV(v++, sp->uv.maxX, sp->uv.maxY);
-
-        for (j = 0; j < 6; j++) {
-            vertexSetColor(
-                    sb->vertices + i * 6 + j,
-                    sp->color.r,
-                    sp->color.g,
-                    sp->color.b,
-                    sp->color.a);
+    for (i = 0; i < sb->dirtyLen; i++) {
+        if (!(obj = sb->dirty[i]->cullObj))
+            continue;
+        limits = sbSpriteAABB(sb->dirty[i]);
+        if (memcmp(&limits, &obj->limits, sizeof(limits)))
+            qtObjectUpdate(obj, limits);
+    }
+}
+
+/**
+ * Queries the index for the sprites around the view and sorts them
+ * by texture into sb->visible
+ *
+ * @param sb The sprite batch
+ * @return false on error (no memory)
+ */
+static bool sbCull(SpriteBatch *sb)
+{
+    QTObject *obj;
+    Sprite **visible;
+    float mx = (sb->view.maxX - sb->view.minX) * SB_CULL_MARGIN,
+          my = (sb->view.maxY - sb->view.minY) * SB_CULL_MARGIN;
+    int i, size;
+
+    // forget the sprites of the last build
+    for (i = 0; i < sb->visibleLen; i++)
+        if (sb->visible[i])
+            sb->visible[i]->batchIdx = -1;
+    sb->visibleLen = 0;
+
+    sb->cullBounds = (AABB) {
+        sb->view.minX - mx, sb->view.minY - my,
+        sb->view.maxX + mx, sb->view.maxY + my
+    };
+    quadTreeResetResults(sb->culled);
+    quadTreeGetIntersections(sb->index, sb->cullBounds, sb->culled);
+
+    if (sb->visibleSize < sb->culled->len) {
+        size = sb->visibleSize == 0 ? 8 : sb->visibleSize;
+        while (size < sb->culled->len)
+            size *= 2;
+        if (!(visible = realloc(sb->visible, size * sizeof(*visible)))) {
+            fprintf(stderr, "Cannot realloc sb->visible\n");
+            return false;
         }
-        assert(sb->renderBatches);
-        assert(sb->renderBatches[numBatch]);
-        sb->renderBatches[numBatch]->numVertices += 6;
+        sb->visible = visible;
+        sb->visibleSize = size;
     }
-    sb->verticesLen = i * 6;
+    arrayForEach(sb->culled, obj, i)
+        sb->visible[sb->visibleLen++] = obj->data;
+    if (!sbSortSprites(sb, sb->visible, sb->visibleLen, false))
+        return false;
+    sb->needsSort = false;
+
+    return true;
 }
 
-void sbDrawBatches(SpriteBatch *sb) 
+void sbSetWorkerPool(SpriteBatch *sb, WorkerPool *pool)
 {
+    sb->pool = pool;
+    if (sb->statics)
+        sb->statics->pool = pool;
+}
+
+/* A full build, shared by the threads writing its vertices */
+typedef struct {
+    SpriteBatch *sb;
+    Sprite **sprites;   // sorted sprites, written at their index
+    void *vertices;
+} SBBuildJob;
+
+/**
+ * Writes the vertices of a slice of the sorted sprites. Runs on the worker
+ * threads, so it only touches the slice sprites and their vertices.
+ *
+ * @param arg The SBBuildJob
+ * @param first Index of the first sprite
+ * @param count Number of sprites
+ */
+static void sbBuildSlice(void *arg, int first, int count)
+{
+    SBBuildJob *job = arg;
+    Sprite *sp;
     int i;
-    GLint textureLocation;
-    
+
+    if (job->sb->expand)
+        job->sb->expand(sbSlot(job->sb, job->vertices, first),
+                job->sprites + first, count);
+    for (i = first; i < first + count; i++) {
+        sp = job->sprites[i];
+        if (!job->sb->expand)
+            sbWriteSprite(job->sb, sbSlot(job->sb, job->vertices, i), sp);
+        sp->dirty = false;
+        sp->batchIdx = i;
+    }
+}
+
+/**
+ * Checks if the vertices of the last build can be kept, rebuilding only
+ * the sprites that changed
+ *
+ * @param sb The sprite batch
+ * @return true if an incremental build is enough
+ */
+static bool sbCanBuildDirty(SpriteBatch *sb)
+{
+    AABB limits;
+    int i, len = sb->index ? sb->visibleLen : sb->spritesLen;
+
+    if (sb->uploadMode != SB_UPLOAD_INCREMENTAL || sb->needsSort
+            || sb->needsFullUpload
+            || sb->verticesLen != len * sb->spriteVertices)
+        return false;
+    if (!sb->index)
+        return true;
+    // the view moved out of what we queried last time
+    if (!aabbFitsIn(sb->view, sb->cullBounds))
+        return false;
+    // a culled out sprite moved in
+    for (i = 0; i < sb->dirtyLen; i++) {
+        limits = sbSpriteAABB(sb->dirty[i]);
+        if (sb->dirty[i]->batchIdx < 0
+                && aabbIntersects(&limits, &sb->cullBounds))
+            return false;
+    }
+
+    return true;
+}
+
+void sbBuildBatches(SpriteBatch *sb)
+{
+    GLuint lastTextureId = 0;
+    int numBatch = 0, i, len;
+    RenderBatch *rb = NULL;
+    Sprite **sprites, *sp;
+    void *vertices;
+
     if (!sb)
         return;
 
-    glBindVertexArray(sb->vao); // bind vertex array
-    glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sb->verticesLen * sizeof(Vertex),
-            sb->vertices, GL_DYNAMIC_DRAW);	 // send data to GPU
+    memset(&sb->stats, 0, sizeof(sb->stats));
+    if (sb->statics)
+        sbBuildBatches(sb->statics);
+    // nothing was added, removed or changed since the last build
+    if (sb->uploadMode == SB_UPLOAD_STATIC && !sb->needsSort
+            && !sb->needsFullUpload && sb->dirtyLen == 0
+            && sb->verticesLen == sb->spritesLen * sb->spriteVertices) {
+        sb->stats.spritesVisible = sb->spritesLen;
+        return;
+    }
+    if (sb->index)
+        sbUpdateIndex(sb);
+    if (sbCanBuildDirty(sb)) {
+        sbBuildDirty(sb);
+        sb->stats.spritesVisible = sb->verticesLen / sb->spriteVertices;
+        return;
+    }
 
-    glProgramUse(sb->prog);
+    if (sb->index) {
+        if (!sbCull(sb))
+            return;
+        sprites = sb->visible;
+        len = sb->visibleLen;
+    } else {
+        sbSort(sb);
+        sprites = sb->sprites;
+        len = sb->spritesLen;
+    }
+    sbResetBatches(sb);
+    // everything gets rebuilt, forget about the changed sprites; the
+    // culled out ones are not built, clear them here or they are never
+    // queued again
+    for (i = 0; i < sb->dirtyLen; i++)
+        sb->dirty[i]->dirty = false;
+    sb->dirtyLen = 0;
+    sb->rangesLen = 0;
+    sb->needsFullUpload = true;
 
-    glActiveTexture(GL_TEXTURE0);
+    int needSize = len * sb->spriteVertices;
 
-    for (i = 0; i < sb->rbLen; i++) {
-        glBindTexture(GL_TEXTURE_2D, sb->renderBatches[i]->textureID);
-        textureLocation = glGetUniformLocation(sb->prog->programID, "mySampler");
-        glUniform1i(textureLocation, 0);
-        glDrawArrays(
-                GL_TRIANGLES, sb->renderBatches[i]->offset,
-                sb->renderBatches[i]->numVertices);
+    sb->verticesLen = 0;
+    if (needSize == 0)
+        return;
+    if (!(vertices = sbMapVertices(sb, needSize)))
+        return;
+
+    SBBuildJob job = { sb, sprites, vertices };
+    workerPoolRun(sb->pool, sbBuildSlice, &job, len, SB_WORKER_MIN_SPRITES);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+    // merge: one render batch per run of sprites with the same texture,
+    // layer and pass
+    for (i = 0; i < len; i++) {
+        sp = sprites[i];
+        if (!sp->textureID) {
+            printf("invalid sprite texture at position: %d\n", i);
+            continue;
+        }
+
+        if (sp->textureID != lastTextureId || !rb
+                || sp->drawLayer != rb->drawLayer || sp->opaque != rb->opaque) {
+            lastTextureId = sp->textureID;
+            if ((numBatch = getFreeRenderBatch(sb)) < 0)
+                break;
+            rb = &sb->renderBatches[numBatch];
+            rb->textureID = lastTextureId;
+            rb->offset = i * sb->spriteVertices;
+            rb->numVertices = 0;
+            rb->drawLayer = sp->drawLayer;
+            rb->opaque = sp->opaque;
+        }
+        rb->numVertices += sb->spriteVertices;
+        sb->stats.spritesBuilt++;
+    }
+    sb->verticesLen = i * sb->spriteVertices;
+    sb->stats.spritesVisible = len;
+}
+
+void *sbMapQuads(SpriteBatch *sb, int count)
+{
+    memset(&sb->stats, 0, sizeof(sb->stats));
+    sbResetBatches(sb);
+    sb->verticesLen = 0;
+    sb->needsFullUpload = true;
+    if (sb->spritesLen > 0 || sb->compact || sb->textureArray) {
+        fprintf(stderr, "sbMapQuads: batch has sprites or another format\n");
+        return NULL;
+    }
+    if (count <= 0)
+        return NULL;
+
+    return sbMapVertices(sb, count * sb->spriteVertices);
+}
+
+void sbCommitQuads(SpriteBatch *sb, int count, GLuint textureID,
+        int drawLayer, bool opaque)
+{
+    RenderBatch *rb;
+    int idx;
+
+    if (count <= 0 || (idx = getFreeRenderBatch(sb)) < 0)
+        return;
+    rb = &sb->renderBatches[idx];
+    rb->textureID = textureID;
+    rb->offset = 0;
+    rb->numVertices = count * sb->spriteVertices;
+    rb->drawLayer = drawLayer;
+    rb->opaque = opaque;
+    sb->verticesLen = rb->numVertices;
+    sb->stats.spritesBuilt = sb->stats.spritesVisible = count;
+}
+
+bool sbKeepQuads(SpriteBatch *sb)
+{
+    memset(&sb->stats, 0, sizeof(sb->stats));
+    // the ring regions of the last frame get written over
+    if (sb->uploadMode == SB_UPLOAD_STREAM)
+        return false;
+    sb->stats.spritesVisible = sb->verticesLen / sb->spriteVertices;
+
+    return true;
+}
+
+/**
+ * Makes this frame vertices available to the GPU
+ *
+ * @param sb The sprite batch
+ */
+static void sbUpload(SpriteBatch *sb)
+{
+    SBRange *r;
+    int i, slotSize = sb->spriteVertices * sb->vertexSize;
+
+    if (sb->uploadMode == SB_UPLOAD_INCREMENTAL && !sb->needsFullUpload) {
+        glStateBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+        for (i = 0; i < sb->rangesLen; i++) {
+            r = sb->ranges + i;
+            glBufferSubData(GL_ARRAY_BUFFER,
+                    r->first * slotSize, r->count * slotSize,
+                    sbSlot(sb, sb->vertices, r->first));
+            sb->stats.bytesUploaded += r->count * slotSize;
+            sb->stats.uploadCalls++;
+        }
+        sb->rangesLen = 0;
+        return;
+    }
+    if (sb->uploadMode == SB_UPLOAD_STATIC && !sb->needsFullUpload)
+        return; // still in the vbo
+    sb->needsFullUpload = false;
+    if (sb->uploadMode == SB_UPLOAD_STREAM) {
+        // already written through the mapping
+        streamBufferUnmap(sb->stream);
+        if (sb->stream->id != sb->attribVbo)
+            sbSetupAttributes(sb, sb->stream->id); // the ring has grown
+        return;
     }
+    glStateBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sb->verticesLen * sb->vertexSize,
+            sb->vertices, sb->uploadMode == SB_UPLOAD_STATIC
+            ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);	 // send data to GPU
+    sb->stats.bytesUploaded += sb->verticesLen * sb->vertexSize;
+    sb->stats.bufferAllocs++;
+}
+
+void sbFrameEnd(SpriteBatch *sb)
+{
+    StreamStats *st;
+
+    if (sb->uploadMode != SB_UPLOAD_STREAM)
+        return;
+    st = &sb->stream->stats;
+    sb->stats.bytesUploaded += st->bytesUploaded;
+    sb->stats.bufferAllocs += st->bufferAllocs;
+    sb->stats.syncWaits += st->syncWaits;
+    streamBufferFrameEnd(sb->stream);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    glProgramUnuse(sb->prog);
+/**
+ * Draws a range of this frame vertices
+ *
+ * @param sb The sprite batch
+ * @param first First vertex of the range
+ * @param count Number of vertices
+ */
+static void sbDrawRange(SpriteBatch *sb, GLint first, GLsizei count)
+{
+    GLvoid *indices;
+
+    if (sb->layout == SB_LAYOUT_INSTANCED) {
+        // no base instance before GL 4.2, move the attributes instead
+        glStateBindBuffer(GL_ARRAY_BUFFER, sb->attribVbo);
+        sbPointAttributes(sb, (GLintptr) (sb->baseVertex + first) * sb->vertexSize);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    } else if (sb->layout == SB_LAYOUT_INDEXED) {
+        // 6 indices for each 4 vertices quad
+        indices = (GLvoid *) (first / 4 * 6 * sizeof(GLuint));
+        glDrawElementsBaseVertex(GL_TRIANGLES, count / 4 * 6,
+                GL_UNSIGNED_INT, indices, sb->baseVertex);
+    } else {
+        glDrawArrays(GL_TRIANGLES, sb->baseVertex + first, count);
+    }
+    sb->stats.drawCalls++;
+}
 
+void sbSetPass(bool opaque)
+{
+    if (opaque) {
+        glStateEnable(GL_DEPTH_TEST, true);
+        glStateDepthFunc(GL_LEQUAL);
+        glStateDepthMask(GL_TRUE);
+        glStateEnable(GL_BLEND, false);
+    } else {
+        glStateDepthMask(GL_FALSE);
+        glStateEnable(GL_BLEND, true);
+    }
+}
+
+/**
+ * Writes and uploads the indirect draw command and the depth of each
+ * render batch, for the multi-draw mode
+ *
+ * @param sb The sprite batch
+ */
+static void sbUploadDrawCommands(SpriteBatch *sb)
+{
+    SBDrawElementsCommand *elements;
+    SBDrawArraysCommand *arrays;
+    RenderBatch *rb;
+    size_t size;
+    int i;
+
+    if (sb->rbLen == 0)
+        return;
+    // sized for the bigger command, so the layout can change
+    if (sb->rbLen > sb->drawCommandsSize) {
+        free(sb->drawCommands);
+        free(sb->drawDepths);
+        sb->drawCommands = malloc(sb->rbSize * sizeof(SBDrawElementsCommand));
+        sb->drawDepths = malloc(sb->rbSize * sizeof(*sb->drawDepths));
+        if (!sb->drawCommands || !sb->drawDepths) {
+            fprintf(stderr, "Cannot alloc %d draw commands\n", sb->rbSize);
+            sb->drawCommandsSize = 0;
+            return;
+        }
+        sb->drawCommandsSize = sb->rbSize;
+    }
+    elements = sb->drawCommands;
+    arrays = sb->drawCommands;
     for (i = 0; i < sb->rbLen; i++) {
-        free(sb->renderBatches[i]);
-        sb->renderBatches[i] = 0;
+        rb = &sb->renderBatches[i];
+        sb->drawDepths[i] = sbLayerDepth(rb->drawLayer);
+        if (sb->layout == SB_LAYOUT_INDEXED)
+            elements[i] = (SBDrawElementsCommand) { rb->numVertices / 4 * 6,
+                1, rb->offset / 4 * 6, sb->baseVertex, i };
+        else
+            arrays[i] = (SBDrawArraysCommand) { rb->numVertices,
+                1, sb->baseVertex + rb->offset, i };
     }
-    sb->rbLen = 0;
+    size = sb->layout == SB_LAYOUT_INDEXED
+        ? sizeof(*elements) : sizeof(*arrays);
+
+    glStateBindBuffer(GL_ARRAY_BUFFER, sb->drawVbo);
+    glBufferData(GL_ARRAY_BUFFER, sb->rbLen * sizeof(*sb->drawDepths),
+            sb->drawDepths, GL_STREAM_DRAW);
+    glStateBindBuffer(GL_DRAW_INDIRECT_BUFFER, sb->indirectVbo);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sb->rbLen * size,
+            sb->drawCommands, GL_STREAM_DRAW);
+    sb->stats.bytesUploaded += sb->rbLen * (size + sizeof(*sb->drawDepths));
+}
+
+void sbPrepareDraw(SpriteBatch *sb)
+{
+    glStateBindVertexArray(sb->vao); // bind vertex array
+    sbUpload(sb);
+    if (sb->layout == SB_LAYOUT_INDEXED)
+        sbBindIndices(sb->verticesLen / 4);
+    if (sb->multiDraw)
+        sbUploadDrawCommands(sb);
 }
 
+void sbDrawRenderBatch(SpriteBatch *sb, int idx)
+{
+    RenderBatch *rb = &sb->renderBatches[idx];
+
+    // the depth of the render batch comes with its command
+    if (sb->multiDraw) {
+        sbMultiDrawRenderBatches(sb, idx, 1);
+        return;
+    }
+    sbDrawRange(sb, rb->offset, rb->numVertices);
+}
+
+void sbMultiDrawRenderBatches(SpriteBatch *sb, int first, int count)
+{
+    if (!sb->drawCommandsSize)
+        return; // no memory for the commands
+    glStateBindBuffer(GL_DRAW_INDIRECT_BUFFER, sb->indirectVbo);
+    if (sb->layout == SB_LAYOUT_INDEXED)
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (GLvoid *) (first * sizeof(SBDrawElementsCommand)), count, 0);
+    else
+        glMultiDrawArraysIndirect(GL_TRIANGLES,
+                (GLvoid *) (first * sizeof(SBDrawArraysCommand)), count, 0);
+    sb->stats.drawCalls++;
+}
+
+/**
+ * Gets the number of render batches of the opaque pass, they come first
+ *
+ * @param sb The sprite batch
+ * @return the index of the first translucent render batch
+ */
+static int sbOpaqueBatches(SpriteBatch *sb)
+{
+    int i;
+
+    for (i = 0; i < sb->rbLen && sb->renderBatches[i].opaque; i++)
+        ;
+    return i;
+}
+
+/**
+ * Draws some render batches of a batch
+ *
+ * @param sb The sprite batch
+ * @param prog The program in use
+ * @param first First render batch
+ * @param last One past the last render batch
+ */
+static void sbDrawList(SpriteBatch *sb, GLProgram *prog, int first, int last)
+{
+    int i, run, drawLayer = -1;
+    GLint depthLocation;
+    RenderBatch *rb;
+
+    if (first >= last)
+        return;
+    glStateBindVertexArray(sb->vao);
+    // the program is shared, batches without compact vertices reset it
+    glUniform2f(glProgramUniformLocation(prog, "origin"),
+            sb->origin.x, sb->origin.y);
+    glUniform1i(glProgramUniformLocation(prog, "mySampler"), 0);
+    depthLocation = glProgramUniformLocation(prog, "depth");
+    if (sb->multiDraw)
+        glUniform1f(depthLocation, 0); // each command brings its depth
+    for (i = first; i < last; i += run) {
+        rb = &sb->renderBatches[i];
+        glStateBindTexture(sb->textureTarget, rb->textureID);
+        if (sb->multiDraw) {
+            // all the layers using this texture in one call
+            for (run = 1; i + run < last; run++)
+                if (sb->renderBatches[i + run].textureID != rb->textureID)
+                    break;
+            sbMultiDrawRenderBatches(sb, i, run);
+            continue;
+        }
+        run = 1;
+        if (rb->drawLayer != drawLayer) {
+            drawLayer = rb->drawLayer;
+            glUniform1f(depthLocation, sbLayerDepth(drawLayer));
+        }
+        sbDrawRange(sb, rb->offset, rb->numVertices);
+    }
+}
+
+void sbAddStats(SBStats *stats, const SBStats *other)
+{
+    stats->bytesUploaded += other->bytesUploaded;
+    stats->bufferAllocs += other->bufferAllocs;
+    stats->uploadCalls += other->uploadCalls;
+    stats->spritesBuilt += other->spritesBuilt;
+    stats->spritesVisible += other->spritesVisible;
+    stats->spritesSorted += other->spritesSorted;
+    stats->syncWaits += other->syncWaits;
+    stats->drawCalls += other->drawCalls;
+}
+
+/**
+ * Draws several batches with one program, in pass order: the opaque
+ * render batches of all of them first, then the translucent ones
+ *
+ * @param prog The program, matching the batches layout
+ * @param batches The batches
+ * @param len Number of batches
+ */
+static void sbDrawGroup(GLProgram *prog, SpriteBatch **batches, int len)
+{
+    bool depthTest = false;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        sbPrepareDraw(batches[i]);
+        // opaque batches come first, without them there is no depth to test
+        if (sbOpaqueBatches(batches[i]) > 0)
+            depthTest = true;
+    }
+
+    glProgramUse(prog);
+    glStateActiveTexture(GL_TEXTURE0);
+
+    if (depthTest)
+        sbSetPass(true);
+    for (i = 0; i < len; i++)
+        sbDrawList(batches[i], prog, 0, sbOpaqueBatches(batches[i]));
+    if (depthTest)
+        sbSetPass(false);
+    for (i = 0; i < len; i++)
+        sbDrawList(batches[i], prog, sbOpaqueBatches(batches[i]),
+                batches[i]->rbLen);
+    if (depthTest) {
+        glStateDepthMask(GL_TRUE);
+        glStateEnable(GL_DEPTH_TEST, false);
+    }
+
+    glStateBindBuffer(GL_ARRAY_BUFFER, 0);
+    glStateBindVertexArray(0);
+    glProgramUnuse(prog);
+    for (i = 0; i < len; i++)
+        sbFrameEnd(batches[i]);
+}
+
+void sbDrawBatches(SpriteBatch *sb) 
+{
+    SpriteBatch *group[2];
+    int len = 0;
+    
+    if (!sb)
+        return;
+
+    if (sb->statics)
+        group[len++] = sb->statics;
+    group[len++] = sb;
+    gpuTimerBegin(sb->gpuTimer);
+    sbDrawGroup(sb->prog, group, len);
+    gpuTimerEnd(sb->gpuTimer);
+    if (sb->statics)
+        sbAddStats(&sb->stats, &sb->statics->stats);
+}
+
+void sbDrawBatchList(SpriteBatch **batches, int len)
+{
+    if (len > 0)
+        sbDrawGroup(batches[0]->prog, batches, len);
+}
+
+#ifdef COMPILE_TESTS
+void sbTest()
+{
+    SpriteBatch *sb;
+    Sprite sp;
+
+    printf("Testing SpriteBatch\n");
+    assert((sb = sbNew(NULL)));
+    sbInit(sb);
+    assert(sbSetLayout(sb, SB_LAYOUT_INDEXED));
+    sbSetUploadMode(sb, SB_UPLOAD_INCREMENTAL);
+    assert(sbSetCulling(sb, aabb(-10000, -10000, 10000, 10000)));
+    sbSetView(sb, aabb(0, 0, 100, 100));
+
+    // added out of the view: culled, but moving it in must build it
+    spriteInit(&sp, 5000, 5000, 10, 10, 1);
+    sbAddSprite(sb, &sp);
+    sbBuildBatches(sb);
+    assert(sp.batchIdx < 0 && !sp.dirty);
+    spriteSetPos(&sp, 10, 10);
+    assert(sb->dirtyLen == 1);
+    sbBuildBatches(sb);
+    assert(sp.batchIdx == 0 && sb->stats.spritesVisible == 1);
+
+    // culled out by a full build while queued, then back in the view
+    spriteSetPos(&sp, 5000, 5000);
+    sbSetView(sb, aabb(200, 200, 300, 300));
+    sbBuildBatches(sb);
+    assert(sp.batchIdx < 0 && !sp.dirty && sb->dirtyLen == 0);
+    spriteSetPos(&sp, 250, 250);
+    sbBuildBatches(sb);
+    assert(sp.batchIdx == 0 && sb->stats.spritesVisible == 1);
+
+    sbDeleteSprite(sb, &sp);
+    sbDelete(sb);
+}
+#endif // COMPILE_TESTS
@@ -1,37 +1,200 @@
 /**
- * Handle sprites in batches, sorted by textureID
+ * Handle sprites in batches, sorted by a draw key made of layer, program,
+ * textureID (or texture array object, in texture array mode) and depth
  */
 #ifndef SPRITE_BATCH_H
 #define SPRITE_BATCH_H
 
+#include <stdint.h>
 #include "vertex.h"
 #include "sprite.h"
 #include "gl_program.h"
+#include "stream_buffer.h"
+#include "radix_sort.h"
+#include "worker_pool.h"
+#include "quad_expand.h"
+#include "gpu_timer.h"
 
-/* TODO: Draw only the batches infront of the camera */
+/* Number of frames kept in flight by the streaming upload mode */
+#define SB_STREAM_FRAMES 3
+/* Culling queries this much more than the view on each side, as a fraction
+ * of its size, so small camera moves do not need a new query */
+#define SB_CULL_MARGIN 0.25f
+/* Full builds give each worker thread at least this many sprites */
+#define SB_WORKER_MIN_SPRITES 4096
+/* Attribute of the sprite layer in texture array mode: the programs must
+ * bind vertexLayer here, see sbSetTextureArray */
+#define SB_ATTRIB_LAYER 3
+/* Attribute of the per render batch depth in multi-draw mode: the
+ * programs must bind drawDepth here, see glProgramBindAttribute */
+#define SB_ATTRIB_DRAW_DEPTH 4
+
+/*
+ * Draw key, sprites are drawn in ascending key order:
+ * | 1 bit pass | 8 bits layer | 7 bits unused | 24 bits texture |
+ * | 24 bits unused |
+ * The opaque pass goes first, its layers front to back, then the
+ * translucent pass with its layers back to front. A batch draws with a
+ * single program and sprites have no depth inside their layer, so
+ * neither is in the key; the fields stay where the render queue key
+ * (see RQ_KEY_*) has them, next to its program.
+ */
+#define SB_KEY_PASS_SHIFT 63
+#define SB_KEY_LAYER_SHIFT 55
+#define SB_KEY_TEXTURE_SHIFT 24
+#define SB_KEY_TEXTURE_MASK 0xffffffULL
+
+/* How vertices reach the GPU */
+typedef enum {
+    SB_UPLOAD_ORPHAN,   // re-specify the whole vbo with glBufferData each frame
+    SB_UPLOAD_STREAM,   // write straight into a mapped ring of frame regions
+    SB_UPLOAD_INCREMENTAL, // keep the vbo, rebuild and upload dirty sprites
+    SB_UPLOAD_STATIC,   // GL_STATIC_DRAW vbo, rebuilt and uploaded only
+                        // when one of the sprites changes
+} SBUploadMode;
+
+/* How a sprite is turned into geometry */
+typedef enum {
+    SB_LAYOUT_TRIANGLES, // 6 vertices per sprite, glDrawArrays
+    SB_LAYOUT_INDEXED,   // 4 vertices per sprite, shared index buffer
+    SB_LAYOUT_INSTANCED, // 1 SpriteInstance per sprite, needs an instanced
+                         // program (shaders/sprite_shader_instanced)
+} SBLayout;
+
+/* Per sprite record of SB_LAYOUT_INSTANCED, expanded to a quad by the shader */
+typedef struct {
+    float x, y, width, height;  // sprite rectangle
+    float minU, minV, maxU, maxV; // sampling UV
+    Color color;
+} SpriteInstance;
+
+/* Vertex of the triangles/indexed layouts in texture array mode */
+typedef struct {
+    Vertex v;
+    float layer;        // layer of the GL_TEXTURE_2D_ARRAY to sample
+} LayerVertex;
+
+/* Indirect draw commands of the multi-draw mode, as GL reads them */
+typedef struct {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;    // render batch, selects its drawDepth
+} SBDrawArraysCommand;
+
+typedef struct {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;    // render batch, selects its drawDepth
+} SBDrawElementsCommand;
+
+/* Per frame counters, reset on each sbBuildBatches */
+typedef struct {
+    unsigned long bytesUploaded; // vertex bytes sent to the GPU
+    int bufferAllocs;            // vbo (re)allocations, including orphaning
+    int uploadCalls;             // glBufferSubData calls
+    int spritesBuilt;            // sprites whose vertices were generated
+    int spritesVisible;          // sprites in the built vertices
+    int spritesSorted;           // sprites that had to be moved by the sort
+    int syncWaits;               // waits for the GPU to release a ring region
+    int drawCalls;               // number of glDraw* calls
+} SBStats;
 
 typedef struct {
     GLuint textureID;    // this batch texture id
     GLint offset;        // offset into vertices
     GLsizei numVertices; // number of vertices in this batch
+    int drawLayer;       // depth of the batch sprites
+    bool opaque;         // drawn in the opaque pass, see spriteSetOpaque
 } RenderBatch;
 
+/* Handle to a sprite in a batch; stale once the sprite is removed */
+typedef struct {
+    uint32_t slot;      // index in the slot table
+    uint32_t gen;       // generation of the slot, 0 is no sprite
+} SBHandle;
+
+#define SB_HANDLE_NONE ((SBHandle) { 0, 0 })
+/* Slot bit of the handles of static sprites, see sbAddStatic */
+#define SB_HANDLE_STATIC 0x80000000u
+
+/* Entry of the slot table, maps handles to sprites */
 typedef struct {
-    RenderBatch **renderBatches; // ptr to render batches
+    Sprite *sprite;     // sprite in this slot, or NULL if free
+    uint32_t gen;       // bumped each time the slot is freed
+    int nextFree;       // next free slot, when free
+} SBSlot;
+
+/* A range of sprite slots, used to upload only what changed */
+typedef struct {
+    int first;
+    int count;
+} SBRange;
+
+typedef struct SpriteBatch {
+    RenderBatch *renderBatches; // render batches, kept between builds
     int rbSize; // size of render batches including unused elements
     int rbLen;  // currently occupied by len batches
 
-    Vertex *vertices;   // where we store all vertices;
+    void *vertices;     // where we store all vertices (or instances);
     int verticesSize;
     int verticesLen;
 
-    Sprite **sprites;   // ptr to ptrs to sprites
-    int spritesSize;
+    Sprite **sprites;   // ptr to ptrs to sprites, packed; in draw order
+    int spritesSize;    // after a sort
     int spritesLen;
 
+    SBSlot *slots;      // slot table behind the handles
+    int slotsSize;
+    int freeSlot;       // first free slot, or -1
+
+    Sprite **dirty;     // sprites changed since last build
+    int dirtySize;
+    int dirtyLen;
+    SBRange *ranges;    // dirty slots coalesced into upload ranges
+    int rangesLen;
+    bool needsFullUpload; // incremental mode: next upload sends everything
+
     bool needsSort;
+    SortPair *sortPairs; // draw keys of the sprites being sorted
+    SortPair *sortScratch; // radix sort temporary
+    Sprite **sortSprites; // sprites in their new order
+    int sortSize;
     GLuint vao, vbo;
+    GLuint attribVbo;   // buffer the vao attributes currently point to
     GLProgram *prog;
+
+    SBLayout layout;
+    int spriteVertices; // vertices written per sprite, depends on layout
+    int vertexSize;     // size of one vertex, depends on layout
+    bool textureArray;  // vertices carry a layer, see sbSetTextureArray
+    bool compact;       // CompactVertex, see sbSetCompact
+    bool multiDraw;     // indirect multi-draw, see sbSetMultiDraw
+    GLuint drawVbo;     // multi-draw: depth of each render batch
+    GLuint indirectVbo; // multi-draw: one command per render batch
+    void *drawCommands; // SBDrawArraysCommand or SBDrawElementsCommand
+    float *drawDepths;
+    int drawCommandsSize;
+    Position origin;    // of the compact vertex positions
+    QuadExpandFn expand; // SIMD vertex writer for the layout, or NULL
+    GLenum textureTarget; // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+    SBUploadMode uploadMode;
+    StreamBuffer *stream; // ring buffer used by SB_UPLOAD_STREAM
+    GLint baseVertex;   // first vertex of this frame in the bound buffer
+
+    QuadTree *index;    // spatial index of the sprites when culling, or NULL
+    Array *culled;      // QTObjects returned by the last index query
+    Sprite **visible;   // sprites of the last culled build, by batchIdx
+    int visibleSize;
+    int visibleLen;
+    AABB view;          // world area to draw, see sbSetView
+    AABB cullBounds;    // area the visible sprites were queried for
+    WorkerPool *pool;   // writes the vertices in parallel, or NULL
+    struct SpriteBatch *statics; // the static sprites, see sbAddStatic
+    GPUTimer *gpuTimer; // GPU time of sbDrawBatches, or NULL
+    SBStats stats;
 } SpriteBatch;
 
 /**
@@ -42,11 +205,348 @@ typedef struct {
  */
 SpriteBatch *sbNew(GLProgram *program);
 void sbInit(SpriteBatch *sb); //
+
+/**
+ * Sets how the vertices are uploaded. Call it after sbInit.
+ *
+ * @param sb The sprite batch
+ * @param mode One of SB_UPLOAD_*
+ * @return false if the mode is not supported by the GL context
+ */
+bool sbSetUploadMode(SpriteBatch *sb, SBUploadMode mode);
+
+/**
+ * @brief Sets how sprites are turned into geometry.
+ *
+ * SB_LAYOUT_INDEXED writes 4 vertices per sprite and draws them with
+ * glDrawElements, using one static index buffer shared by all the batches.
+ * SB_LAYOUT_INSTANCED writes one SpriteInstance per sprite and draws a
+ * unit quad per instance; sb->prog must be an instanced program.
+ * Call it after sbInit.
+ *
+ * @param sb The sprite batch
+ * @param layout One of SB_LAYOUT_*
+ * @return false if the layout cannot be used
+ */
+bool sbSetLayout(SpriteBatch *sb, SBLayout layout);
+
+/**
+ * @brief Sets texture array mode.
+ *
+ * In this mode sprite textures are GL_TEXTURE_2D_ARRAY objects (see
+ * texture_array.h) and each vertex carries the sprite layer, so sprites
+ * sampling different layers of the same array share one draw call.
+ * sb->prog must sample a sampler2DArray and bind the layer to
+ * SB_ATTRIB_LAYER, like shaders/sprite_shader_array. Works with the triangles
+ * and indexed layouts. Call it after sbInit.
+ *
+ * @param sb The sprite batch
+ * @param enable true to use texture arrays, false for plain textures
+ * @return false if texture arrays cannot be used
+ */
+bool sbSetTextureArray(SpriteBatch *sb, bool enable);
+
+/**
+ * @brief Uses 12 bytes CompactVertex instead of 20 bytes Vertex.
+ *
+ * Positions are stored as whole world units relative to the origin
+ * (see sbSetOrigin), within +-32767 of it, and UVs as 16 bit normalized
+ * values, so it suits tile aligned geometry like a chunk of a map.
+ * The program needs the origin uniform of shaders/sprite_shader.
+ * Not available with the instanced layout or texture arrays.
+ *
+ * @param sb The sprite batch
+ * @param enable true for compact vertices
+ * @return false if the layout or texture mode do not allow it
+ */
+bool sbSetCompact(SpriteBatch *sb, bool enable);
+
+/**
+ * Sets the origin of the compact vertex positions, like the corner
+ * of a chunk. Rebuilds all the vertices on the next build.
+ *
+ * @param sb The sprite batch
+ * @param x Origin x
+ * @param y Origin y
+ */
+void sbSetOrigin(SpriteBatch *sb, float x, float y);
+
+/**
+ * Tells if the context can use the multi-draw mode
+ *
+ * @return true with GL 4.3, or ARB_multi_draw_indirect and ARB_base_instance
+ */
+bool sbMultiDrawSupported();
+
+/**
+ * @brief Draws runs of render batches with one indirect multi-draw.
+ *
+ * Each render batch becomes an indirect draw command, and consecutive
+ * render batches of a pass with the same texture are drawn by one
+ * glMultiDraw*Indirect call. The depth of each layer comes from the
+ * drawDepth attribute (SB_ATTRIB_DRAW_DEPTH), read per command through
+ * its base instance, instead of the depth uniform; the program needs it,
+ * like shaders/sprite_shader and shaders/sprite_shader_array. With
+ * texture arrays a whole pass is one call. Not available with the
+ * instanced layout. Call it after sbInit.
+ *
+ * @param sb The sprite batch
+ * @param enable true to use multi-draw
+ * @return false if the context or layout do not allow it
+ */
+bool sbSetMultiDraw(SpriteBatch *sb, bool enable);
+
+/**
+ * Measures the GPU time of each sbDrawBatches, statics included, see
+ * GPUTimer. Batches drawn by a RenderQueue are timed by the queue.
+ *
+ * @param sb The sprite batch
+ * @param enable true to measure
+ * @return false if the context has no timer queries
+ */
+bool sbSetGPUTimer(SpriteBatch *sb, bool enable);
+
+/**
+ * @brief Enables camera culling.
+ *
+ * Sprites are kept in a QuadTree, moved as they change, and the build
+ * only generates vertices for the ones intersecting the view, so its cost
+ * depends on what is on screen and not on the size of the world.
+ * The index grows if sprites go out of the limits, but that is slow.
+ *
+ * @param sb The sprite batch
+ * @param limits World area the sprites are expected to be in
+ * @return false on error (no memory)
+ */
+bool sbSetCulling(SpriteBatch *sb, AABB limits);
+
+/**
+ * Sets the world area to draw on the next build, like cameraGetAABB.
+ * Only used when culling is enabled.
+ *
+ * @param sb The sprite batch
+ * @param view The visible area
+ */
+void sbSetView(SpriteBatch *sb, AABB view);
+
+/**
+ * @brief Generates the vertices of full builds in parallel.
+ *
+ * The sorted sprites are split in slices written by the pool threads,
+ * then the render batches are merged on the calling thread. The pool is
+ * not owned by the batch and can be shared, but not used by two builds
+ * at the same time.
+ *
+ * @param sb The sprite batch
+ * @param pool The worker pool, or NULL to build on the calling thread
+ */
+void sbSetWorkerPool(SpriteBatch *sb, WorkerPool *pool);
+
+/**
+ * Adds a sprite to the batch, in O(1)
+ *
+ * @param sb The sprite batch
+ * @param sp The sprite; it must not be in another batch
+ * @return a handle to the sprite, with gen 0 on error
+ */
+SBHandle sbAdd(SpriteBatch *sb, Sprite *sp);
+
+/**
+ * Removes a sprite from the batch, in O(1). The sprite is not destroyed.
+ *
+ * @param sb The sprite batch
+ * @param h The handle returned by sbAdd
+ * @return false if the handle is stale (the sprite was already removed)
+ */
+bool sbRemove(SpriteBatch *sb, SBHandle h);
+
+/**
+ * Gets the sprite behind a handle
+ *
+ * @param sb The sprite batch
+ * @param h The handle returned by sbAdd
+ * @return the sprite, or NULL if the handle is stale
+ */
+Sprite *sbGet(SpriteBatch *sb, SBHandle h);
+
+/**
+ * @brief Adds a sprite that rarely changes, like the map of a level.
+ *
+ * Static sprites live in a partition of the batch with its own
+ * GL_STATIC_DRAW buffer, built once and rebuilt only when one of them
+ * is added, removed or changed. The other sprites are still built and
+ * uploaded every frame, so the upload is the size of the dynamic set.
+ * Both are drawn by sbDrawBatches, in layer order. Static sprites are
+ * not culled.
+ *
+ * @param sb The sprite batch
+ * @param sp The sprite; it must not be in another batch
+ * @return a handle to the sprite, with gen 0 on error
+ */
+SBHandle sbAddStatic(SpriteBatch *sb, Sprite *sp);
+
+/**
+ * Adds a sprite to the batch, see sbAdd
+ *
+ * @return the slot of the sprite, or -1 on error
+ */
 int sbAddSprite(SpriteBatch *sb, Sprite *sp);
+
+/**
+ * Removes a sprite from the batch, see sbRemove
+ *
+ * @return false if the sprite is not in this batch
+ */
 bool sbDeleteSprite(SpriteBatch *sb, Sprite *sp);
+
+/**
+ * Queues a sprite whose vertices must be rebuilt.
+ * Called by the sprite setters, there is no need to call it directly.
+ *
+ * @param sb The batch the sprite belongs to
+ * @param sp The changed sprite
+ */
+void sbSpriteDirty(SpriteBatch *sb, Sprite *sp);
 void sbResetSprites(SpriteBatch *sb);
+
+/**
+ * @brief Starts a build of quads written by the caller instead of sprites.
+ *
+ * For producers with their own storage, like particles: the batch
+ * must have no sprites. The quads are written in the batch format,
+ * sb->spriteVertices Vertex per quad or one SpriteInstance in the
+ * instanced layout; compact vertices and texture arrays are not
+ * supported. In SB_UPLOAD_STREAM mode they go straight into the
+ * mapped buffer. Finish with sbCommitQuads before drawing.
+ *
+ * @param sb The sprite batch
+ * @param count Most quads that will be written
+ * @return where to write the quads, or NULL on error or if count is 0
+ */
+void *sbMapQuads(SpriteBatch *sb, int count);
+
+/**
+ * Ends the build started by sbMapQuads, with one render batch for
+ * all the quads
+ *
+ * @param sb The sprite batch
+ * @param count Quads written, at most those mapped
+ * @param textureID Texture of the quads
+ * @param drawLayer Draw layer of the quads, see spriteSetDrawLayer
+ * @param opaque The quads are drawn in the opaque pass
+ */
+void sbCommitQuads(SpriteBatch *sb, int count, GLuint textureID,
+        int drawLayer, bool opaque);
+
+/**
+ * Draws the quads of the last sbCommitQuads again, without writing or
+ * uploading anything, for producers whose quads did not change
+ *
+ * @param sb The sprite batch
+ * @return false in SB_UPLOAD_STREAM mode, where the quads must be
+ *  written again with sbMapQuads
+ */
+bool sbKeepQuads(SpriteBatch *sb);
+
+/**
+ * Writes the 4 corners of a quad for sbMapQuads, in the order of the
+ * shared indices
+ *
+ * @param v The 4 vertices
+ * @param x0 Left
+ * @param y0 Bottom
+ * @param x1 Right
+ * @param y1 Top
+ * @param color Color of the corners
+ * @param uv Texture coordinates, minX and minY at the bottom left
+ */
+void sbQuadVertices(Vertex *v, float x0, float y0, float x1, float y1,
+        Color color, AABB uv);
 void sbBuildBatches(SpriteBatch *sb);
 void sbDrawBatches(SpriteBatch *sb);
+
+/**
+ * @brief Draws several built batches as one, like the chunks of a world.
+ *
+ * The opaque sprites of all the batches are drawn before the translucent
+ * ones, so the layers stay in order across batches. They must share the
+ * program and layout of the first one. Their static partitions are not
+ * drawn.
+ *
+ * @param batches The batches
+ * @param len Number of batches
+ */
+void sbDrawBatchList(SpriteBatch **batches, int len);
+
+/**
+ * @brief Uploads the built vertices and binds the batch vertex array.
+ *
+ * The steps of sbDrawBatches, for callers drawing render batches
+ * themselves like a RenderQueue: sbPrepareDraw once per frame, then
+ * sbDrawRenderBatch with the program, texture and pass state set by the
+ * caller, then sbFrameEnd after the last draw.
+ *
+ * @param sb The sprite batch, built
+ */
+void sbPrepareDraw(SpriteBatch *sb);
+
+/**
+ * Draws one render batch with the current GL state. The batch vertex
+ * array must be bound.
+ *
+ * @param sb The sprite batch
+ * @param idx Index of the render batch
+ */
+void sbDrawRenderBatch(SpriteBatch *sb, int idx);
+
+/**
+ * Draws consecutive render batches with the same texture and pass in
+ * one call, in multi-draw mode. The depth uniform must be 0, each
+ * render batch brings its own.
+ *
+ * @param sb The sprite batch, in multi-draw mode
+ * @param first First render batch
+ * @param count Number of render batches
+ */
+void sbMultiDrawRenderBatches(SpriteBatch *sb, int first, int count);
+
+/**
+ * Gets the depth of a draw layer, inside the (-1, 0] depth range;
+ * higher layers are closer
+ */
+static inline float sbLayerDepth(int drawLayer)
+{
+    return -(float) drawLayer / SPRITE_DRAW_LAYERS;
+}
+
+/**
+ * Ends the frame of the batch: closes its streaming ring region and
+ * collects its counters
+ *
+ * @param sb The sprite batch
+ */
+void sbFrameEnd(SpriteBatch *sb);
+
+/**
+ * Sets the GL state of a pass: opaque sprites write the depth buffer
+ * and do not blend, translucent ones blend and only test the depth
+ *
+ * @param opaque true for the opaque pass
+ */
+void sbSetPass(bool opaque);
+
+/**
+ * Adds the counters of a batch to others, like the total of a frame
+ *
+ * @param stats The counters to add to
+ * @param other The counters to add
+ */
+void sbAddStats(SBStats *stats, const SBStats *other);
 void sbDelete(SpriteBatch *sb);
 
+/**
+ * Internal self test, needs a GL context
+ */
+void sbTest();
+
 #endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream_buffer.h"
+#include "gl_state.h"
+
+#define STREAM_PERSISTENT_FLAGS \
+    (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+#define STREAM_UNSYNC_FLAGS \
+    (GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT)
+// how long to wait for a fence in one glClientWaitSync call, in ns
+#define STREAM_WAIT_TIMEOUT 1000000
+
+bool streamBufferSupported()
+{
+    return GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+}
+
+/**
+ * Allocates the GL storage for all the frame regions
+ *
+ * @param sbuf The stream buffer
+ * @return true on success
+ */
+static bool streamBufferAlloc(StreamBuffer *sbuf)
+{
+    GLsizeiptr total = sbuf->frameSize * sbuf->numFrames;
+
+    glGenBuffers(1, &sbuf->id);
+    glStateBindBuffer(sbuf->target, sbuf->id);
+    if (sbuf->persistent) {
+        glBufferStorage(sbuf->target, total, NULL, STREAM_PERSISTENT_FLAGS);
+        sbuf->ptr = glMapBufferRange(
+                sbuf->target, 0, total, STREAM_PERSISTENT_FLAGS);
+        if (!sbuf->ptr) {
+            fprintf(stderr, "streamBuffer: cannot map persistent buffer\n");
+            return false;
+        }
+    } else {
+        glBufferData(sbuf->target, total, NULL, GL_STREAM_DRAW);
+    }
+    sbuf->stats.bufferAllocs++;
+
+    return true;
+}
+
+/**
+ * Releases the GL storage and all pending fences
+ *
+ * @param sbuf The stream buffer
+ */
+static void streamBufferFree(StreamBuffer *sbuf)
+{
+    int i;
+
+    for (i = 0; i < STREAM_MAX_FRAMES; i++) {
+        if (sbuf->fences[i]) {
+            glDeleteSync(sbuf->fences[i]);
+            sbuf->fences[i] = 0;
+        }
+    }
+    if (sbuf->id) {
+        if (sbuf->ptr || sbuf->mapped) {
+            glStateBindBuffer(sbuf->target, sbuf->id);
+            glUnmapBuffer(sbuf->target);
+        }
+        glStateDeleteBuffers(1, &sbuf->id);
+        sbuf->id = 0;
+    }
+    sbuf->ptr = NULL;
+    sbuf->mapped = false;
+}
+
+StreamBuffer *streamBufferNew(GLenum target, GLsizeiptr frameSize, int numFrames)
+{
+    StreamBuffer *sbuf;
+
+    if (!streamBufferSupported()) {
+        fprintf(stderr, "streamBufferNew: glMapBufferRange not supported\n");
+        return NULL;
+    }
+    if (!(sbuf = calloc(1, sizeof(*sbuf)))) {
+        fprintf(stderr, "Cannot alloc StreamBuffer\n");
+        return NULL;
+    }
+    if (numFrames < 2)
+        numFrames = 2;
+    if (numFrames > STREAM_MAX_FRAMES)
+        numFrames = STREAM_MAX_FRAMES;
+
+    sbuf->target = target;
+    sbuf->frameSize = frameSize > 0 ? frameSize : 4096;
+    sbuf->numFrames = numFrames;
+    sbuf->persistent = GLEW_ARB_buffer_storage;
+    if (!streamBufferAlloc(sbuf)) {
+        streamBufferDelete(sbuf);
+        return NULL;
+    }
+
+    return sbuf;
+}
+
+void streamBufferDelete(StreamBuffer *sbuf)
+{
+    if (!sbuf)
+        return;
+    streamBufferFree(sbuf);
+    free(sbuf);
+}
+
+/**
+ * Waits until the GPU is done with a frame region
+ *
+ * @param sbuf The stream buffer
+ * @param frame The region to wait for
+ */
+static void streamBufferWait(StreamBuffer *sbuf, int frame)
+{
+    GLsync fence = sbuf->fences[frame];
+    GLenum ret;
+
+    if (!fence)
+        return;
+    ret = glClientWaitSync(fence, 0, 0);
+    if (ret == GL_TIMEOUT_EXPIRED) {
+        sbuf->stats.syncWaits++;
+        do {
+            ret = glClientWaitSync(
+                    fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_WAIT_TIMEOUT);
+        } while (ret == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    sbuf->fences[frame] = 0;
+}
+
+/**
+ * Grows every frame region to at least minSize bytes.
+ * The old buffer is released; the driver keeps it alive until the
+ * GPU is done with it.
+ *
+ * @param sbuf The stream buffer
+ * @param minSize The minimum region size
+ * @return true on success
+ */
+static bool streamBufferGrow(StreamBuffer *sbuf, GLsizeiptr minSize)
+{
+    GLsizeiptr size = sbuf->frameSize * 2;
+
+    while (size < minSize)
+        size *= 2;
+    streamBufferFree(sbuf);
+    sbuf->frameSize = size;
+    sbuf->frame = 0;
+    sbuf->used = 0;
+
+    return streamBufferAlloc(sbuf);
+}
+
+void *streamBufferMap(StreamBuffer *sbuf, GLsizeiptr size, GLsizeiptr align,
+        GLintptr *offset)
+{
+    GLsizeiptr start;
+    void *ptr;
+
+    if (sbuf->mapped)
+        streamBufferUnmap(sbuf);
+
+    start = sbuf->used;
+    if (align > 1 && start % align)
+        start += align - start % align;
+    if (start + size > sbuf->frameSize) {
+        if (!streamBufferGrow(sbuf, start + size))
+            return NULL;
+        start = 0;
+    } else if (sbuf->used == 0) {
+        // first write in this region, make sure the GPU is done with it
+        if (sbuf->persistent) {
+            streamBufferWait(sbuf, sbuf->frame);
+        } else if (sbuf->frame == 0) {
+            // ring wrapped, let the driver give us fresh storage
+            glStateBindBuffer(sbuf->target, sbuf->id);
+            glBufferData(sbuf->target, sbuf->frameSize * sbuf->numFrames,
+                    NULL, GL_STREAM_DRAW);
+            sbuf->stats.bufferAllocs++;
+        }
+    }
+
+    *offset = sbuf->frame * sbuf->frameSize + start;
+    sbuf->used = start + size;
+    sbuf->stats.bytesUploaded += size;
+
+    if (sbuf->persistent)
+        return sbuf->ptr + *offset;
+
+    glStateBindBuffer(sbuf->target, sbuf->id);
+    ptr = glMapBufferRange(sbuf->target, *offset, size, STREAM_UNSYNC_FLAGS);
+    if (!ptr) {
+        fprintf(stderr, "streamBuffer: cannot map range\n");
+        return NULL;
+    }
+    sbuf->mapped = true;
+
+    return ptr;
+}
+
+void streamBufferUnmap(StreamBuffer *sbuf)
+{
+    if (!sbuf->mapped)
+        return;
+    glStateBindBuffer(sbuf->target, sbuf->id);
+    glUnmapBuffer(sbuf->target);
+    sbuf->mapped = false;
+}
+
+void streamBufferFrameEnd(StreamBuffer *sbuf)
+{
+    streamBufferUnmap(sbuf);
+    if (sbuf->persistent && sbuf->used > 0) {
+        if (sbuf->fences[sbuf->frame])
+            glDeleteSync(sbuf->fences[sbuf->frame]);
+        sbuf->fences[sbuf->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    if (sbuf->used > 0)
+        sbuf->frame = (sbuf->frame + 1) % sbuf->numFrames;
+    sbuf->used = 0;
+    memset(&sbuf->stats, 0, sizeof(sbuf->stats));
+}
@@ -0,0 +1,97 @@
+/**
+ * Streaming buffer - a GPU buffer split into a ring of per frame regions.
+ *
+ * Every frame writes into the next region, so the GPU can still read the
+ * previous frames while we fill the current one. When ARB_buffer_storage is
+ * available the whole buffer stays persistently mapped and each region is
+ * guarded by a fence; otherwise regions are mapped unsynchronized and the
+ * buffer is orphaned every time the ring wraps around.
+ */
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stdbool.h>
+#include <GL/glew.h>
+
+/* Maximum number of frames (regions) in the ring */
+#define STREAM_MAX_FRAMES 4
+
+typedef struct {
+    unsigned long bytesUploaded;    // bytes written this frame
+    int bufferAllocs;               // buffer (re)allocations/orphans this frame
+    int syncWaits;                  // times we waited on the GPU this frame
+} StreamStats;
+
+typedef struct {
+    GLenum target;          // GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER...
+    GLuint id;              // buffer object; changes if the buffer grows
+    GLsizeiptr frameSize;   // size in bytes of one region
+    int numFrames;          // number of regions in the ring
+    int frame;              // region we are writing into
+    GLsizeiptr used;        // bytes already handed out from this region
+    GLsync fences[STREAM_MAX_FRAMES]; // fence of each region, or 0
+    bool persistent;        // using a persistent, coherent mapping
+    bool mapped;            // fallback path: a range is currently mapped
+    unsigned char *ptr;     // persistent mapping base
+    StreamStats stats;      // counters of the current frame
+} StreamBuffer;
+
+/**
+ * Checks if the current context can stream through mapped buffers
+ *
+ * @return true if glMapBufferRange is available
+ */
+bool streamBufferSupported();
+
+/**
+ * Creates a new streaming buffer
+ *
+ * @param target Buffer target, like GL_ARRAY_BUFFER
+ * @param frameSize Initial size in bytes of each frame region
+ * @param numFrames Number of frames in the ring, 2 to STREAM_MAX_FRAMES
+ * @return a new StreamBuffer or NULL on error
+ */
+StreamBuffer *streamBufferNew(GLenum target, GLsizeiptr frameSize, int numFrames);
+
+/**
+ * Destroys the streaming buffer
+ *
+ * @param sbuf The buffer to destroy
+ */
+void streamBufferDelete(StreamBuffer *sbuf);
+
+/**
+ * @brief Gets a write pointer into the current frame region.
+ *
+ * Reserves size bytes from the current region and returns a pointer where
+ * the caller writes them. The memory is write only - do not read from it.
+ * If the region is too small the buffer grows, so sbuf->id may change and
+ * offsets returned earlier in the same frame are no longer valid.
+ * The buffer is left bound to its target.
+ *
+ * @param sbuf The stream buffer
+ * @param size Number of bytes to reserve
+ * @param align Alignment of the returned offset (eg. the vertex size)
+ * @param offset Where to store the byte offset of the data in the buffer
+ * @return the write pointer or NULL on error
+ */
+void *streamBufferMap(StreamBuffer *sbuf, GLsizeiptr size, GLsizeiptr align,
+        GLintptr *offset);
+
+/**
+ * Makes the data written since streamBufferMap visible to the GPU.
+ * Must be called before drawing from the buffer.
+ *
+ * @param sbuf The stream buffer
+ */
+void streamBufferUnmap(StreamBuffer *sbuf);
+
+/**
+ * Ends the current frame: fences the region that was just drawn from
+ * and moves to the next one, waiting for the GPU if it still uses it.
+ *
+ * @param sbuf The stream buffer
+ */
+void streamBufferFrameEnd(StreamBuffer *sbuf);
+
+#endif // STREAM_BUFFER_H
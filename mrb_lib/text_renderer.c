@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include "texture.h"
 #include "text_renderer.h"
+#include "arena.h"
 
 TextRenderer *trNew(char *texturePath, int numX, int numY, GLProgram *prog)
 {
@@ -23,11 +26,6 @@ TextRenderer *trNew(char *texturePath, int numX, int numY, GLProgram *prog)
         free(tr);
         return NULL;
     }
-    if (!(tr->sprites = arrayNew())) {
-        fprintf(stderr, "trNew: could not alocate sprites array\n");
-        textureDelete(tr->texture);
-        free(tr);
-    }
     tr->numX = numX;
     tr->numY = numY;
     tr->prog = prog;
@@ -41,18 +39,46 @@ TextRenderer *trNew(char *texturePath, int numX, int numY, GLProgram *prog)
         return NULL;
     }
     sbInit(tr->sb);
+    sbSetLayout(tr->sb, SB_LAYOUT_INDEXED);
+    // text is rebuilt every frame, stream it
+    sbSetUploadMode(tr->sb, SB_UPLOAD_STREAM);
+
+    if (!(tr->labels = arrayNew()) || !(tr->labelSb = sbNew(prog))) {
+        fprintf(stderr, "trNew: could not init the labels\n");
+        trDelete(tr);
+        return NULL;
+    }
+    sbInit(tr->labelSb);
+    sbSetLayout(tr->labelSb, SB_LAYOUT_INDEXED);
+    // rewritten only when a label or the camera changes
+    sbSetUploadMode(tr->labelSb, SB_UPLOAD_STATIC);
 
     return tr;
 }
 
+/**
+ * Frees a label
+ *
+ * @param label The label
+ */
+static void trLabelFree(TextLabel *label)
+{
+    free(label->text);
+    free(label->quads);
+    free(label);
+}
+
 void trDelete(TextRenderer *tr)
 {
-    Sprite *sp;
-    int i; 
+    TextLabel *label;
+    int i;
 
-    arrayForEach(tr->sprites, sp, i)
-        spriteDelete(sp);
-    arrayDelete(&tr->sprites);
+    if (tr->labels) {
+        arrayForEach(tr->labels, label, i)
+            trLabelFree(label);
+        arrayDelete(&tr->labels);
+    }
+    sbDelete(tr->labelSb);
     sbDelete(tr->sb);
     textureDelete(tr->texture);
     free(tr);
@@ -78,6 +104,205 @@ void trSetColor(TextRenderer *tr, Color color)
     tr->currColor = color;
 }
 
+/**
+ * Copies a string
+ *
+ * @param text The string
+ * @return the copy or NULL on no memory
+ */
+static char *trCopyText(const char *text)
+{
+    size_t n = strlen(text) + 1;
+    char *copy = malloc(n);
+
+    if (copy)
+        memcpy(copy, text, n);
+
+    return copy;
+}
+
+TextLabel *trLabelNew(TextRenderer *tr, int x, int y, const char *text)
+{
+    TextLabel *label;
+
+    if (!(label = calloc(1, sizeof(*label)))
+            || !(label->text = trCopyText(text))) {
+        fprintf(stderr, "trLabelNew: calloc\n");
+        free(label);
+        return NULL;
+    }
+    label->x = x;
+    label->y = y;
+    label->fontSize = tr->fontSize;
+    label->spacing = tr->spacing;
+    label->color = tr->currColor;
+    label->visible = true;
+    label->dirty = true;
+    arrayPush(tr->labels, label);
+    tr->labelsChanged = true;
+
+    return label;
+}
+
+void trLabelDelete(TextRenderer *tr, TextLabel *label)
+{
+    int idx;
+
+    if (!label)
+        return;
+    if ((idx = arrayIndexOf(tr->labels, label)) >= 0) {
+        arrayUnset(tr->labels, idx);
+        arrayCompact(tr->labels);
+    }
+    tr->labelsChanged = true;
+    trLabelFree(label);
+}
+
+bool trLabelSetText(TextLabel *label, const char *text)
+{
+    char *copy;
+
+    // labels like "FPS: 60" are set every frame but rarely change
+    if (!strcmp(label->text, text))
+        return true;
+    if (!(copy = trCopyText(text))) {
+        fprintf(stderr, "trLabelSetText: malloc\n");
+        return false;
+    }
+    free(label->text);
+    label->text = copy;
+    label->dirty = true;
+
+    return true;
+}
+
+void trLabelSetPos(TextLabel *label, int x, int y)
+{
+    if (label->x == x && label->y == y)
+        return;
+    label->x = x;
+    label->y = y;
+    label->dirty = true;
+}
+
+void trLabelSetFontSize(TextLabel *label, int fontSize)
+{
+    if (label->fontSize == fontSize)
+        return;
+    label->fontSize = fontSize;
+    label->dirty = true;
+}
+
+void trLabelSetColor(TextLabel *label, Color color)
+{
+    if (!memcmp(&label->color, &color, sizeof(color)))
+        return;
+    label->color = color;
+    label->dirty = true;
+}
+
+void trLabelSetVisible(TextLabel *label, bool visible)
+{
+    if (label->visible == visible)
+        return;
+    label->visible = visible;
+    label->dirty = true;
+}
+
+/**
+ * Writes the glyph quads of a label, in screen pixels with y up from
+ * the top of the screen, so the camera only scales and offsets them
+ *
+ * @param tr The text renderer
+ * @param label The label
+ * @return false on no memory, the label has no glyphs then
+ */
+static bool trLabelBuild(TextRenderer *tr, TextLabel *label)
+{
+    float uvW = 1.0f / tr->numX, uvH = 1.0f / tr->numY;
+    float size = label->fontSize, advance = size * label->spacing;
+    int i, len = strlen(label->text), idx, idy;
+    float x0, y0, x1, y1;
+    Vertex *q, *quads;
+    AABB uv;
+
+    label->dirty = false;
+    label->len = 0;
+    if (len > label->size) {
+        if (!(quads = realloc(label->quads, len * 4 * sizeof(*quads)))) {
+            fprintf(stderr, "Cannot alloc %d glyphs\n", len);
+            return false;
+        }
+        label->quads = quads;
+        label->size = len;
+    }
+
+    y1 = -label->y;
+    y0 = y1 - size;
+    for (i = 0, q = label->quads; i < len; i++, q += 4) {
+        idx = (unsigned char) label->text[i] % tr->numX;
+        idy = tr->numY - 1 - (unsigned char) label->text[i] / tr->numX;
+        uv = aabb(idx * uvW, idy * uvH, (idx + 1) * uvW, (idy + 1) * uvH);
+        x0 = label->x + advance * i;
+        x1 = x0 + size;
+        sbQuadVertices(q, x0, y0, x1, y1, label->color, uv);
+    }
+    label->len = len;
+
+    return true;
+}
+
+/**
+ * Places the cached quads of the visible labels in the camera view,
+ * unless neither the labels nor the view changed since the last time
+ *
+ * @param tr The text renderer
+ * @return false if there is nothing to draw
+ */
+static bool trBuildLabels(TextRenderer *tr)
+{
+    bool changed = tr->labelsChanged;
+    TextLabel *label;
+    float invScale;
+    int i, j, len = 0;
+    Vertex *v;
+    AABB view;
+
+    if (arrayLen(tr->labels) == 0)
+        return false;
+    arrayForEach(tr->labels, label, i) {
+        if (label->dirty) {
+            trLabelBuild(tr, label);
+            changed = true;
+        }
+        if (label->visible)
+            len += label->len;
+    }
+
+    view = cameraGetAABB(tr->camera);
+    if (!changed && !memcmp(&view, &tr->labelView, sizeof(view))
+            && sbKeepQuads(tr->labelSb))
+        return len > 0;
+    tr->labelView = view;
+    tr->labelsChanged = false;
+
+    invScale = 1.0f / tr->camera->scale;
+    if (!(v = sbMapQuads(tr->labelSb, len)))
+        return false;
+    arrayForEach(tr->labels, label, i) {
+        if (!label->visible)
+            continue;
+        for (j = 0; j < label->len * 4; j++, v++) {
+            *v = label->quads[j];
+            v->pos.x = view.minX + v->pos.x * invScale;
+            v->pos.y = view.maxY + v->pos.y * invScale;
+        }
+    }
+    sbCommitQuads(tr->labelSb, len, tr->texture->id, TR_DRAW_LAYER, false);
+
+    return len > 0;
+}
+
 int trTextAt(TextRenderer *tr, int x, int y, char *str)
 {
     int i;
@@ -92,7 +317,11 @@ int trTextAt(TextRenderer *tr, int x, int y, char *str)
         float posX = x / scale + caabb.minX + width * tr->spacing * i;
         float posY = caabb.maxY - y / scale - height;
 
-        Sprite *sp = spriteNew(posX, posY, width, height, tr->texture->id);
+        // letters only live until trRender, keep them in the frame arena
+        Sprite *sp = arenaAlloc(arenaFrame(), sizeof(*sp));
+        if (!sp)
+            return -1;
+        spriteInit(sp, posX, posY, width, height, tr->texture->id);
 
         int idx = str[i] % tr->numX;
         int idy = tr->numY - 1 - (str[i] / tr->numX);
@@ -100,8 +329,8 @@ int trTextAt(TextRenderer *tr, int x, int y, char *str)
         spriteSetUV(sp, uv);
 
         spriteSetColor(sp, &tr->currColor);
+        spriteSetDrawLayer(sp, TR_DRAW_LAYER);
 
-        arrayPush(tr->sprites, sp);
         sbAddSprite(tr->sb, sp);
     }
 
@@ -112,16 +341,70 @@ int trTextAt(TextRenderer *tr, int x, int y, char *str)
 
 void trRender(TextRenderer *tr)
 {
-    Sprite *sp;
-    int i;
+    if (trBuildLabels(tr))
+        sbDrawBatches(tr->labelSb);
 
     tr->sb->needsSort = false;
     sbBuildBatches(tr->sb);
     sbDrawBatches(tr->sb);
 
-    arrayForEach(tr->sprites, sp, i)
-        spriteDelete(sp);
-    arrayReset(tr->sprites);
+    // the letters go away with the frame arena
+    sbResetSprites(tr->sb);
+}
+
+bool trSetGPUTimer(TextRenderer *tr, bool enable)
+{
+    return sbSetGPUTimer(tr->sb, enable);
+}
+
+void trSubmit(TextRenderer *tr, RenderQueue *rq)
+{
+    if (trBuildLabels(tr))
+        rqSubmit(rq, tr->labelSb);
+
+    tr->sb->needsSort = false;
+    sbBuildBatches(tr->sb);
+    rqSubmit(rq, tr->sb);
+
     sbResetSprites(tr->sb);
 }
 
+
+#ifdef COMPILE_TESTS
+void trTest()
+{
+    TextRenderer tr = { .numX = 16, .numY = 16 };
+    TextLabel label = {
+        .x = 10, .y = 20, .fontSize = 8, .spacing = 0.5f,
+        .color = { 1, 2, 3, 4 }, .visible = true, .dirty = true
+    };
+    Vertex *q;
+
+    printf("Testing TextRenderer\n");
+    label.text = trCopyText("AB");
+    assert(trLabelBuild(&tr, &label));
+    assert(!label.dirty && label.len == 2 && label.size == 2);
+
+    // 'A' is 65: column 1 of row 4 from the top
+    q = label.quads;
+    assert(q[2].pos.x == 10 && q[2].pos.y == -28);
+    assert(q[0].pos.x == 18 && q[0].pos.y == -20);
+    assert(q[2].uv.u == 1 / 16.0f && q[2].uv.v == 11 / 16.0f);
+    assert(q[0].color.a == 4);
+    // letters advance by spacing * font size
+    assert(q[4 + 2].pos.x == 14);
+
+    // the same text is not rebuilt
+    assert(trLabelSetText(&label, "AB") && !label.dirty);
+    assert(trLabelSetText(&label, "") && label.dirty);
+    assert(trLabelBuild(&tr, &label) && label.len == 0 && label.size == 2);
+
+    trLabelSetColor(&label, label.color);
+    assert(!label.dirty);
+    trLabelSetPos(&label, 0, 0);
+    assert(label.dirty);
+
+    free(label.text);
+    free(label.quads);
+}
+#endif // COMPILE_TESTS
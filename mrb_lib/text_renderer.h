@@ -6,6 +6,24 @@
 #include "gl_program.h"
 #include "sprite_batch.h"
 #include "camera.h"
+#include "render_queue.h"
+
+/* Letters are drawn over the sprites of all the other layers */
+#define TR_DRAW_LAYER (SPRITE_DRAW_LAYERS - 1)
+
+/* A text kept from frame to frame, see trLabelNew. Its glyph quads are
+ * cached in screen pixels and only rebuilt when it changes. */
+typedef struct {
+    char *text;
+    int x, y;           // from the top left of the screen, in pixels
+    int fontSize;
+    float spacing;
+    Color color;
+    bool visible;
+    bool dirty;         // the quads do not match the fields above
+    Vertex *quads;      // 4 per glyph, x right and y up from the screen top
+    int len, size;      // glyphs, capacity of quads in glyphs
+} TextLabel;
 
 typedef struct {
     Texture *texture;   // Texture with all letters
@@ -15,8 +33,11 @@ typedef struct {
     int fontSize;       // Font size to use
     float spacing;      // Spacing between letters, 0.0 -> 1.0 ->
     SpriteBatch *sb;    // Sprite batch to use in draw
-    Array *sprites;     // All letters. Can be removed if using sprite-batch array
     Color currColor;    // Current drawing color
+    Array *labels;      // TextLabel *, drawn every frame
+    SpriteBatch *labelSb; // quads of the labels, kept while nothing moves
+    AABB labelView;     // camera view the label quads were placed in
+    bool labelsChanged; // a label was added or removed
 } TextRenderer;
 
 /**
@@ -63,9 +84,114 @@ void trSetColor(TextRenderer *tr, Color color);
  * Sets game camera, to be used by text
  */
 void trSetCamera(TextRenderer *tr, Camera *cam);
+
+/**
+ * Creates a text drawn every frame until deleted, with the current font
+ * size, spacing and color. Unlike trTextAt nothing is allocated or
+ * rebuilt while the label and the camera do not change.
+ *
+ * @param tr The text renderer
+ * @param x Position from the left of the screen, in pixels
+ * @param y Position from the top of the screen, in pixels
+ * @param text The text, copied
+ * @return a new TextLabel, owned by the renderer, or NULL on error
+ */
+TextLabel *trLabelNew(TextRenderer *tr, int x, int y, const char *text);
+
+/**
+ * Destroys a label
+ *
+ * @param tr The text renderer of the label
+ * @param label The label
+ */
+void trLabelDelete(TextRenderer *tr, TextLabel *label);
+
+/**
+ * Changes the text of a label, nothing is rebuilt if it is the same
+ *
+ * @param label The label
+ * @param text The text, copied
+ * @return false on error, the label keeps its text
+ */
+bool trLabelSetText(TextLabel *label, const char *text);
+
+/**
+ * Moves a label
+ *
+ * @param label The label
+ * @param x Position from the left of the screen, in pixels
+ * @param y Position from the top of the screen, in pixels
+ */
+void trLabelSetPos(TextLabel *label, int x, int y);
+
+/**
+ * Sets the font size of a label
+ *
+ * @param label The label
+ * @param fontSize The new font size
+ */
+void trLabelSetFontSize(TextLabel *label, int fontSize);
+
+/**
+ * Sets the color of a label
+ *
+ * @param label The label
+ * @param color Color to use color(r, g, b, a)
+ */
+void trLabelSetColor(TextLabel *label, Color color);
+
+/**
+ * Shows or hides a label, keeping its quads
+ *
+ * @param label The label
+ * @param visible false to hide it
+ */
+void trLabelSetVisible(TextLabel *label, bool visible);
+
+/**
+ * Queues a text to be drawn by trRender. The letters are allocated from
+ * the frame arena, so trRender must be called in the same frame.
+ *
+ * @param tr The text renderer
+ * @param x Position from the left of the screen, in pixels
+ * @param y Position from the top of the screen, in pixels
+ * @param text The text
+ * @return 0 on success, -1 on error
+ */
 int trTextAt(TextRenderer *tr, int x, int y, char *text);
 //AABB trGetBox(TextRenderer *tr, char *text);
+
+/**
+ * Draws the labels and the texts queued by trTextAt
+ *
+ * @param tr The text renderer
+ */
 void trRender(TextRenderer *tr);
 
+/**
+ * Builds the labels and the queued texts like trRender, but queues them to be drawn
+ * with the rest of the frame. The letters are forgotten, the vertices
+ * stay until the queue is flushed.
+ *
+ * @param tr The text renderer
+ * @param rq The render queue of the frame
+ */
+void trSubmit(TextRenderer *tr, RenderQueue *rq);
+
+/**
+ * Measures the GPU time of each trRender, see GPUTimer. The results
+ * are those of tr->sb->gpuTimer. Submitted texts are timed by the queue.
+ *
+ * @param tr The text renderer
+ * @param enable true to measure
+ * @return false if the context has no timer queries
+ */
+bool trSetGPUTimer(TextRenderer *tr, bool enable);
+
+/**
+ * Internal self test
+ */
+void trTest();
+
 #endif // TEXT_RENDERER_H
 
@@ -1,58 +1,98 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "texture.h"
 #include "file_get.h"
+#include "gl_state.h"
 #include "upng/upng.h"
 
-Texture *loadTexture(const char *filePath) 
+unsigned char *loadImage(const char *filePath, int *width, int *height)
 {
-    Texture *texture = NULL;
-    unsigned char *buff = NULL;
+    unsigned char *buff = NULL, *pixels = NULL;
     int size;
     if (!(buff = file_get(filePath, &size))) {
-        fprintf(stderr, "loadTexture: cannot open %s\n", filePath);
+        fprintf(stderr, "loadImage: cannot open %s\n", filePath);
         return NULL;
     }
 
     upng_t *png = upng_new_from_bytes(buff, size);
     if (!png) {
-        fprintf(stderr, "loadTexture: cannot convert the png file\n");
+        fprintf(stderr, "loadImage: cannot convert the png file\n");
         free(buff);
-        upng_free(png);
         return NULL;
     }
 
     upng_decode(png);
-    if (upng_get_error(png) == UPNG_EOK) {
-        if (!(texture = calloc(1, sizeof(Texture)))) {
-            fprintf(stderr, "loadTexture: cannot alloc texture\n");
-            return NULL;
-        }
-        texture->width = upng_get_width(png);
-        texture->height = upng_get_height(png);
-
-        glGenTextures(1, &texture->id);
-        glBindTexture(GL_TEXTURE_2D, texture->id);
-        // upload texture //
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                texture->width, texture->height,
-                0, GL_RGBA, GL_UNSIGNED_BYTE, upng_get_buffer(png));
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
+    if (upng_get_error(png) != UPNG_EOK) {
+        fprintf(stderr, "loadImage: cannot decode %s\n", filePath);
+    } else if (upng_get_format(png) != UPNG_RGBA8) {
+        fprintf(stderr, "loadImage: %s is not an RGBA png\n", filePath);
+    } else if (!(pixels = malloc(upng_get_size(png)))) {
+        fprintf(stderr, "loadImage: cannot alloc pixels\n");
+    } else {
+        memcpy(pixels, upng_get_buffer(png), upng_get_size(png));
+        *width = upng_get_width(png);
+        *height = upng_get_height(png);
     }
     upng_free(png);
     free(buff);
 
+    return pixels;
+}
+
+Texture *textureNew(int width, int height)
+{
+    Texture *texture = NULL;
+
+    if (!(texture = calloc(1, sizeof(Texture)))) {
+        fprintf(stderr, "textureNew: cannot alloc texture\n");
+        return NULL;
+    }
+    texture->width = width;
+    texture->height = height;
+    glGenTextures(1, &texture->id);
+
+    return texture;
+}
+
+void textureSetPixels(Texture *texture, const unsigned char *pixels,
+        bool mipmaps)
+{
+    glStateBindTexture(GL_TEXTURE_2D, texture->id);
+    // upload texture //
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+            texture->width, texture->height,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (mipmaps) {
+        glTexParameteri(GL_TEXTURE_2D,
+                GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    } else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+    glStateBindTexture(GL_TEXTURE_2D, 0);
+}
+
+Texture *loadTexture(const char *filePath) 
+{
+    Texture *texture = NULL;
+    unsigned char *pixels;
+    int width, height;
+
+    if (!(pixels = loadImage(filePath, &width, &height)))
+        return NULL;
+    if ((texture = textureNew(width, height)))
+        textureSetPixels(texture, pixels, true);
+    free(pixels);
+
     return texture;
 }
 
 void textureDelete(Texture *texture) 
 {
-    glDeleteTextures(1, &texture->id);
+    glStateDeleteTextures(1, &texture->id);
     free(texture);
 }
-
@@ -1,5 +1,6 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
+#include <stdbool.h>
 #include <GL/glew.h>
 
 typedef struct {
@@ -8,6 +9,36 @@ typedef struct {
     int height;
 } Texture;
 
+/**
+ * Reads and decodes a png file, without touching the GPU
+ *
+ * @param filePath Path to png file
+ * @param width Where to store the image width
+ * @param height Where to store the image height
+ * @return RGBA pixels, top row first, to be freed by the caller,
+ *  or NULL on failure
+ */
+unsigned char *loadImage(const char *filePath, int *width, int *height);
+
+/**
+ * Creates a texture object with no pixels yet
+ *
+ * @param width Texture width
+ * @param height Texture height
+ * @return a new Texture or NULL on failure
+ */
+Texture *textureNew(int width, int height);
+
+/**
+ * Uploads RGBA pixels to the texture
+ *
+ * @param texture The texture
+ * @param pixels width * height RGBA pixels
+ * @param mipmaps Generate mipmaps and use trilinear filtering
+ */
+void textureSetPixels(Texture *texture, const unsigned char *pixels,
+        bool mipmaps);
+
 /**
  * Read a texture from png file and uploads it to GPU
  *
@@ -23,4 +54,3 @@ Texture *loadTexture(const char *filePath);
 void textureDelete(Texture *texture);
 
 #endif // TEXTURE_H
-
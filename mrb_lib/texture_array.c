@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "texture_array.h"
+#include "texture.h"
+#include "gl_state.h"
+
+bool textureArraySupported()
+{
+    return GLEW_VERSION_3_0 || GLEW_EXT_texture_array;
+}
+
+TextureArray *textureArrayNew(int width, int height, int layers)
+{
+    TextureArray *ta;
+    GLint maxLayers = 0;
+
+    if (!textureArraySupported()) {
+        fprintf(stderr, "textureArrayNew: texture arrays not supported\n");
+        return NULL;
+    }
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if (layers <= 0 || (maxLayers > 0 && layers > maxLayers)) {
+        fprintf(stderr, "textureArrayNew: invalid number of layers %d\n",
+                layers);
+        return NULL;
+    }
+    if (!(ta = calloc(1, sizeof(*ta)))) {
+        fprintf(stderr, "Cannot alloc TextureArray\n");
+        return NULL;
+    }
+    ta->width = width;
+    ta->height = height;
+    ta->layers = layers;
+
+    glGenTextures(1, &ta->id);
+    glStateBindTexture(GL_TEXTURE_2D_ARRAY, ta->id);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,
+            GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glStateBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return ta;
+}
+
+void textureArrayDelete(TextureArray *ta)
+{
+    if (!ta)
+        return;
+    glStateDeleteTextures(1, &ta->id);
+    free(ta);
+}
+
+int textureArrayAddPixels(TextureArray *ta, const unsigned char *pixels)
+{
+    if (ta->len == ta->layers) {
+        fprintf(stderr, "textureArrayAddPixels: all %d layers used\n",
+                ta->layers);
+        return -1;
+    }
+    glStateBindTexture(GL_TEXTURE_2D_ARRAY, ta->id);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, ta->len,
+            ta->width, ta->height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glStateBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return ta->len++;
+}
+
+void textureArrayGenerateMipmaps(TextureArray *ta)
+{
+    glStateBindTexture(GL_TEXTURE_2D_ARRAY, ta->id);
+    // layers are independent, mipmaps never mix two images
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glStateBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+int textureArrayAddImage(TextureArray *ta, const char *filePath)
+{
+    unsigned char *pixels;
+    int width, height, layer = -1;
+
+    if (!(pixels = loadImage(filePath, &width, &height)))
+        return -1;
+    if (width != ta->width || height != ta->height)
+        fprintf(stderr, "textureArrayAddImage: %s is %dx%d, "
+                "the array layers are %dx%d\n", filePath,
+                width, height, ta->width, ta->height);
+    else
+        layer = textureArrayAddPixels(ta, pixels);
+    free(pixels);
+
+    return layer;
+}
+
+Sprite *textureArraySpriteNew(TextureArray *ta, int layer,
+        float x, float y, float width, float height)
+{
+    Sprite *sp;
+
+    if (!(sp = spriteNew(x, y, width, height, ta->id)))
+        return NULL;
+    spriteSetLayer(sp, layer);
+
+    return sp;
+}
@@ -0,0 +1,85 @@
+/**
+ * Texture arrays - images of the same size stored as the layers of one
+ * GL_TEXTURE_2D_ARRAY. Sprites using any layer share the same texture id,
+ * so they are drawn together, without the padding of an atlas.
+ */
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <stdbool.h>
+#include <GL/glew.h>
+#include "sprite.h"
+
+typedef struct {
+    GLuint id;              // GL_TEXTURE_2D_ARRAY object
+    int width, height;      // size of every layer
+    int layers;             // number of allocated layers
+    int len;                // number of used layers
+} TextureArray;
+
+/**
+ * Checks if the current context supports texture arrays
+ *
+ * @return true if GL_TEXTURE_2D_ARRAY can be used
+ */
+bool textureArraySupported();
+
+/**
+ * Creates an empty texture array
+ *
+ * @param width Width of each layer
+ * @param height Height of each layer
+ * @param layers Maximum number of layers
+ * @return a new TextureArray or NULL on error
+ */
+TextureArray *textureArrayNew(int width, int height, int layers);
+
+/**
+ * Destroys the texture array
+ *
+ * @param ta The texture array
+ */
+void textureArrayDelete(TextureArray *ta);
+
+/**
+ * Uploads RGBA pixels into the next free layer. The mipmaps are not
+ * updated, see textureArrayGenerateMipmaps.
+ *
+ * @param ta The texture array
+ * @param pixels ta->width * ta->height RGBA pixels, top row first
+ * @return the layer index or -1 if the array is full
+ */
+int textureArrayAddPixels(TextureArray *ta, const unsigned char *pixels);
+
+/**
+ * Loads a png file into the next free layer
+ *
+ * @param ta The texture array
+ * @param filePath Path to png file, must have the size of the layers
+ * @return the layer index or -1 on error
+ */
+int textureArrayAddImage(TextureArray *ta, const char *filePath);
+
+/**
+ * Generates the mipmaps of all the layers. Call it once the layers are
+ * loaded, the array cannot be sampled before.
+ *
+ * @param ta The texture array
+ */
+void textureArrayGenerateMipmaps(TextureArray *ta);
+
+/**
+ * Creates a sprite showing a layer of the array
+ *
+ * @param ta The texture array
+ * @param layer Layer index
+ * @param x Sprite position x
+ * @param y Sprite position y
+ * @param width Sprite width
+ * @param height Sprite height
+ * @return a new Sprite or NULL on error
+ */
+Sprite *textureArraySpriteNew(TextureArray *ta, int layer,
+        float x, float y, float width, float height);
+
+#endif // TEXTURE_ARRAY_H
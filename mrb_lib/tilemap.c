@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "tilemap.h"
+
+Tilemap *tilemapNew(GLProgram *prog, SBLayout layout, Tileset tileset,
+        int width, int height, float tileWidth, float tileHeight)
+{
+    Tilemap *tm;
+    float fw, fh;
+    int i, f;
+
+    if (layout != SB_LAYOUT_INDEXED && layout != SB_LAYOUT_INSTANCED) {
+        fprintf(stderr, "tilemapNew: indexed or instanced layout only\n");
+        return NULL;
+    }
+    if (width <= 0 || height <= 0 || tileset.cols <= 0 || tileset.rows <= 0
+            || tileset.cols * tileset.rows >= 65536) {
+        fprintf(stderr, "tilemapNew: invalid size %dx%d or tileset %dx%d\n",
+                width, height, tileset.cols, tileset.rows);
+        return NULL;
+    }
+    if (!(tm = calloc(1, sizeof(*tm)))) {
+        fprintf(stderr, "Cannot alloc Tilemap\n");
+        return NULL;
+    }
+    tm->width = width;
+    tm->height = height;
+    tm->tileWidth = tileWidth;
+    tm->tileHeight = tileHeight;
+    tm->tileset = tileset;
+    tm->numTiles = tileset.cols * tileset.rows + 1;
+    tm->prog = prog;
+    tm->layout = layout;
+    tm->dirty = true;
+    tm->tiles = calloc((size_t) width * height, sizeof(*tm->tiles));
+    tm->flags = malloc(tm->numTiles * sizeof(*tm->flags));
+    tm->uvs = malloc(tm->numTiles * sizeof(*tm->uvs));
+    if (!tm->tiles || !tm->flags || !tm->uvs) {
+        fprintf(stderr, "Cannot alloc %dx%d tiles\n", width, height);
+        tilemapDelete(tm);
+        return NULL;
+    }
+
+    // frames from the top left, like spriteSetFrame
+    fw = (tileset.region.maxX - tileset.region.minX) / tileset.cols;
+    fh = (tileset.region.maxY - tileset.region.minY) / tileset.rows;
+    tm->flags[TILE_EMPTY] = 0;
+    tm->uvs[TILE_EMPTY] = (AABB) { 0, 0, 0, 0 };
+    for (i = 1; i < tm->numTiles; i++) {
+        f = i - 1;
+        tm->flags[i] = TILE_SOLID;
+        tm->uvs[i] = aabb(
+                tileset.region.minX + f % tileset.cols * fw,
+                tileset.region.minY
+                    + (tileset.rows - 1 - f / tileset.cols) * fh,
+                tileset.region.minX + (f % tileset.cols + 1) * fw,
+                tileset.region.minY
+                    + (tileset.rows - f / tileset.cols) * fh);
+    }
+
+    return tm;
+}
+
+void tilemapDelete(Tilemap *tm)
+{
+    if (!tm)
+        return;
+    sbDelete(tm->sb);
+    free(tm->tiles);
+    free(tm->flags);
+    free(tm->uvs);
+    free(tm);
+}
+
+void tilemapMeasureString(const char *map, int *width, int *height)
+{
+    const char *line = map, *end;
+    int len;
+
+    *width = *height = 0;
+    while (*line) {
+        end = strchr(line, '\n');
+        len = end ? end - line : (int) strlen(line);
+        if (len > *width)
+            *width = len;
+        (*height)++;
+        if (!end)
+            break;
+        line = end + 1;
+    }
+}
+
+void tilemapLoadString(Tilemap *tm, const char *map,
+        const uint16_t charTiles[256])
+{
+    uint16_t *row;
+    int r, c;
+
+    memset(tm->tiles, 0, (size_t) tm->width * tm->height * sizeof(*tm->tiles));
+    for (r = 0; r < tm->height && *map; r++) {
+        row = tm->tiles + (size_t) r * tm->width;
+        for (c = 0; *map && *map != '\n'; c++, map++)
+            if (c < tm->width && charTiles[(unsigned char) *map] < tm->numTiles)
+                row[c] = charTiles[(unsigned char) *map];
+        if (*map == '\n')
+            map++;
+    }
+    tm->dirty = true;
+}
+
+void tilemapSetOrigin(Tilemap *tm, float x, float y)
+{
+    tm->origin.x = x;
+    tm->origin.y = y;
+    tm->dirty = true;
+}
+
+uint16_t tilemapGet(const Tilemap *tm, int col, int row)
+{
+    if (col < 0 || row < 0 || col >= tm->width || row >= tm->height)
+        return TILE_EMPTY;
+    return tm->tiles[(size_t) row * tm->width + col];
+}
+
+bool tilemapSet(Tilemap *tm, int col, int row, uint16_t tile)
+{
+    uint16_t *t;
+
+    if (col < 0 || row < 0 || col >= tm->width || row >= tm->height
+            || tile >= tm->numTiles)
+        return false;
+    t = &tm->tiles[(size_t) row * tm->width + col];
+    if (*t != tile) {
+        *t = tile;
+        tm->dirty = true;
+    }
+
+    return true;
+}
+
+void tilemapSetSolid(Tilemap *tm, uint16_t tile, bool solid)
+{
+    if (tile == TILE_EMPTY || tile >= tm->numTiles)
+        return;
+    if (solid)
+        tm->flags[tile] |= TILE_SOLID;
+    else
+        tm->flags[tile] &= ~TILE_SOLID;
+}
+
+void tilemapSetDrawLayer(Tilemap *tm, int drawLayer, bool opaque)
+{
+    if (drawLayer < 0 || drawLayer >= SPRITE_DRAW_LAYERS) {
+        fprintf(stderr, "Invalid draw layer: %d\n", drawLayer);
+        return;
+    }
+    tm->drawLayer = drawLayer;
+    tm->opaque = opaque;
+    tm->dirty = true;
+}
+
+bool tilemapTileAt(const Tilemap *tm, float x, float y, int *col, int *row)
+{
+    float c = floorf((x - tm->origin.x) / tm->tileWidth);
+    float r = floorf((y - tm->origin.y) / tm->tileHeight);
+
+    if (c < 0 || r < 0 || c >= tm->width || r >= tm->height)
+        return false;
+    *col = c;
+    *row = r;
+
+    return true;
+}
+
+/**
+ * Gets the tiles overlapping an area, clamped to the map
+ *
+ * @param tm The map
+ * @param box World area
+ * @param c0 Where to store the first column
+ * @param r0 Where to store the first row
+ * @param c1 Where to store the column after the last one
+ * @param r1 Where to store the row after the last one
+ * @return false if no tile overlaps
+ */
+static bool tilemapRange(const Tilemap *tm, AABB box,
+        int *c0, int *r0, int *c1, int *r1)
+{
+    // clamped as floats, the box can be far away
+    float minC = floorf((box.minX - tm->origin.x) / tm->tileWidth);
+    float minR = floorf((box.minY - tm->origin.y) / tm->tileHeight);
+    float maxC = ceilf((box.maxX - tm->origin.x) / tm->tileWidth);
+    float maxR = ceilf((box.maxY - tm->origin.y) / tm->tileHeight);
+
+    *c0 = minC < 0 ? 0 : minC > tm->width ? tm->width : minC;
+    *r0 = minR < 0 ? 0 : minR > tm->height ? tm->height : minR;
+    *c1 = maxC < 0 ? 0 : maxC > tm->width ? tm->width : maxC;
+    *r1 = maxR < 0 ? 0 : maxR > tm->height ? tm->height : maxR;
+
+    return *c0 < *c1 && *r0 < *r1;
+}
+
+int tilemapQuery(const Tilemap *tm, AABB box, TileHit *hits, int maxHits)
+{
+    const uint16_t *row;
+    int c, r, c0, r0, c1, r1, len = 0;
+
+    if (!tilemapRange(tm, box, &c0, &r0, &c1, &r1))
+        return 0;
+    for (r = r0; r < r1; r++) {
+        row = tm->tiles + (size_t) r * tm->width;
+        for (c = c0; c < c1; c++) {
+            if (!(tm->flags[row[c]] & TILE_SOLID))
+                continue;
+            if (len == maxHits)
+                return len;
+            hits[len].col = c;
+            hits[len].row = r;
+            hits[len].tile = row[c];
+            hits[len].bounds = aabb(
+                    tm->origin.x + c * tm->tileWidth,
+                    tm->origin.y + r * tm->tileHeight,
+                    tm->origin.x + (c + 1) * tm->tileWidth,
+                    tm->origin.y + (r + 1) * tm->tileHeight);
+            len++;
+        }
+    }
+
+    return len;
+}
+
+bool tilemapCollides(const Tilemap *tm, AABB box)
+{
+    TileHit hit;
+
+    return tilemapQuery(tm, box, &hit, 1) > 0;
+}
+
+/**
+ * Creates the batch of the quads, on the first draw
+ *
+ * @param tm The map
+ * @return false on error
+ */
+static bool tilemapNewBatch(Tilemap *tm)
+{
+    if (!(tm->sb = sbNew(tm->prog)))
+        return false;
+    sbInit(tm->sb);
+    if (!sbSetLayout(tm->sb, tm->layout)) {
+        sbDelete(tm->sb);
+        tm->sb = NULL;
+        return false;
+    }
+    // rebuilt only when the view leaves the built area or tiles change
+    sbSetUploadMode(tm->sb, SB_UPLOAD_STATIC);
+
+    return true;
+}
+
+/**
+ * Writes the quads of the non empty tiles of a range
+ *
+ * @param tm The map
+ * @param v Where to write, room for every tile of the range
+ * @return the number of quads written
+ */
+static int tilemapWriteQuads(Tilemap *tm, void *v,
+        int c0, int r0, int c1, int r1)
+{
+    const Color white = { 255, 255, 255, 255 };
+    const uint16_t *row;
+    Vertex *q = v;
+    SpriteInstance *inst = v;
+    float x0, y0, x1, y1;
+    AABB uv;
+    int c, r, n = 0;
+
+    for (r = r0; r < r1; r++) {
+        row = tm->tiles + (size_t) r * tm->width;
+        y0 = tm->origin.y + r * tm->tileHeight;
+        y1 = y0 + tm->tileHeight;
+        for (c = c0; c < c1; c++) {
+            if (row[c] == TILE_EMPTY)
+                continue;
+            uv = tm->uvs[row[c]];
+            x0 = tm->origin.x + c * tm->tileWidth;
+            x1 = x0 + tm->tileWidth;
+            if (tm->layout == SB_LAYOUT_INSTANCED) {
+                *inst++ = (SpriteInstance) { x0, y0, tm->tileWidth,
+                    tm->tileHeight, uv.minX, uv.minY, uv.maxX, uv.maxY,
+                    white };
+            } else {
+                sbQuadVertices(q, x0, y0, x1, y1, white, uv);
+                q += 4;
+            }
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Builds the quads of the tiles in view, with a margin, unless the
+ * last ones still cover the view
+ *
+ * @param tm The map
+ * @param view The visible area
+ * @return false if there is nothing to draw
+ */
+static bool tilemapBuild(Tilemap *tm, AABB view)
+{
+    float mx = (view.maxX - view.minX) * TILEMAP_VIEW_MARGIN;
+    float my = (view.maxY - view.minY) * TILEMAP_VIEW_MARGIN;
+    int c0, r0, c1, r1;
+    void *v;
+
+    if (!tm->sb && !tilemapNewBatch(tm))
+        return false;
+    if (!tilemapRange(tm, view, &c0, &r0, &c1, &r1))
+        return false;
+    if (!tm->dirty && c0 >= tm->builtCol && r0 >= tm->builtRow
+            && c1 <= tm->builtCol + tm->builtCols
+            && r1 <= tm->builtRow + tm->builtRows && sbKeepQuads(tm->sb))
+        return tm->builtQuads > 0;
+
+    view = aabb(view.minX - mx, view.minY - my, view.maxX + mx,
+            view.maxY + my);
+    tilemapRange(tm, view, &c0, &r0, &c1, &r1);
+    tm->builtCol = c0;
+    tm->builtRow = r0;
+    tm->builtCols = c1 - c0;
+    tm->builtRows = r1 - r0;
+    tm->builtQuads = 0;
+    tm->dirty = false;
+    if (!(v = sbMapQuads(tm->sb, tm->builtCols * tm->builtRows)))
+        return false;
+    tm->builtQuads = tilemapWriteQuads(tm, v, c0, r0, c1, r1);
+    sbCommitQuads(tm->sb, tm->builtQuads, tm->tileset.textureID,
+            tm->drawLayer, tm->opaque);
+
+    return tm->builtQuads > 0;
+}
+
+void tilemapDraw(Tilemap *tm, AABB view)
+{
+    if (tilemapBuild(tm, view))
+        sbDrawBatches(tm->sb);
+}
+
+void tilemapSubmit(Tilemap *tm, RenderQueue *rq, AABB view)
+{
+    if (tilemapBuild(tm, view))
+        rqSubmit(rq, tm->sb);
+}
+
+#ifdef COMPILE_TESTS
+void tilemapTest()
+{
+    const char *map =
+        "###\n"
+        "# .#\n"
+        "\n"
+        "#";
+    uint16_t charTiles[256] = { 0 };
+    Tileset tileset = { 1, { 0, 0, 1, 0.5f }, 2, 2 };
+    TileHit hits[8];
+    Tilemap *tm;
+    int w, h, col, row;
+
+    printf("Testing Tilemap\n");
+    tilemapMeasureString(map, &w, &h);
+    assert(w == 4 && h == 4);
+
+    charTiles['#'] = 1;
+    charTiles['.'] = 4;
+    assert((tm = tilemapNew(NULL, SB_LAYOUT_INDEXED, tileset, w, h, 10, 10)));
+    tilemapLoadString(tm, map, charTiles);
+    assert(tilemapGet(tm, 0, 0) == 1 && tilemapGet(tm, 2, 0) == 1);
+    assert(tilemapGet(tm, 3, 0) == TILE_EMPTY);
+    assert(tilemapGet(tm, 1, 1) == TILE_EMPTY && tilemapGet(tm, 2, 1) == 4);
+    assert(tilemapGet(tm, 0, 2) == TILE_EMPTY && tilemapGet(tm, 0, 3) == 1);
+    assert(tilemapGet(tm, -1, 0) == TILE_EMPTY);
+    assert(tilemapGet(tm, 4, 0) == TILE_EMPTY);
+
+    // frame 0 is the top left of the region, frame 3 its bottom right
+    assert(tm->uvs[1].minX == 0 && tm->uvs[1].minY == 0.25f);
+    assert(tm->uvs[4].minX == 0.5f && tm->uvs[4].maxY == 0.25f);
+
+    assert(tilemapTileAt(tm, 15, 5, &col, &row) && col == 1 && row == 0);
+    assert(!tilemapTileAt(tm, -1, 5, &col, &row));
+
+    // touching edges do not collide
+    assert(!tilemapCollides(tm, aabb(10, 10, 20, 20)));
+    assert(tilemapCollides(tm, aabb(9, 10, 20, 20)));
+    assert(tilemapQuery(tm, aabb(-100, -100, 100, 100), hits, 8) == 7);
+    assert(tilemapQuery(tm, aabb(15, 5, 25, 15), hits, 8) == 3);
+    assert(hits[0].col == 1 && hits[0].row == 0);
+    assert(hits[2].col == 2 && hits[2].row == 1 && hits[2].tile == 4);
+    assert(hits[2].bounds.minX == 20 && hits[2].bounds.maxY == 20);
+    assert(tilemapQuery(tm, aabb(15, 5, 25, 15), hits, 1) == 1);
+
+    tilemapSetSolid(tm, 4, false);
+    assert(tilemapQuery(tm, aabb(15, 5, 25, 15), hits, 8) == 2);
+    assert(tilemapSet(tm, 1, 1, 1) && !tilemapSet(tm, 1, 1, 5));
+    assert(tilemapCollides(tm, aabb(11, 11, 12, 12)));
+
+    tilemapDelete(tm);
+}
+#endif // COMPILE_TESTS
@@ -0,0 +1,206 @@
+/**
+ * Grid of tiles from one tileset: 2 bytes per tile, drawn by building
+ * the quads of the tiles in view, and queried for collisions without
+ * any object per tile.
+ */
+#ifndef TILEMAP_H
+#define TILEMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "aabb.h"
+#include "vertex.h"
+#include "sprite_batch.h"
+#include "render_queue.h"
+#include "gl_program.h"
+
+/* Tile value of an empty cell; other values are tileset frames + 1 */
+#define TILE_EMPTY 0
+/* Flags of a tile value, see tilemapSetSolid */
+#define TILE_SOLID 0x1
+/* The quads are built for this much more than the view on each side, as
+ * a fraction of its size, so small camera moves do not rebuild them */
+#define TILEMAP_VIEW_MARGIN 0.25f
+
+/* Images of the tiles: a grid of frames in a texture region */
+typedef struct {
+    GLuint textureID;
+    AABB region;        // UV of the frames in the texture, like AtlasRegion
+    int cols, rows;     // frames, numbered from the top left, row by row
+} Tileset;
+
+/* A solid tile overlapping a query, see tilemapQuery */
+typedef struct {
+    int col, row;
+    uint16_t tile;
+    AABB bounds;        // world area of the tile
+} TileHit;
+
+typedef struct {
+    int width, height;  // in tiles
+    float tileWidth, tileHeight;
+    Position origin;    // world position of the corner of tile 0, 0
+    uint16_t *tiles;    // width * height, row by row, row 0 at origin.y
+    Tileset tileset;
+    uint8_t *flags;     // TILE_* flags of each tile value
+    AABB *uvs;          // texture coordinates of each tile value
+    int numTiles;       // tile values, TILE_EMPTY included
+
+    GLProgram *prog;
+    SBLayout layout;
+    SpriteBatch *sb;    // quads of the tiles in view, NULL until drawn
+    int drawLayer;      // see spriteSetDrawLayer
+    bool opaque;        // see spriteSetOpaque
+    bool dirty;         // tiles changed since the quads were built
+    int builtCol, builtRow;     // first tile of the built quads
+    int builtCols, builtRows;   // tiles covered by the built quads
+    int builtQuads;     // non empty tiles among them
+} Tilemap;
+
+/**
+ * Creates an empty map. Every tile but TILE_EMPTY is solid.
+ *
+ * @param prog Program to draw with, matching the layout
+ * @param layout SB_LAYOUT_INDEXED or SB_LAYOUT_INSTANCED
+ * @param tileset Images of the tiles
+ * @param width Width in tiles
+ * @param height Height in tiles
+ * @param tileWidth Width of a tile in world units
+ * @param tileHeight Height of a tile in world units
+ * @return a new Tilemap or NULL on error
+ */
+Tilemap *tilemapNew(GLProgram *prog, SBLayout layout, Tileset tileset,
+        int width, int height, float tileWidth, float tileHeight);
+
+/**
+ * Destroys the map and its quads
+ *
+ * @param tm The map
+ */
+void tilemapDelete(Tilemap *tm);
+
+/**
+ * Gets the size of a text map: lines separated by '\n', the longest
+ * one gives the width
+ *
+ * @param map The text
+ * @param width Where to store the width, in characters
+ * @param height Where to store the height, in lines
+ */
+void tilemapMeasureString(const char *map, int *width, int *height);
+
+/**
+ * Sets all the tiles from a text map, line i to row i. Characters
+ * missing at the end of short lines and past the map are empty.
+ *
+ * @param tm The map
+ * @param map The text
+ * @param charTiles Tile value of each character, TILE_EMPTY for none
+ */
+void tilemapLoadString(Tilemap *tm, const char *map,
+        const uint16_t charTiles[256]);
+
+/**
+ * Moves the map
+ *
+ * @param tm The map
+ * @param x World position of the corner of tile 0, 0
+ * @param y World position of the corner of tile 0, 0
+ */
+void tilemapSetOrigin(Tilemap *tm, float x, float y);
+
+/**
+ * Gets a tile
+ *
+ * @return the tile value, TILE_EMPTY out of the map
+ */
+uint16_t tilemapGet(const Tilemap *tm, int col, int row);
+
+/**
+ * Sets a tile, the quads are rebuilt on the next draw
+ *
+ * @param tm The map
+ * @param col Column
+ * @param row Row
+ * @param tile Tile value, up to the number of tileset frames
+ * @return false out of the map or for an unknown tile value
+ */
+bool tilemapSet(Tilemap *tm, int col, int row, uint16_t tile);
+
+/**
+ * Sets if a tile value stops movement, see tilemapQuery
+ *
+ * @param tm The map
+ * @param tile The tile value
+ * @param solid true if solid
+ */
+void tilemapSetSolid(Tilemap *tm, uint16_t tile, bool solid);
+
+/**
+ * Draws the tiles with a draw layer and pass, like spriteSetDrawLayer
+ * and spriteSetOpaque
+ *
+ * @param tm The map
+ * @param drawLayer The draw layer
+ * @param opaque The tileset has no transparent pixels
+ */
+void tilemapSetDrawLayer(Tilemap *tm, int drawLayer, bool opaque);
+
+/**
+ * Gets the tile at a world position
+ *
+ * @param tm The map
+ * @param x World position
+ * @param y World position
+ * @param col Where to store the column
+ * @param row Where to store the row
+ * @return false if the position is out of the map
+ */
+bool tilemapTileAt(const Tilemap *tm, float x, float y, int *col, int *row);
+
+/**
+ * Finds the solid tiles overlapping an area; touching edges do not
+ * overlap
+ *
+ * @param tm The map
+ * @param box World area, like a moving entity
+ * @param hits Where to store the tiles, row by row
+ * @param maxHits Size of hits
+ * @return the number of tiles found, up to maxHits
+ */
+int tilemapQuery(const Tilemap *tm, AABB box, TileHit *hits, int maxHits);
+
+/**
+ * Tells if an area overlaps a solid tile
+ *
+ * @param tm The map
+ * @param box World area
+ * @return true if it does
+ */
+bool tilemapCollides(const Tilemap *tm, AABB box);
+
+/**
+ * Draws the tiles in view, rebuilding their quads when the map changed
+ * or the view left the built area
+ *
+ * @param tm The map
+ * @param view The visible area, like cameraGetAABB
+ */
+void tilemapDraw(Tilemap *tm, AABB view);
+
+/**
+ * Builds the tiles in view like tilemapDraw, but queues them to be
+ * drawn with the rest of the frame
+ *
+ * @param tm The map
+ * @param rq The render queue of the frame
+ * @param view The visible area, like cameraGetAABB
+ */
+void tilemapSubmit(Tilemap *tm, RenderQueue *rq, AABB view);
+
+/**
+ * Internal self test
+ */
+void tilemapTest();
+
+#endif // TILEMAP_H
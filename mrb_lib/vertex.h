@@ -21,6 +21,14 @@ typedef struct {
 	UV uv;
 } Vertex;
 
+/* 12 bytes vertex: position in whole units relative to an origin,
+ * see sbSetCompact, and UV normalized to 0-65535 */
+typedef struct {
+	GLshort x, y;
+	Color color;
+	GLushort u, v;
+} CompactVertex;
+
 int vertexSetPos(Vertex *v, float x, float y);
 int vertexSetColor(Vertex *v, float r, float g, float b, float a);
 int vertexSetUV(Vertex *vert, float u, float v);
@@ -2,10 +2,54 @@
 #include <GL/glew.h>
 #include "error.h"
 #include "window.h"
+#include "gl_state.h"
+
+/**
+ * Makes the offscreen render target and binds it as the framebuffer
+ *
+ * @param window The window, with a current context
+ * @return false if the context cannot do it
+ */
+static bool windowInitOffscreen(Window *window)
+{
+    GLenum status;
+
+    if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object) {
+        fprintf(stderr, "No framebuffer objects for offscreen rendering\n");
+        return false;
+    }
+    glGenRenderbuffers(1, &window->colorRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, window->colorRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8,
+            window->width, window->height);
+    // for the sprite draw layers, like the window depth buffer
+    glGenRenderbuffers(1, &window->depthRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, window->depthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+            window->width, window->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &window->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, window->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_RENDERBUFFER, window->colorRb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+            GL_RENDERBUFFER, window->depthRb);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Offscreen framebuffer incomplete: 0x%x\n", status);
+        return false;
+    }
+    glViewport(0, 0, window->width, window->height);
+
+    return true;
+}
 
 Window *windowNew(const char *title, int width, int height, int flags) 
 {
-    flags = 0;
+    Uint32 sdlFlags = SDL_WINDOW_OPENGL;
+    Uint32 sdlInit = SDL_INIT_EVERYTHING;
+    GLenum glewStatus;
     Window *window = calloc(1, sizeof(*window));
     if (!window) {
         fprintf(stderr, "Cannot alocate memory for window\n");
@@ -13,17 +57,30 @@ Window *windowNew(const char *title, int width, int height, int flags)
     }
     window->width = width;
     window->height = height;
+    window->flags = flags;
 
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    // for the sprite draw layers, see spriteSetDrawLayer
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16);
 
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+    if (flags & (WINDOW_HIDDEN | WINDOW_OFFSCREEN))
+        sdlFlags |= SDL_WINDOW_HIDDEN;
+    if (flags & WINDOW_OFFSCREEN) {
+        // no audio or input devices on a build machine
+        sdlInit = SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_EVENTS;
+#ifdef SDL_HINT_VIDEODRIVER
+        if (!getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY"))
+            SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+#endif
+    }
+    if (SDL_Init(sdlInit) < 0) {
         fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
         windowDelete(window);
         return NULL;
     }
     window->sdlWindow = SDL_CreateWindow(
             title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-            width, height, SDL_WINDOW_OPENGL | flags);
+            width, height, sdlFlags);
 
     if (window->sdlWindow == NULL) {
         fprintf(stderr, "Cannot create window: %s\n", SDL_GetError());
@@ -37,19 +94,32 @@ Window *windowNew(const char *title, int width, int height, int flags)
         return NULL;
     }
     glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
+    glewStatus = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // an EGL context without X: the GL entry points are loaded, only
+    // the GLX extensions are not
+    if (glewStatus == GLEW_ERROR_NO_GLX_DISPLAY)
+        glewStatus = GLEW_OK;
+#endif
+    if (glewStatus != GLEW_OK) {
         fprintf(stderr, "Cannot init glew\n");
         windowDelete(window);
         return NULL;
     }
     printf("--- OpenGL Version: %s ---\n", glGetString(GL_VERSION));
+    // a new context, nothing is known about its state
+    glStateReset();
+    if ((flags & WINDOW_OFFSCREEN) && !windowInitOffscreen(window)) {
+        windowDelete(window);
+        return NULL;
+    }
     windowSetClearColor(0, 0, 0.3, 1);
 
     // 1 for vsync, 0 for immediate update, -1 for late swap tearing
     SDL_GL_SetSwapInterval(0);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glStateEnable(GL_BLEND, true);
+    glStateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     return window;
 }
@@ -67,7 +137,19 @@ void windowClear()
 
 void windowUpdate(Window *window) 
 {
-    SDL_GL_SwapWindow(window->sdlWindow);
+    // nothing to show; wait for the frame so it is timed like a swap
+    // would, and frames do not pile up in the driver
+    if (window->fbo)
+        glFinish();
+    else
+        SDL_GL_SwapWindow(window->sdlWindow);
+}
+
+void windowReadPixels(Window *window, unsigned char *pixels)
+{
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, window->width, window->height, GL_RGBA,
+            GL_UNSIGNED_BYTE, pixels);
 }
 
 int windowSetUpdateInterval(int type)
@@ -82,6 +164,14 @@ void windowDelete(Window *window)
         return;
     }
 
+    if (window->fbo) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &window->fbo);
+    }
+    if (window->colorRb)
+        glDeleteRenderbuffers(1, &window->colorRb);
+    if (window->depthRb)
+        glDeleteRenderbuffers(1, &window->depthRb);
     SDL_GL_DeleteContext(window->glContext);
     SDL_DestroyWindow(window->sdlWindow);
     SDL_Quit();
@@ -2,24 +2,54 @@
 #define WINDOW_H
 
 #include <stdbool.h>
+#include <GL/glew.h>
 #include "SDL2/SDL.h"
 
+typedef enum {
+    WINDOW_NOFLAGS = 0,
+    WINDOW_HIDDEN = 1 << 0,     // the window is not shown
+    WINDOW_OFFSCREEN = 1 << 1,  // hidden, drawn into a framebuffer object
+} WindowFlags;
+
 typedef struct {
     int width, height;
+    int flags;              // WindowFlags
     SDL_Window *sdlWindow;
     SDL_GLContext glContext;
     SDL_Event event;
+    GLuint fbo;             // offscreen render target, or 0
+    GLuint colorRb, depthRb; // its color and depth renderbuffers
 } Window;
 
-enum {
-    WINDOW_NOFLAGS,
-    WINDOW_HIDDEN,
-} WindowFlags;
-
+/**
+ * @brief Creates a window and its GL context.
+ *
+ * With WINDOW_OFFSCREEN nothing is shown: the frames are drawn into a
+ * framebuffer object of the window size, whose pixels are all kept,
+ * unlike those of a hidden window. Without a display (no DISPLAY or
+ * WAYLAND_DISPLAY) SDL is asked for its "offscreen" EGL video driver,
+ * so it runs on build machines with Mesa software GL; SDL_VIDEODRIVER
+ * still takes precedence.
+ *
+ * @param title Window title
+ * @param width Width, in pixels
+ * @param height Height, in pixels
+ * @param flags WindowFlags, or'ed
+ * @return a new Window or NULL on error
+ */
 Window *windowNew(const char *title, int width, int height, int flags);
 void windowSetClearColor(float r, float g, float b, float a);
 void windowClear();
 void windowUpdate(Window *window);
+
+/**
+ * Reads the pixels of the frame being drawn, before windowUpdate,
+ * from the offscreen target or the back buffer
+ *
+ * @param window The window
+ * @param pixels width * height RGBA pixels, bottom row first
+ */
+void windowReadPixels(Window *window, unsigned char *pixels);
 int windowSetUpdateInterval(int type);
 void windowDelete(Window *window);
 
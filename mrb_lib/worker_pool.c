@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "worker_pool.h"
+
+int workerPoolCpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int) n : 1;
+}
+
+/**
+ * Takes and processes slices of the current job until none is left
+ *
+ * @param pool The pool
+ */
+static void workerPoolRunSlices(WorkerPool *pool)
+{
+    WorkerFn fn;
+    void *arg;
+    int slice, first, last;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nextSlice < pool->numSlices) {
+        slice = pool->nextSlice++;
+        fn = pool->fn;
+        arg = pool->arg;
+        first = (long) pool->len * slice / pool->numSlices;
+        last = (long) pool->len * (slice + 1) / pool->numSlices;
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(arg, first, last - first);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *workerPoolThread(void *data)
+{
+    WorkerPool *pool = data;
+    unsigned long job = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->job == job && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        job = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        workerPoolRunSlices(pool);
+    }
+
+    return NULL;
+}
+
+WorkerPool *workerPoolNew(int numThreads)
+{
+    WorkerPool *pool;
+    int i;
+
+    if (numThreads <= 0)
+        numThreads = workerPoolCpus() - 1;
+    if (numThreads > WP_MAX_THREADS)
+        numThreads = WP_MAX_THREADS;
+    if (!(pool = calloc(1, sizeof(*pool)))) {
+        fprintf(stderr, "Cannot alloc WorkerPool\n");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i < numThreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, workerPoolThread, pool)) {
+            fprintf(stderr, "workerPoolNew: cannot start thread %d\n", i);
+            break;
+        }
+        pool->numThreads++;
+    }
+
+    return pool;
+}
+
+void workerPoolDelete(WorkerPool *pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->numThreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void workerPoolRun(WorkerPool *pool, WorkerFn fn, void *arg, int len,
+        int minSlice)
+{
+    int numSlices;
+
+    if (len <= 0)
+        return;
+    numSlices = pool ? pool->numThreads + 1 : 1;
+    if (minSlice > 0 && len / minSlice < numSlices)
+        numSlices = len / minSlice;
+    if (numSlices <= 1) {
+        fn(arg, 0, len);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->len = len;
+    pool->numSlices = numSlices;
+    pool->nextSlice = 0;
+    pool->pending = numSlices;
+    pool->job++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    workerPoolRunSlices(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#ifdef COMPILE_TESTS
+/**
+ * Test job: adds one to every item of the range
+ */
+static void workerPoolTestFn(void *arg, int first, int count)
+{
+    int *items = arg;
+    int i;
+
+    for (i = first; i < first + count; i++)
+        items[i]++;
+}
+
+void workerPoolTest()
+{
+    WorkerPool *pool;
+    int items[10000] = {0};
+    int i, run;
+
+    printf("Testing WorkerPool\n");
+    assert((pool = workerPoolNew(3)));
+    assert(pool->numThreads == 3);
+
+    // every item is processed exactly once, whatever the slicing
+    for (run = 0; run < 100; run++)
+        workerPoolRun(pool, workerPoolTestFn, items, 10000, run % 7);
+    workerPoolRun(pool, workerPoolTestFn, items, 10, 1000);
+    workerPoolRun(NULL, workerPoolTestFn, items, 10000, 1);
+    for (i = 0; i < 10000; i++)
+        assert(items[i] == (i < 10 ? 102 : 101));
+
+    workerPoolDelete(pool);
+}
+#endif // COMPILE_TESTS
@@ -0,0 +1,82 @@
+/**
+ * A persistent pool of worker threads, to split a loop in slices
+ * processed in parallel. The calling thread works on slices too.
+ */
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Most threads a pool can have */
+#define WP_MAX_THREADS 32
+
+/**
+ * Processes the items [first, first + count) of a job.
+ * Called from several threads at once, for different ranges.
+ */
+typedef void (*WorkerFn)(void *arg, int first, int count);
+
+typedef struct {
+    pthread_t threads[WP_MAX_THREADS];
+    int numThreads;         // worker threads, not counting the caller
+    pthread_mutex_t lock;
+    pthread_cond_t start;   // a new job was posted
+    pthread_cond_t done;    // the last slice of the job finished
+    unsigned long job;      // incremented on every job
+    bool quit;              // the workers must exit
+
+    // current job, protected by lock
+    WorkerFn fn;
+    void *arg;
+    int len;                // number of items
+    int numSlices;          // the items are split in this many slices
+    int nextSlice;          // next slice nobody took yet
+    int pending;            // slices not finished yet
+} WorkerPool;
+
+/**
+ * Gets the number of online CPUs
+ *
+ * @return the number of CPUs, at least 1
+ */
+int workerPoolCpus();
+
+/**
+ * Creates a pool and starts its threads
+ *
+ * @param numThreads Number of worker threads, 0 for one less than
+ *  the number of CPUs (the caller is the last one)
+ * @return a new WorkerPool or NULL on error
+ */
+WorkerPool *workerPoolNew(int numThreads);
+
+/**
+ * Stops the threads and destroys the pool
+ *
+ * @param pool The pool
+ */
+void workerPoolDelete(WorkerPool *pool);
+
+/**
+ * @brief Runs fn over len items and waits until all of them are done.
+ *
+ * The items are split in contiguous slices, one per thread including the
+ * caller, but not smaller than minSlice items. Small jobs run on the
+ * calling thread only. Not reentrant: one job at a time per pool.
+ *
+ * @param pool The pool, or NULL to run on the calling thread
+ * @param fn Function processing a range of items
+ * @param arg Argument passed to fn
+ * @param len Number of items
+ * @param minSlice Minimum number of items in a slice
+ */
+void workerPoolRun(WorkerPool *pool, WorkerFn fn, void *arg, int len,
+        int minSlice);
+
+/**
+ * Internal self test
+ */
+void workerPoolTest();
+
+#endif // WORKER_POOL_H
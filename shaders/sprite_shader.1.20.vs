@@ -12,15 +12,19 @@ varying vec2 fragmentPosition;
 varying vec2 fragmentUV;
 
 uniform mat4 P;
+uniform float depth;  // of the sprite draw layer, see spriteSetDrawLayer
+uniform vec2 origin;  // of compact vertex positions, see sbSetCompact
 
 void main()
 {
-	gl_Position.xy = (P * vec4(vertexPosition, 0.0, 1.0)).xy;
-	gl_Position.z = 0.0;
+	vec2 position = vertexPosition + origin;
+
+	gl_Position.xy = (P * vec4(position, 0.0, 1.0)).xy;
+	gl_Position.z = depth;
 	gl_Position.w = 1.0;
 
 	fragmentColor = vertexColor;
-	fragmentPosition = vertexPosition;
+	fragmentPosition = position;
 	fragmentUV = vertexUV;
 }
 
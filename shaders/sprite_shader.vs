@@ -6,21 +6,26 @@
 in vec2 vertexPosition;
 in vec4 vertexColor;
 in vec2 vertexUV;
+in float drawDepth;   // of the layer in multi-draw mode, see sbSetMultiDraw
 
 out vec4 fragmentColor;
 out vec2 fragmentPosition;
 out vec2 fragmentUV;
 
 uniform mat4 P;
+uniform float depth;  // of the sprite draw layer, see spriteSetDrawLayer
+uniform vec2 origin;  // of compact vertex positions, see sbSetCompact
 
 void main()
 {
-	gl_Position.xy = (P * vec4(vertexPosition, 0.0, 1.0)).xy;
-	gl_Position.z = 0.0;
+	vec2 position = vertexPosition + origin;
+
+	gl_Position.xy = (P * vec4(position, 0.0, 1.0)).xy;
+	gl_Position.z = depth + drawDepth;
 	gl_Position.w = 1.0;
 
 	fragmentColor = vertexColor;
-	fragmentPosition = vertexPosition;
+	fragmentPosition = position;
 	fragmentUV = vertexUV;
 }
 
@@ -0,0 +1,19 @@
+#version 130
+
+// ->
+in vec2 fragmentPosition;
+in vec4 fragmentColor;
+in vec2 fragmentUV;
+in float fragmentLayer;
+
+out vec4 color;
+
+uniform sampler2DArray mySampler;
+
+void main()
+{
+
+	vec4 textureColor = texture(mySampler,
+			vec3(fragmentUV.x, -fragmentUV.y, fragmentLayer));
+	color = fragmentColor * textureColor;
+}
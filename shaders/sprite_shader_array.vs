@@ -0,0 +1,31 @@
+// vertex shader, texture array mode
+#version 130
+
+// specify inputs
+
+in vec2 vertexPosition;
+in vec4 vertexColor;
+in vec2 vertexUV;
+in float drawDepth;   // of the layer in multi-draw mode, see sbSetMultiDraw
+in float vertexLayer;
+
+out vec4 fragmentColor;
+out vec2 fragmentPosition;
+out vec2 fragmentUV;
+out float fragmentLayer;
+
+uniform mat4 P;
+uniform float depth;  // of the sprite draw layer, see spriteSetDrawLayer
+
+void main()
+{
+	gl_Position.xy = (P * vec4(vertexPosition, 0.0, 1.0)).xy;
+	gl_Position.z = depth + drawDepth;
+	gl_Position.w = 1.0;
+
+	fragmentColor = vertexColor;
+	fragmentPosition = vertexPosition;
+	fragmentUV = vertexUV;
+	fragmentLayer = vertexLayer;
+}
+
@@ -0,0 +1,30 @@
+// instanced vertex shader
+#version 130
+
+// one record per sprite (see SpriteInstance), expanded to a quad
+
+in vec4 instanceRect;   // x, y, width, height
+in vec4 instanceColor;
+in vec4 instanceUV;     // minU, minV, maxU, maxV
+
+out vec4 fragmentColor;
+out vec2 fragmentPosition;
+out vec2 fragmentUV;
+
+uniform mat4 P;
+uniform float depth;  // of the sprite draw layer, see spriteSetDrawLayer
+
+void main()
+{
+	// triangle strip corners: (0, 0) (1, 0) (0, 1) (1, 1)
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 position = instanceRect.xy + corner * instanceRect.zw;
+
+	gl_Position.xy = (P * vec4(position, 0.0, 1.0)).xy;
+	gl_Position.z = depth;
+	gl_Position.w = 1.0;
+
+	fragmentColor = instanceColor;
+	fragmentPosition = position;
+	fragmentUV = mix(instanceUV.xy, instanceUV.zw, corner);
+}